@@ -0,0 +1,44 @@
+#!/bin/bash
+#
+# Measures encode and decode throughput across read/write buffer sizes.
+#
+# Usage: ./scripts/bench_io.sh [file] [encode flags...]
+#
+# Without a file, a 256MB base64 sample is generated. Every size is run 3 times and the best time is kept, with
+# the input in the page cache, so the numbers show the cost of the syscalls rather than of the disk. Pass '-d'
+# or '-n' as encode flags to measure the O_DIRECT and no-cache paths instead.
+
+set -e
+cd "$(dirname "$0")/.."
+make -s encode decode
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+input=${1:-$dir/sample}
+shift || true
+if [ ! -f "$input" ]; then
+    base64 /dev/urandom | head -c 268435456 > "$input"
+fi
+bytes=$(stat -c %s "$input")
+
+# Prints the best of 3 wall-clock times of a command, in nanoseconds
+best() {
+    local fastest=0
+    for run in 1 2 3; do
+        local start=$(date +%s%N)
+        "$@" > /dev/null
+        local elapsed=$(($(date +%s%N) - start))
+        if [ $fastest -eq 0 ] || [ $elapsed -lt $fastest ]; then
+            fastest=$elapsed
+        fi
+    done
+    echo $fastest
+}
+
+printf "%-10s %14s %14s\n" "buffer" "encode MB/s" "decode MB/s"
+for size in 4K 16K 64K 256K 1M 4M 16M 64M; do
+    encode=$(best ./encode -b $size "$@" -i "$input" -o "$dir/out.huf")
+    decode=$(best ./decode -b $size -i "$dir/out.huf")
+    awk -v size=$size -v bytes=$bytes -v encode=$encode -v decode=$decode \
+        'BEGIN { printf "%-10s %14.1f %14.1f\n", size, bytes * 1000 / encode, bytes * 1000 / decode }'
+done
@@ -0,0 +1,63 @@
+#!/bin/bash
+#
+# Cross-checks the vector kernels against the scalar reference kernels.
+#
+# Usage: ./scripts/check_simd.sh [file...]
+#
+# Every input is encoded and decoded with HUFF_SIMD set to scalar, avx2 and avx512, with and without '-m'. The
+# streams of every level must match the scalar stream byte for byte, and every level must decode every stream
+# back to the input. Without files, a few inputs are generated: random, text, skewed, a single byte, empty, and
+# sizes just off a block boundary. Levels the CPU lacks fall back to the widest one it has.
+
+set -e
+cd "$(dirname "$0")/.."
+make -s encode decode
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+inputs=("$@")
+if [ ${#inputs[@]} -eq 0 ]; then
+    head -c 3000000 /dev/urandom > "$dir/random"
+    base64 /dev/urandom | head -c 2000000 > "$dir/text"
+    head -c 1000000 /dev/urandom | tr '\200-\377' '\000' > "$dir/skewed"
+    printf 'x' > "$dir/one"
+    : > "$dir/empty"
+    head -c 65535 "$dir/text" > "$dir/block-1"
+    head -c 65537 "$dir/text" > "$dir/block+1"
+    inputs=("$dir/random" "$dir/text" "$dir/skewed" "$dir/one" "$dir/empty" "$dir/block-1" "$dir/block+1")
+fi
+
+failed=0
+# Reports a mismatch and carries on, so that one run shows every failing combination
+mismatch() {
+    echo "MISMATCH: $*" >&2
+    failed=1
+}
+
+for input in "${inputs[@]}"; do
+    name=$(basename "$input")
+    for flags in "" "-m"; do
+        rm -f "$dir"/*.huf
+        for level in scalar avx2 avx512; do
+            HUFF_SIMD=$level ./encode $flags -i "$input" -o "$dir/$level.huf" \
+                || mismatch "$name [$flags] encode failed at $level"
+            if [ $level != scalar ] && ! cmp -s "$dir/scalar.huf" "$dir/$level.huf"; then
+                mismatch "$name [$flags] $level stream differs from scalar"
+            fi
+        done
+        for level in scalar avx2 avx512; do
+            for stream in scalar avx2 avx512; do
+                HUFF_SIMD=$level ./decode -i "$dir/$stream.huf" -o "$dir/out" \
+                    || mismatch "$name [$flags] $level failed to decode the $stream stream"
+                cmp -s "$input" "$dir/out" || mismatch "$name [$flags] $level decodes the $stream stream wrongly"
+            done
+        done
+        echo "$name [${flags:-no flags}]: checked"
+    done
+done
+
+if [ $failed -ne 0 ]; then
+    echo "FAILED: the vector kernels disagree with the scalar reference" >&2
+    exit 1
+fi
+echo "All levels agree"
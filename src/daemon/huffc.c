@@ -0,0 +1,130 @@
+#include "protocol.h"
+#include "../defines.h"
+#include "../huffman/filter.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define OPTIONS "hdcmtrkf:s:i:o:"
+
+enum Files { INFILE, OUTFILE };
+
+void help_message(char *error, int files[2]);
+void close_files(int files[2]);
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    uint32_t op = OP_COMPRESS, flags = 0;
+    char *path = SOCKET_PATH;
+    int files[2] = { STDIN_FILENO, STDOUT_FILENO };
+    // Checks all flags
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'd': op = OP_DECOMPRESS; break;
+        case 'c': flags |= FLAG_CHECKSUM; break;
+        case 'm': flags |= FLAG_STREAMS; break;
+        case 't': flags |= FLAG_TANS; break;
+        case 'r': flags |= FLAG_RLE; break;
+        case 'k': flags |= FLAG_COUNTS; break;
+        case 'f':
+            if (!set_filter(optarg, &flags)) {
+                help_message("Invalid filter.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 's': path = optarg; break;
+        case 'i':
+            if ((files[INFILE] = open(optarg, O_RDONLY)) < 0) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o':
+            if ((files[OUTFILE] = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+                help_message("Invalid file.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h': help_message("", files); return EXIT_SUCCESS;
+        default: help_message("", files); return EXIT_FAILURE;
+        }
+    }
+    // Reads the whole infile into memory
+    Buffer in = { NULL, 0, 0 }, out = { NULL, 0, 0 };
+    ssize_t curr_read = 1;
+    while (curr_read > 0 && buffer_reserve(&in, in.size + BLOCK)) {
+        curr_read = read(files[INFILE], &in.data[in.size], in.capacity - in.size);
+        in.size += curr_read > 0 ? curr_read : 0;
+    }
+    int connection = connect_socket(path);
+    Response response;
+    int status = EXIT_FAILURE;
+    if (connection < 0) {
+        perror("Unable to reach huffd");
+    } else if (!call(connection, op, flags, in.data, in.size, &response, &out)) {
+        fprintf(stderr, "Lost connection to huffd.\n");
+    } else if (response.status != STATUS_OK) {
+        out.data[out.size] = '\0';
+        fprintf(stderr, "%s\n", (char *) out.data);
+    } else {
+        uint64_t written = 0;
+        ssize_t value = 1;
+        while (written < out.size && value > 0) {
+            value = write(files[OUTFILE], &out.data[written], out.size - written);
+            written += value > 0 ? value : 0;
+        }
+        status = written == out.size ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (connection >= 0) {
+        close(connection);
+    }
+    buffer_free(&in);
+    buffer_free(&out);
+    close_files(files);
+    return status;
+}
+
+//
+// Closes file descriptors.
+//
+// files: an array of file descriptors
+//
+void close_files(int files[2]) {
+    if (files[INFILE] != STDIN_FILENO) {
+        close(files[INFILE]);
+    }
+    if (files[OUTFILE] != STDOUT_FILENO) {
+        close(files[OUTFILE]);
+    }
+    return;
+}
+
+//
+// Prints out the help message that describes how to use the program
+//
+void help_message(char *error, int files[2]) {
+    if (*error != '\0') {
+        fprintf(stderr, "%s", error);
+    }
+    close_files(files);
+    fprintf(stderr, "SYNOPSIS\n"
+                    "  A client for the Huffman compression daemon.\n"
+                    "  Compresses (or decompresses) a file through huffd.\n\n"
+                    "USAGE\n"
+                    "  ./huffc [-hdcmtrk] [-f filter] [-s socket] [-i infile] [-o outfile]\n\n"
+                    "OPTIONS\n"
+                    "  -h             Program usage and help.\n"
+                    "  -d             Decompress instead of compressing.\n"
+                    "  -c             Compress with CRC32C checksums.\n"
+                    "  -m             Compress every block into 4 bitstreams.\n"
+                    "  -t             Compress blocks with tANS wherever that is smaller.\n"
+                    "  -r             Run-length code blocks before compressing them (default: when\n"
+                    "                 one symbol dominates the file and its runs code smaller).\n"
+                    "  -k             Store the count of every byte value in every block.\n"
+                    "  -f filter      Transform blocks before compressing them: delta[:N] or shuffle[:N].\n"
+                    "  -s socket      Path of the daemon's socket (default: " SOCKET_PATH ").\n"
+                    "  -i infile      Input file.\n"
+                    "  -o outfile     Output file.\n");
+    return;
+}
@@ -0,0 +1,434 @@
+#include "protocol.h"
+#include "../huffman/batch.h"
+#include "../utils/pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTIONS      "hvs:t:"
+#define IDLE_TIMEOUT 30 // Seconds a half-received request or half-sent response may stall before it is dropped.
+#define WARM_SIZE    (1 << 22) // Largest buffers a connection keeps between requests.
+
+enum States { RECEIVING, WORKING, SENDING };
+
+// A client connection. The main thread receives its requests and sends its responses without blocking,
+// and only a complete request is handed to a worker, so idle or slow clients never hold a worker.
+typedef struct Connection {
+    int fd;
+    uint32_t state;
+    bool closing; // Whether to close the connection once its response is sent.
+    uint64_t done; // Bytes of the request (header and payload) received, or of the response sent.
+    time_t active; // When bytes last moved.
+    Request request;
+    Response response;
+    uint8_t *reply; // The payload of the response: out's data or an error message.
+    Buffer in;
+    Buffer out;
+    struct Connection *next; // The next connection in the queue of finished requests.
+} Connection;
+
+static TableCache *cache;
+static volatile sig_atomic_t stopping = 0;
+static pthread_mutex_t finished_lock = PTHREAD_MUTEX_INITIALIZER;
+static Connection *finished = NULL; // Requests the workers are done with, for the main thread to send.
+static int wakeup[2] = { -1, -1 }; // Written to by a worker when it finishes a request.
+
+void help_message(char *error);
+bool claim_socket(struct sockaddr_un *address);
+void serve(void *arg, uint32_t worker);
+void stop(int signal);
+void respond(Connection *c, const char *error);
+bool receive_request(Connection *c, Pool *pool);
+bool send_response(Connection *c);
+void close_after(Connection *c);
+void drop(Connection *c);
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    bool stats = false;
+    char *path = SOCKET_PATH;
+    uint32_t threads = sysconf(_SC_NPROCESSORS_ONLN);
+    // Checks all flags
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'v': stats = true; break;
+        case 's': path = optarg; break;
+        case 't': threads = batch_threads(optarg); break;
+        case 'h': help_message(""); return EXIT_SUCCESS;
+        default: help_message(""); return EXIT_FAILURE;
+        }
+    }
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (threads == 0 || strlen(path) >= sizeof(address.sun_path)) {
+        help_message("Invalid thread count or socket path.\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, path);
+
+    if (!claim_socket(&address)) {
+        fprintf(stderr, "%s is in use or is not a socket left behind by huffd.\n", path);
+        return EXIT_FAILURE;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0
+        || listen(listener, SOMAXCONN) < 0 || fcntl(listener, F_SETFL, O_NONBLOCK) < 0) {
+        perror("Unable to listen on socket");
+        return EXIT_FAILURE;
+    }
+    // Every worker can hold two tables (a member's and the one its blocks switched to) while the rest
+    // stay cached
+    cache = cache_create(2 * threads + 64);
+    Pool *pool = pool_create(threads);
+    if (!cache || !pool || pipe(wakeup) < 0 || fcntl(wakeup[0], F_SETFL, O_NONBLOCK) < 0
+        || fcntl(wakeup[1], F_SETFL, O_NONBLOCK) < 0) {
+        fprintf(stderr, "Unable to start %" PRIu32 " workers.\n", threads);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    // Interrupt poll() on SIGINT/SIGTERM instead of restarting it
+    struct sigaction action = { .sa_handler = stop };
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Slots 0 and 1 of the poll set are the wakeup pipe and the listener, and polled names the connection
+    // in every other slot
+    uint32_t nconnections = 0, capacity = 64;
+    Connection **connections = (Connection **) malloc(capacity * sizeof(Connection *));
+    Connection **polled = (Connection **) malloc((capacity + 2) * sizeof(Connection *));
+    struct pollfd *fds = (struct pollfd *) malloc((capacity + 2) * sizeof(struct pollfd));
+    if (!connections || !polled || !fds) {
+        fprintf(stderr, "Unable to allocate connection table.\n");
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    // Once stopping, take no new connections or requests, but send the responses already under way
+    while (!stopping || nconnections > 0) {
+        if (stopping && listener >= 0) {
+            close(listener);
+            unlink(path);
+            listener = -1;
+        }
+        uint32_t nfds = 2;
+        fds[0] = (struct pollfd) { wakeup[0], POLLIN, 0 };
+        fds[1] = (struct pollfd) { listener, POLLIN, 0 };
+        for (uint32_t i = 0; i < nconnections; i++) {
+            Connection *c = connections[i];
+            if (c->state != WORKING) {
+                polled[nfds] = c;
+                fds[nfds++] = (struct pollfd) { c->fd, c->state == SENDING ? POLLOUT : POLLIN, 0 };
+            }
+        }
+        if (poll(fds, nfds, 1000) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        time_t now = time(NULL);
+        // Finished requests are sent straight away, as far as the socket takes them
+        uint8_t drain[64];
+        while (read(wakeup[0], drain, sizeof(drain)) > 0) {
+        }
+        pthread_mutex_lock(&finished_lock);
+        Connection *done = finished;
+        finished = NULL;
+        pthread_mutex_unlock(&finished_lock);
+        for (; done; done = done->next) {
+            done->state = SENDING;
+            done->done = 0;
+            done->active = now;
+            if (!send_response(done)) {
+                close_after(done);
+            }
+        }
+        for (uint32_t slot = 2; slot < nfds; slot++) {
+            Connection *c = polled[slot];
+            if (fds[slot].revents && c->state != WORKING
+                && !(c->state == SENDING ? send_response(c) : !stopping && receive_request(c, pool))) {
+                close_after(c);
+            }
+        }
+        // Drops closed and stalled connections, and, once stopping, every one without a response under way
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < nconnections; i++) {
+            Connection *c = connections[i];
+            bool partial = c->state == SENDING || (c->state == RECEIVING && c->done > 0);
+            bool idle = c->state == RECEIVING && (c->closing || stopping);
+            if (c->state != WORKING && (idle || (partial && now - c->active > IDLE_TIMEOUT))) {
+                drop(c);
+            } else {
+                connections[kept++] = c;
+            }
+        }
+        nconnections = kept;
+        while (listener >= 0 && !stopping && (fds[1].revents & POLLIN)) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    perror("accept");
+                }
+                break;
+            }
+            if (nconnections == capacity) {
+                Connection **more = (Connection **) realloc(connections, 2 * capacity * sizeof(Connection *));
+                connections = more ? more : connections;
+                Connection **slots = (Connection **) realloc(polled, (2 * capacity + 2) * sizeof(Connection *));
+                polled = slots ? slots : polled;
+                struct pollfd *wider = (struct pollfd *) realloc(fds, (2 * capacity + 2) * sizeof(struct pollfd));
+                fds = wider ? wider : fds;
+                capacity = more && slots && wider ? 2 * capacity : capacity;
+            }
+            Connection *c = nconnections < capacity ? (Connection *) calloc(1, sizeof(Connection)) : NULL;
+            if (!c || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+                free(c);
+                close(fd);
+                break;
+            }
+            *c = (Connection) { .fd = fd, .state = RECEIVING, .active = now };
+            connections[nconnections++] = c;
+        }
+    }
+    // Workers may still hold requests if poll() failed
+    pool_delete(&pool);
+    for (uint32_t i = 0; i < nconnections; i++) {
+        drop(connections[i]);
+    }
+    free(connections);
+    free(polled);
+    free(fds);
+    if (listener >= 0) {
+        close(listener);
+        unlink(path);
+    }
+    close(wakeup[0]);
+    close(wakeup[1]);
+    if (stats) {
+        uint64_t hits, misses;
+        cache_stats(cache, &hits, &misses);
+        fprintf(stderr, "Decode table cache: %" PRIu64 " hits, %" PRIu64 " misses\n", hits, misses);
+    }
+    cache_delete(&cache);
+    return EXIT_SUCCESS;
+}
+
+//
+// Reads what has arrived of a connection's request without blocking, and hands the request to a worker once
+// it is complete. A request that cannot be taken gets an error response, after which the connection closes.
+// Returns whether the connection is still open
+//
+// c   : the connection
+// pool: the workers
+//
+bool receive_request(Connection *c, Pool *pool) {
+    while (c->state == RECEIVING) {
+        uint64_t header = sizeof(c->request), got = c->done > header ? c->done - header : 0;
+        if (c->done >= header && got == c->request.size) {
+            c->state = WORKING;
+            if (!pool_submit(pool, serve, c)) {
+                c->state = SENDING;
+                c->closing = true;
+                respond(c, "Unable to queue request.");
+                return send_response(c);
+            }
+            return true;
+        }
+        uint8_t *into = c->done < header ? (uint8_t *) &c->request + c->done : &c->in.data[got];
+        uint64_t left = c->done < header ? header - c->done : c->request.size - got;
+        ssize_t received = recv(c->fd, into, left, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        c->done += received;
+        c->active = time(NULL);
+        if (c->done == header) {
+            const char *error = NULL;
+            if (c->request.size > MAX_REQUEST) {
+                error = "Request too large.";
+            } else if (!buffer_reserve(&c->in, c->request.size)) {
+                error = "Unable to allocate request buffer.";
+            }
+            if (error) {
+                // The payload cannot be skipped reliably, so drop the connection after replying
+                c->state = SENDING;
+                c->closing = true;
+                c->done = 0;
+                respond(c, error);
+                return send_response(c);
+            }
+        }
+    }
+    return true;
+}
+
+//
+// Sends what the socket takes of a connection's response without blocking. Once all of it is sent, the
+// connection waits for its next request, and buffers grown past WARM_SIZE by a large request are let go.
+// Returns whether the connection is still open
+//
+// c: the connection
+//
+bool send_response(Connection *c) {
+    uint64_t header = sizeof(c->response);
+    while (c->done < header + c->response.size) {
+        uint8_t *from = c->done < header ? (uint8_t *) &c->response + c->done : &c->reply[c->done - header];
+        uint64_t left = c->done < header ? header - c->done : header + c->response.size - c->done;
+        ssize_t sent = send(c->fd, from, left, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        c->done += sent;
+        c->active = time(NULL);
+    }
+    if (c->in.capacity > WARM_SIZE) {
+        buffer_free(&c->in);
+    }
+    if (c->out.capacity > WARM_SIZE) {
+        buffer_free(&c->out);
+    }
+    c->state = RECEIVING;
+    c->done = 0;
+    return !c->closing;
+}
+
+//
+// Sets the response to a connection's request: the output of the request, or an error message.
+//
+// c    : the connection
+// error: the error message, or NULL if the request succeeded
+//
+void respond(Connection *c, const char *error) {
+    c->response = (Response) { error ? STATUS_ERROR : STATUS_OK, 0, error ? strlen(error) : c->out.size };
+    c->reply = error ? (uint8_t *) error : c->out.data;
+    return;
+}
+
+//
+// Makes way for the socket: a socket left at its path by a huffd that is gone is removed, while a file that
+// is not a socket, or a socket another huffd still accepts connections on, is left alone.
+// Returns whether the path is free to bind
+//
+// address: the address the socket will be bound to
+//
+bool claim_socket(struct sockaddr_un *address) {
+    struct stat sb;
+    if (lstat(address->sun_path, &sb) < 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(sb.st_mode)) {
+        return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool stale = probe >= 0 && connect(probe, (struct sockaddr *) address, sizeof(*address)) < 0
+                 && errno == ECONNREFUSED;
+    if (probe >= 0) {
+        close(probe);
+    }
+    return stale && unlink(address->sun_path) == 0;
+}
+
+//
+// Marks a connection to be closed, once its socket has failed or its last response has been sent.
+//
+// c: the connection
+//
+void close_after(Connection *c) {
+    c->closing = true;
+    c->state = RECEIVING;
+    return;
+}
+
+//
+// Closes a connection and frees its buffers.
+//
+// c: the connection
+//
+void drop(Connection *c) {
+    close(c->fd);
+    buffer_free(&c->in);
+    buffer_free(&c->out);
+    free(c);
+    return;
+}
+
+//
+// Serves one complete request on a worker, then queues the connection for the main thread to send the response.
+//
+// arg   : the connection
+// worker: the index of the worker serving the request
+//
+void serve(void *arg, uint32_t worker) {
+    Connection *c = (Connection *) arg;
+    const char *error = NULL;
+    (void) worker;
+    uint8_t *in = c->in.data;
+    // Replies are held in memory like requests, so they are bounded the same way, and holes are zero bytes in them
+    switch (c->request.op) {
+    case OP_COMPRESS: error = compress_buffer(in, c->request.size, c->request.flags, NULL, &c->out); break;
+    case OP_DECOMPRESS: error = decompress_buffer(in, c->request.size, cache, MAX_REQUEST, &c->out, NULL); break;
+    default: error = "Unknown operation."; break;
+    }
+    respond(c, error);
+    pthread_mutex_lock(&finished_lock);
+    c->next = finished;
+    finished = c;
+    pthread_mutex_unlock(&finished_lock);
+    uint8_t signal = 1;
+    if (write(wakeup[1], &signal, sizeof(signal)) < 0) {
+        // The pipe is full, so the main thread has a wakeup pending already
+    }
+    return;
+}
+
+//
+// Asks the accept loop to stop.
+//
+// signal: the signal that was caught
+//
+void stop(int signal) {
+    (void) signal;
+    stopping = 1;
+    return;
+}
+
+//
+// Prints out the help message that describes how to use the program
+//
+void help_message(char *error) {
+    if (*error != '\0') {
+        fprintf(stderr, "%s", error);
+    }
+    fprintf(stderr, "SYNOPSIS\n"
+                    "  A Huffman compression daemon.\n"
+                    "  Serves compress and decompress requests over a Unix domain socket.\n\n"
+                    "USAGE\n"
+                    "  ./huffd [-hv] [-s socket] [-t threads]\n\n"
+                    "OPTIONS\n"
+                    "  -h             Program usage and help.\n"
+                    "  -v             Print decode table cache statistics on exit.\n"
+                    "  -s socket      Path of the socket to listen on (default: " SOCKET_PATH ").\n"
+                    "                 A stale socket there is replaced; anything else stops huffd.\n"
+                    "  -t threads     Number of worker threads (default: number of CPUs).\n");
+    return;
+}
@@ -0,0 +1,158 @@
+#include "protocol.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTIONS "hs:n:c:b:"
+
+typedef struct {
+    pthread_t id;
+    uint32_t requests;
+    uint64_t bytes;
+    uint64_t *latencies;
+    uint32_t completed;
+    uint32_t failed;
+} Client;
+
+static char *path = SOCKET_PATH;
+
+void help_message(char *error);
+void *run(void *arg);
+uint64_t now(void);
+int compare(const void *a, const void *b);
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    uint32_t requests = 10000, clients = 4;
+    uint64_t bytes = 4096;
+    // Checks all flags
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 's': path = optarg; break;
+        case 'n': requests = strtoul(optarg, NULL, 10); break;
+        case 'c': clients = strtoul(optarg, NULL, 10); break;
+        case 'b': bytes = strtoull(optarg, NULL, 10); break;
+        case 'h': help_message(""); return EXIT_SUCCESS;
+        default: help_message(""); return EXIT_FAILURE;
+        }
+    }
+    if (clients == 0 || requests < clients) {
+        help_message("Need at least one request per client.\n");
+        return EXIT_FAILURE;
+    }
+    Client *pool = (Client *) calloc(clients, sizeof(Client));
+    uint64_t *latencies = (uint64_t *) calloc(requests, sizeof(uint64_t));
+    if (!pool || !latencies) {
+        fprintf(stderr, "Unable to allocate clients.\n");
+        return EXIT_FAILURE;
+    }
+    uint64_t start = now();
+    for (uint32_t i = 0, given = 0; i < clients; i++) {
+        pool[i].requests = requests / clients + (i < requests % clients);
+        pool[i].bytes = bytes;
+        pool[i].latencies = &latencies[given];
+        given += pool[i].requests;
+        pthread_create(&pool[i].id, NULL, run, &pool[i]);
+    }
+    uint32_t completed = 0, failed = 0;
+    for (uint32_t i = 0; i < clients; i++) {
+        pthread_join(pool[i].id, NULL);
+        // Gather the finished latencies at the front
+        memmove(&latencies[completed], pool[i].latencies, pool[i].completed * sizeof(uint64_t));
+        completed += pool[i].completed;
+        failed += pool[i].failed;
+    }
+    double seconds = (now() - start) / 1e9;
+    qsort(latencies, completed, sizeof(uint64_t), compare);
+    printf("Requests: %" PRIu32 " round trips (%" PRIu32 " failed) of %" PRIu64 " bytes\n", completed,
+        failed, bytes);
+    printf("Throughput: %.0f round trips/s, %.2f MB/s\n", completed / seconds,
+        completed * bytes / seconds / 1e6);
+    if (completed > 0) {
+        printf("Latency: p50 %.1f us, p99 %.1f us, max %.1f us\n", latencies[completed / 2] / 1e3,
+            latencies[(uint64_t) completed * 99 / 100] / 1e3, latencies[completed - 1] / 1e3);
+    }
+    free(pool);
+    free(latencies);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//
+// Sends compress and decompress requests over one connection, checking every round trip.
+//
+// arg: the client to run
+//
+void *run(void *arg) {
+    Client *c = (Client *) arg;
+    Buffer payload = { NULL, 0, 0 }, compressed = { NULL, 0, 0 }, restored = { NULL, 0, 0 };
+    int connection = connect_socket(path);
+    if (connection < 0 || !buffer_reserve(&payload, c->bytes)) {
+        c->failed = c->requests;
+        return NULL;
+    }
+    // Skewed, text-like data so the round trips exercise real code lengths
+    unsigned int seed = (unsigned int) (uintptr_t) c;
+    for (uint64_t i = 0; i < c->bytes; i++) {
+        payload.data[i] = "eeeeeetttaaoinshrdlu \n"[rand_r(&seed) % 22];
+    }
+    Response response;
+    for (uint32_t i = 0; i < c->requests; i++) {
+        uint64_t start = now();
+        if (!call(connection, OP_COMPRESS, 0, payload.data, c->bytes, &response, &compressed)
+            || response.status != STATUS_OK
+            || !call(connection, OP_DECOMPRESS, 0, compressed.data, compressed.size, &response, &restored)
+            || response.status != STATUS_OK || restored.size != c->bytes
+            || memcmp(restored.data, payload.data, c->bytes) != 0) {
+            c->failed = c->requests - i;
+            break;
+        }
+        c->latencies[c->completed++] = now() - start;
+    }
+    close(connection);
+    buffer_free(&payload);
+    buffer_free(&compressed);
+    buffer_free(&restored);
+    return NULL;
+}
+
+//
+// Returns the monotonic time in nanoseconds.
+//
+uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//
+// Orders latencies for qsort().
+//
+int compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+//
+// Prints out the help message that describes how to use the program
+//
+void help_message(char *error) {
+    if (*error != '\0') {
+        fprintf(stderr, "%s", error);
+    }
+    fprintf(stderr, "SYNOPSIS\n"
+                    "  A load generator for the Huffman compression daemon.\n"
+                    "  Sends compress/decompress round trips and reports throughput and latency.\n\n"
+                    "USAGE\n"
+                    "  ./huffload [-h] [-s socket] [-n requests] [-c clients] [-b bytes]\n\n"
+                    "OPTIONS\n"
+                    "  -h             Program usage and help.\n"
+                    "  -s socket      Path of the daemon's socket (default: " SOCKET_PATH ").\n"
+                    "  -n requests    Total number of round trips (default: 10000).\n"
+                    "  -c clients     Number of concurrent connections (default: 4).\n"
+                    "  -b bytes       Size of every payload (default: 4096).\n");
+    return;
+}
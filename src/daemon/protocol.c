@@ -0,0 +1,89 @@
+#include "protocol.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Sends an entire buffer over a socket.
+// Returns whether every byte was sent
+//
+// fd    : the socket to send over
+// buf   : the bytes to send
+// nbytes: the number of bytes to send
+bool send_all(int fd, void *buf, uint64_t nbytes) {
+    uint8_t *bytes = (uint8_t *) buf;
+    while (nbytes > 0) {
+        ssize_t sent = send(fd, bytes, nbytes, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        nbytes -= sent;
+    }
+    return true;
+}
+
+// Receives an exact number of bytes from a socket.
+// Returns whether every byte was received before the peer closed the socket
+//
+// fd    : the socket to receive from
+// buf   : the buffer to store the bytes into
+// nbytes: the number of bytes to receive
+bool recv_all(int fd, void *buf, uint64_t nbytes) {
+    uint8_t *bytes = (uint8_t *) buf;
+    while (nbytes > 0) {
+        ssize_t received = recv(fd, bytes, nbytes, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        nbytes -= received;
+    }
+    return true;
+}
+
+// Connects to the daemon's Unix domain socket.
+// Returns the connected socket, or -1 if the daemon could not be reached
+//
+// path: the path of the socket
+int connect_socket(const char *path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Sends a request to the daemon and receives its response.
+// Returns whether the exchange completed; the response status says whether the request succeeded
+//
+// fd    : the connected socket
+// op    : the operation to request
+// flags : the frame flags to compress with
+// in    : the payload to send
+// nbytes: the number of bytes in in
+// r     : the address to store the response header into
+// out   : the buffer to store the response payload into
+bool call(int fd, uint32_t op, uint32_t flags, uint8_t *in, uint64_t nbytes, Response *r, Buffer *out) {
+    Request request = { op, flags, nbytes };
+    if (!send_all(fd, &request, sizeof(request)) || !send_all(fd, in, nbytes)
+        || !recv_all(fd, r, sizeof(*r)) || !buffer_reserve(out, r->size + 1)
+        || !recv_all(fd, out->data, r->size)) {
+        return false;
+    }
+    out->size = r->size;
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "../huffman/codec.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SOCKET_PATH  "/tmp/huffd.sock" // Default socket of the compression daemon.
+#define MAX_REQUEST  (1UL << 30) // Largest payload the daemon accepts (1GB).
+
+enum Operations { OP_COMPRESS = 1, OP_DECOMPRESS = 2 };
+enum Status { STATUS_OK, STATUS_ERROR };
+
+// Precedes the payload of every request. Flags are the frame flags to compress with.
+typedef struct {
+    uint32_t op;
+    uint32_t flags;
+    uint64_t size;
+} Request;
+
+// Precedes the payload of every response. An error's payload is its message.
+typedef struct {
+    uint32_t status;
+    uint32_t reserved;
+    uint64_t size;
+} Response;
+
+bool send_all(int fd, void *buf, uint64_t nbytes);
+
+bool recv_all(int fd, void *buf, uint64_t nbytes);
+
+int connect_socket(const char *path);
+
+bool call(int fd, uint32_t op, uint32_t flags, uint8_t *in, uint64_t nbytes, Response *r, Buffer *out);
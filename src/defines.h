@@ -1,7 +1,35 @@
 #pragma once
 
 #define BLOCK         4096 // 4KB blocks.
+#define MAX_IO_SIZE   (1 << 26) // 64MB largest read/write buffer.
+#define IO_ALIGN      4096 // Alignment of I/O buffers, as O_DIRECT needs.
 #define ALPHABET      256 // ASCII + Extended ASCII.
+#define WIDE_ALPHABET (1 << 16) // 16-bit symbols, with FLAG_WIDE.
 #define MAGIC         0xBEEFD00D // 32-bit magic number.
+#define MAGIC_FRAMED  0xBEEFD00F // 32-bit magic number for block-framed streams.
 #define MAX_CODE_SIZE (ALPHABET / 8) // Bytes for a maximum, 256-bit code.
 #define MAX_TREE_SIZE (3 * ALPHABET - 1) // Maximum Huffman tree dump size.
+#define FRAME_BLOCK   (1 << 16) // 64KB of input per framed block.
+#define STREAMS       4 // Interleaved bitstreams per block with FLAG_STREAMS.
+#define TABLE_BITS    11 // Bits of lookahead per decode table probe.
+#define TABLE_SYMBOLS 4 // Maximum symbols emitted per decode table probe.
+#define TANS_LOG      12 // log2 of the number of tANS states.
+
+#define FLAG_CHECKSUM 0x1 // Blocks and the whole file carry CRC32C checksums.
+#define FLAG_STREAMS  0x2 // Blocks are split into STREAMS independently decodable bitstreams.
+#define FLAG_TANS     0x4 // Blocks start with a coder byte and may be coded with tANS instead of Huffman.
+#define FLAG_RLE      0x8 // Blocks start with their run-length coded size (0 if not run-length coded).
+#define FLAG_TABLES   0x10 // Blocks start with a tree dump size and, if not 0, a new table for them and later blocks.
+#define FLAG_WIDE     0x20 // Symbols are 16-bit byte pairs, and a code length table replaces the tree dump.
+#define FLAG_COUNTS   0x40 // Blocks start with the count of every byte value they decode to.
+#define FLAG_SYNC     0x80 // The stream was coded as it arrived: its size is only recorded in its blocks.
+#define FLAG_FILTER   0xFF00 // The FILTER_ every block was transformed with before it was coded.
+#define FLAG_STRIDE   0xFF0000 // The element width, in bytes, the filter works on.
+#define FLAG_HOLES    0x1000000 // Blocks with a raw size of 0 and 8 coded bytes are holes of that many zero bytes.
+
+#define FILTER_NONE    0 // Blocks are coded as they are.
+#define FILTER_DELTA   1 // Every byte minus the byte a stride before it.
+#define FILTER_SHUFFLE 2 // Byte planes: the first byte of every stride-byte element, then the second...
+
+#define CODER_HUFFMAN 0 // Block coder byte: Huffman codes.
+#define CODER_TANS    1 // Block coder byte: tANS with two interleaved states.
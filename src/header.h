@@ -8,3 +8,17 @@ typedef struct {
     uint16_t tree_size;
     uint64_t file_size;
 } Header;
+
+// Follows the Header (and precedes the tree dump) when magic is MAGIC_FRAMED.
+typedef struct {
+    uint32_t flags;
+    uint32_t block_size;
+} FrameHeader;
+
+// Precedes the coded bytes of every framed block. A block with a raw_size of 0 ends the
+// stream, and its checksum is the CRC32C of the entire uncompressed file.
+typedef struct {
+    uint32_t raw_size;
+    uint32_t coded_size;
+    uint32_t checksum;
+} BlockHeader;
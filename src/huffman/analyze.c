@@ -0,0 +1,357 @@
+#include "analyze.h"
+#include "codec.h"
+#include "counts.h"
+#include "huffman.h"
+#include "filter.h"
+#include "frame.h"
+#include "rle.h"
+#include "tans.h"
+#include "../io/io.h"
+#include "../header.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The histograms of every block (or, with FLAG_STREAMS, of every bitstream of every block), both as
+// it is and run-length coded.
+typedef struct {
+    uint32_t (*segments)[ALPHABET];
+    uint32_t (*runs)[ALPHABET];
+    uint32_t *sizes;
+    uint32_t *coded;
+    uint32_t *counts; // The number of bytes the counts of every block take up under FLAG_COUNTS.
+    uint64_t blocks;
+    uint64_t capacity;
+    uint8_t per_block;
+} Blocks;
+
+// Makes room for one more block.
+// Returns whether the block could be allocated
+//
+// b: the block histograms
+static bool blocks_grow(Blocks *b) {
+    if (b->blocks == b->capacity) {
+        uint64_t capacity = b->capacity ? 2 * b->capacity : 64;
+        void *segments = realloc(b->segments, capacity * b->per_block * sizeof(*b->segments));
+        if (!segments) {
+            return false;
+        }
+        b->segments = segments;
+        void *runs = realloc(b->runs, capacity * b->per_block * sizeof(*b->runs));
+        if (!runs) {
+            return false;
+        }
+        b->runs = runs;
+        void *coded = realloc(b->coded, capacity * sizeof(*b->coded));
+        if (!coded) {
+            return false;
+        }
+        b->coded = coded;
+        void *sizes = realloc(b->sizes, capacity * sizeof(*b->sizes));
+        if (!sizes) {
+            return false;
+        }
+        b->sizes = sizes;
+        void *counts = realloc(b->counts, capacity * sizeof(*b->counts));
+        if (!counts) {
+            return false;
+        }
+        b->counts = counts;
+        b->capacity = capacity;
+    }
+    memset(b->segments[b->blocks * b->per_block], 0, b->per_block * sizeof(*b->segments));
+    memset(b->runs[b->blocks * b->per_block], 0, b->per_block * sizeof(*b->runs));
+    return true;
+}
+
+// Frees the block histograms.
+//
+// b: the block histograms
+static void blocks_free(Blocks *b) {
+    free(b->segments);
+    free(b->runs);
+    free(b->sizes);
+    free(b->coded);
+    free(b->counts);
+    return;
+}
+
+// Adds the histograms of the bitstreams of a block.
+//
+// segments: the histograms of the bitstreams of the block
+// per_block: the number of bitstreams in the block
+// in      : the symbols of the block
+// nsymbols: the number of symbols in the block
+// hist    : the histogram of the whole file to add to
+static void count_segments(uint32_t (*segments)[ALPHABET], uint8_t per_block, uint8_t *in, uint32_t nsymbols,
+    uint64_t hist[static ALPHABET]) {
+    uint32_t quarter = (nsymbols + per_block - 1) / per_block;
+    for (uint8_t s = 0; s < per_block; s++) {
+        uint32_t first = s * quarter < nsymbols ? s * quarter : nsymbols;
+        uint32_t count = nsymbols - first < quarter ? nsymbols - first : quarter;
+        uint64_t counted[ALPHABET] = { 0 };
+        count_symbols(&in[first], count, counted);
+        for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+            segments[s][symbol] = counted[symbol];
+            hist[symbol] += counted[symbol];
+        }
+    }
+    return;
+}
+
+// Returns the number of bits a histogram codes to
+//
+// hist   : the histogram
+// lengths: the length of the code of every symbol
+static uint64_t coded_bits(uint32_t hist[static ALPHABET], uint32_t lengths[static ALPHABET]) {
+    uint64_t bits = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        bits += (uint64_t) hist[symbol] * lengths[symbol];
+    }
+    return bits;
+}
+
+// Codes every block of an infile with tANS again, exactly as code_block() would, to find how many bytes
+// each takes when tANS codes it.
+// Returns whether the infile could be read again and the encoder allocated
+//
+// infile : the file to analyze, at its start again
+// flags  : the frame flags encode would run with
+// counts : the normalized tANS counts of the file
+// nblocks: the number of blocks the histogram pass found
+// sizes  : set to the tANS coded size of every block
+static bool tans_blocks(int infile, uint32_t flags, uint16_t counts[static ALPHABET], uint64_t nblocks,
+    uint32_t *sizes) {
+    uint32_t chunk = (io_size + FRAME_BLOCK - 1) / FRAME_BLOCK * FRAME_BLOCK;
+    uint8_t *buffer = io_alloc(chunk);
+    uint8_t *scratch = (uint8_t *) malloc(2 * FRAME_BLOCK), *runs = scratch ? &scratch[FRAME_BLOCK] : NULL;
+    TansEncoder *tans = (TansEncoder *) malloc(sizeof(TansEncoder));
+    uint64_t curr_read, hole = 0, block = 0;
+    bool valid = buffer && scratch && tans;
+    if (valid) {
+        tans_encoder_init(tans, counts);
+    }
+    while (valid && ((curr_read = read_extent(infile, buffer, chunk, &hole)) > 0 || hole > 0)) {
+        for (uint64_t i = 0; i < curr_read && (valid = block < nblocks); i += FRAME_BLOCK) {
+            uint32_t size = curr_read - i < FRAME_BLOCK ? curr_read - i : FRAME_BLOCK;
+            uint8_t *symbols = filter_block(flags, &buffer[i], size, scratch);
+            uint32_t coded = flags & FLAG_RLE ? rle_encode(symbols, size, runs) : 0;
+            sizes[block++] = tans_pack(tans, coded ? runs : symbols, coded ? coded : size, tans->coded);
+        }
+    }
+    free(buffer);
+    free(scratch);
+    free(tans);
+    return valid && block == nblocks;
+}
+
+// Returns the order-0 entropy of a histogram, in bits per symbol
+//
+// hist : the histogram
+// total: the number of symbols counted in hist
+static double entropy(uint64_t hist[static ALPHABET], uint64_t total) {
+    double bits = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        if (hist[symbol] > 0) {
+            double p = hist[symbol] / (double) total;
+            bits -= p * log2(p);
+        }
+    }
+    return bits;
+}
+
+// Runs the histogram pass of encode over an infile and reports exactly what encode would write with the
+// given flags, without writing anything: the compressed size, the entropy and average code length, and
+// how every 64KB block codes. With FLAG_TANS, the blocks are coded with tANS in a second pass (over a
+// copy of the infile if it is a pipe), since only coding them tells which coder each block keeps.
+// Returns whether the per-block histograms could be allocated and the infile read
+//
+// infile: the file to analyze
+// flags : the frame flags encode would run with, or 0 for the original format
+// detect: whether to use the run-length pre-pass when encode would pick it on its own
+// blocks: whether to print a line for every block
+bool analyze_file(int infile, uint32_t flags, bool detect, bool blocks) {
+    Blocks b = { NULL, NULL, NULL, NULL, NULL, 0, 0, flags & FLAG_STREAMS ? STREAMS : 1 };
+    uint32_t chunk = (io_size + FRAME_BLOCK - 1) / FRAME_BLOCK * FRAME_BLOCK;
+    uint8_t *buffer = io_alloc(chunk);
+    uint8_t *scratch = (uint8_t *) malloc(2 * FRAME_BLOCK), *runs = scratch ? &scratch[FRAME_BLOCK] : NULL;
+    uint64_t curr_read, total = 0, histogram[ALPHABET] = { 0 }, coded_histogram[ALPHABET] = { 0 };
+    uint64_t hole = 0, holes = 0, hole_bytes = 0;
+    FILE *copy = (flags & FLAG_TANS) && lseek(infile, 0, SEEK_CUR) < 0 ? tmpfile() : NULL;
+    int reread = copy ? fileno(copy) : infile;
+    bool valid = buffer && scratch && (!(flags & FLAG_TANS) || reread >= 0);
+    // The histogram pass, keeping the histogram of every (filtered) block it is made of, as it is and
+    // run-length coded. Holes are skipped, and only cost an empty block each.
+    while (valid && ((curr_read = read_extent(infile, buffer, chunk, &hole)) > 0 || hole > 0)) {
+        holes += hole > 0;
+        hole_bytes += hole;
+        if (copy && write(reread, buffer, curr_read) != (ssize_t) curr_read) {
+            valid = false;
+            break;
+        }
+        for (uint64_t i = 0; i < curr_read && (valid = blocks_grow(&b)); i += FRAME_BLOCK) {
+            uint32_t size = curr_read - i < FRAME_BLOCK ? curr_read - i : FRAME_BLOCK;
+            uint8_t *block = filter_block(flags, &buffer[i], size, scratch);
+            uint32_t coded = rle_encode(block, size, runs);
+            count_segments(&b.segments[b.blocks * b.per_block], b.per_block, block, size, histogram);
+            count_segments(&b.runs[b.blocks * b.per_block], b.per_block, coded ? runs : block,
+                coded ? coded : size, coded_histogram);
+            b.coded[b.blocks] = coded ? coded : size;
+            b.counts[b.blocks] = 0;
+            if (flags & FLAG_COUNTS) {
+                uint64_t counted[ALPHABET] = { 0 };
+                count_symbols(&buffer[i], size, counted);
+                b.counts[b.blocks] = COUNTS_BITMAP;
+                for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+                    b.counts[b.blocks] += counted[symbol] > 0 ? sizeof(uint16_t) : 0;
+                }
+            }
+            b.sizes[b.blocks++] = size;
+            total += size;
+        }
+    }
+    free(buffer);
+    free(scratch);
+    if (!valid) {
+        blocks_free(&b);
+        if (copy) {
+            fclose(copy);
+        }
+        return false;
+    }
+    flags |= holes ? FLAG_HOLES : 0;
+    // The same choice encode makes, on histograms with the two padding symbols, after which only the
+    // histograms it codes matter
+    uint64_t symbols = total;
+    histogram[0] += 1;
+    histogram[ALPHABET - 1] += 1;
+    coded_histogram[0] += 1;
+    coded_histogram[ALPHABET - 1] += 1;
+    bool check_runs = FILTER(flags) != FILTER_NONE || rle_dominated(histogram);
+    if ((flags & FLAG_RLE) || (detect && check_runs && rle_smaller(histogram, coded_histogram))) {
+        uint32_t (*segments)[ALPHABET] = b.segments;
+        flags |= FLAG_RLE;
+        memcpy(histogram, coded_histogram, sizeof(histogram));
+        b.segments = b.runs;
+        b.runs = segments;
+        symbols = 0;
+        for (uint64_t block = 0; block < b.blocks; block++) {
+            symbols += b.coded[block];
+        }
+    } else {
+        memcpy(b.coded, b.sizes, b.blocks * sizeof(*b.coded));
+    }
+    histogram[0] -= 1;
+    histogram[ALPHABET - 1] -= 1;
+
+    // The same tree encode builds, with the two padding symbols
+    uint16_t unique = 2;
+    for (uint16_t symbol = 1; symbol < ALPHABET - 1; symbol++) {
+        unique += histogram[symbol] > 0;
+    }
+    histogram[0] += 1;
+    histogram[ALPHABET - 1] += 1;
+    Node *root = build_tree(histogram);
+    Code table[ALPHABET] = { 0 };
+    build_codes(root, table);
+    delete_tree(&root);
+    histogram[0] -= 1;
+    histogram[ALPHABET - 1] -= 1;
+    uint32_t lengths[ALPHABET];
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        lengths[symbol] = code_size(&table[symbol]);
+    }
+
+    // tANS is only used when it beats the Huffman codes over the whole file, as encode decides; without it, a
+    // file with no other flags falls back to the original format. With it, every block keeps whichever coder
+    // makes it smaller.
+    CodeBook book;
+    codebook_init(&book, table);
+    uint16_t counts[ALPHABET];
+    bool normalized = tans_normalize(histogram, counts);
+    if (!normalized || !tans_smaller(&book, histogram, counts)) {
+        flags &= ~FLAG_TANS;
+    }
+    uint32_t *tans = flags & FLAG_TANS ? (uint32_t *) malloc((b.blocks ? b.blocks : 1) * sizeof(uint32_t)) : NULL;
+    valid = !(flags & FLAG_TANS)
+            || (tans && lseek(reread, 0, SEEK_SET) == 0 && tans_blocks(reread, flags, counts, b.blocks, tans));
+    if (copy) {
+        fclose(copy);
+    }
+    if (!valid) {
+        free(tans);
+        blocks_free(&b);
+        return false;
+    }
+
+    // Sizes follow exactly from the code lengths, including the byte padding of every bitstream
+    uint16_t tree_size = 3 * unique - 1;
+    uint64_t size = sizeof(Header) + tree_size, bits = 0, smallest = UINT64_MAX, largest = 0, tans_kept = 0;
+    if (flags) {
+        size += sizeof(FrameHeader) + sizeof(BlockHeader) + holes * (sizeof(BlockHeader) + sizeof(uint64_t));
+    }
+    if (flags & FLAG_TANS) {
+        uint8_t normalized_counts[1 + 2 * ALPHABET];
+        size += tans_write_counts(counts, normalized_counts);
+    }
+    for (uint64_t block = 0; block < b.blocks; block++) {
+        uint64_t huffman = flags & FLAG_STREAMS ? (STREAMS - 1) * sizeof(uint32_t) : 0;
+        for (uint8_t s = 0; s < b.per_block; s++) {
+            uint64_t segment = coded_bits(b.segments[block * b.per_block + s], lengths);
+            huffman += (segment + 7) / 8;
+            bits += segment;
+        }
+        // Under FLAG_TANS, a coder byte and the smaller of the two codings
+        uint64_t chosen = (flags & FLAG_TANS) && tans[block] < huffman ? tans[block] : huffman;
+        uint64_t coded = (flags & FLAG_RLE ? sizeof(uint32_t) : 0) + b.counts[block] + (flags & FLAG_TANS ? 1 : 0);
+        coded += chosen;
+        tans_kept += chosen < huffman;
+        smallest = coded < smallest ? coded : smallest;
+        largest = coded > largest ? coded : largest;
+        if (flags) {
+            size += sizeof(BlockHeader) + coded;
+        }
+        if (blocks) {
+            uint64_t hist[ALPHABET] = { 0 };
+            for (uint8_t s = 0; s < b.per_block; s++) {
+                for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+                    hist[symbol] += b.segments[block * b.per_block + s][symbol];
+                }
+            }
+            printf("Block %" PRIu64 ": %" PRIu32 " -> %" PRIu64 " bytes (%.3f bits/symbol, own entropy %.3f)\n",
+                block, b.sizes[block], coded, coded * 8.0 / b.sizes[block], entropy(hist, b.coded[block]));
+        }
+    }
+    if (!flags) {
+        size += (bits + 7) / 8;
+    }
+
+    printf("Input size: %" PRIu64 " bytes\n", total + hole_bytes);
+    if (holes) {
+        printf("Holes: %" PRIu64 ", making up %" PRIu64 " bytes\n", holes, hole_bytes);
+    }
+    printf("Format: %s", flags ? "framed" : "original");
+    if (FILTER(flags) != FILTER_NONE) {
+        printf(", %s:%" PRIu32 " filter", FILTER(flags) == FILTER_DELTA ? "delta" : "shuffle", STRIDE(flags));
+    }
+    printf("%s\n", flags & FLAG_RLE ? ", run-length coded" : "");
+    printf("Unique symbols: %" PRIu16 "\n", unique - 2 + (histogram[0] > 0) + (histogram[ALPHABET - 1] > 0));
+    printf("Tree size: %" PRIu16 " bytes\n", tree_size);
+    printf("Entropy: %.4f bits/symbol\n", symbols ? entropy(histogram, symbols) : 0);
+    printf("Average code length: %.4f bits/symbol\n", total ? bits / (double) total : 0);
+    printf("Blocks: %" PRIu64 " of up to %d bytes, coded to %" PRIu64 "-%" PRIu64 " bytes\n", b.blocks,
+        FRAME_BLOCK, b.blocks ? smallest : 0, largest);
+    printf("Compressed size: %" PRIu64 " bytes\n", size);
+    if (flags & FLAG_TANS) {
+        printf("tANS blocks: %" PRIu64 " of %" PRIu64 "\n", tans_kept, b.blocks);
+    } else if (normalized) {
+        printf("tANS coded size: about %" PRIu64 " bytes\n", (tans_cost(histogram, counts) + 7) / 8);
+    }
+    printf("Space saving: %.2lf%%\n", total + hole_bytes ? 100 * (1 - (size / ((total + hole_bytes) * 1.0))) : 0);
+    free(tans);
+    blocks_free(&b);
+    return true;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool analyze_file(int infile, uint32_t flags, bool detect, bool blocks);
@@ -0,0 +1,341 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "batch.h"
+#include "codec.h"
+#include "../header.h"
+#include "../utils/pool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_THREADS 1024 // Most worker threads a batch runs on.
+
+typedef struct Batch Batch;
+
+// One file of a batch, and how it went.
+typedef struct {
+    Batch *batch;
+    const char *path;
+    char *output; // The path of the output, or NULL if there is none.
+    uint64_t in_size;
+    uint64_t out_size;
+    bool failed;
+} BatchFile;
+
+struct Batch {
+    BatchOptions *options;
+    TableCache *cache;
+    Buffer *outputs; // One output buffer per worker, reused from file to file.
+    Holes *holes; // One list of holes per worker, likewise.
+};
+
+// Parses the number of worker threads of a batch.
+// Returns the number of threads, or 0 if it is not a number from 1 to MAX_THREADS
+//
+// threads: the number of threads to parse
+uint32_t batch_threads(const char *threads) {
+    char *end;
+    uint64_t value = strtoull(threads, &end, 10);
+    return *end == '\0' && end != threads && value > 0 && value <= MAX_THREADS ? value : 0;
+}
+
+// Builds the path of the output of a file: the infile's name in the output directory (or the
+// infile's own directory), with the suffix added when compressing and removed when decompressing.
+// Returns whether the path fits and, when decompressing, whether the infile had the suffix
+//
+// options: the batch options
+// path   : the path of the infile
+// out    : the buffer to build the path in, which must hold PATH_MAX bytes
+static bool output_path(BatchOptions *options, const char *path, char *out) {
+    const char *slash = strrchr(path, '/'), *name = slash ? slash + 1 : path;
+    size_t length = strlen(name), suffix = strlen(options->suffix);
+    int dir = options->outdir ? (int) strlen(options->outdir) : (int) (name - path);
+    const char *prefix = options->outdir ? options->outdir : path;
+    if (options->op == BATCH_DECOMPRESS) {
+        if (length <= suffix || strcmp(&name[length - suffix], options->suffix) != 0) {
+            return false;
+        }
+        length -= suffix;
+    }
+    const char *separator = options->outdir && dir > 0 && prefix[dir - 1] != '/' ? "/" : "";
+    int written = snprintf(out, PATH_MAX, "%.*s%s%.*s%s", dir, prefix, separator, (int) length, name,
+        options->op == BATCH_COMPRESS ? options->suffix : "");
+    return written > 0 && written < PATH_MAX;
+}
+
+// Finds the holes of a sparse file (ranges that no disk blocks are allocated for), so that they are skipped
+// rather than read. Files on filesystems that do not report holes have none.
+// Returns whether the list of holes could be grown
+//
+// infile: the file
+// size  : the size of the file
+// holes : the list to store the holes in
+static bool find_holes(int infile, uint64_t size, Holes *holes) {
+    holes->count = holes->size = 0;
+#ifdef SEEK_HOLE
+    off_t at = 0;
+    while ((uint64_t) at < size) {
+        // A hole runs up to the next data, or to the end of the file if there is none
+        off_t hole = lseek(infile, at, SEEK_HOLE);
+        if (hole < 0 || (uint64_t) hole >= size) {
+            break;
+        }
+        off_t data = lseek(infile, hole, SEEK_DATA);
+        data = data < 0 || (uint64_t) data > size ? (off_t) size : data;
+        if (!holes_add(holes, hole, data - hole)) {
+            return false;
+        }
+        at = data;
+    }
+#else
+    (void) infile;
+    (void) size;
+#endif
+    return true;
+}
+
+// Writes bytes to a file in full.
+// Returns whether every byte was written
+//
+// outfile: the file
+// data   : the bytes to write
+// nbytes : the number of bytes to write
+static bool write_all(int outfile, uint8_t *data, uint64_t nbytes) {
+    uint64_t written = 0;
+    while (written < nbytes) {
+        ssize_t curr_write = write(outfile, &data[written], nbytes - written);
+        if (curr_write <= 0) {
+            return false;
+        }
+        written += curr_write;
+    }
+    return true;
+}
+
+// Orders files by the paths of their outputs, and files with the same output in the order they were named.
+// Returns less than, equal to or greater than 0 as a comes before, is or comes after b
+//
+// a: the first file
+// b: the second file
+static int compare_outputs(const void *a, const void *b) {
+    BatchFile *x = *(BatchFile **) a, *y = *(BatchFile **) b;
+    int order = strcmp(x->output, y->output);
+    return order ? order : (x > y) - (x < y);
+}
+
+// Builds the output path of every file, and fails files whose output path cannot be built or is already the
+// output of a file named before them (infiles with the same name, from different directories, in one output
+// directory), so that no two workers write the same file.
+// Returns whether the paths could be allocated
+//
+// files : the files
+// nfiles: the number of files
+static bool plan_outputs(BatchFile *files, uint32_t nfiles) {
+    BatchOptions *options = files[0].batch->options;
+    BatchFile **sorted = (BatchFile **) malloc(nfiles * sizeof(BatchFile *));
+    uint32_t nsorted = 0;
+    char path[PATH_MAX];
+    for (uint32_t i = 0; sorted && i < nfiles; i++) {
+        if (!output_path(options, files[i].path, path)) {
+            fprintf(stderr, "%s: %s\n", files[i].path,
+                options->op == BATCH_DECOMPRESS ? "Unknown suffix." : "Output path too long.");
+            files[i].failed = true;
+        } else if (!(files[i].output = strdup(path))) {
+            free(sorted);
+            return false;
+        } else {
+            sorted[nsorted++] = &files[i];
+        }
+    }
+    if (!sorted) {
+        return false;
+    }
+    qsort(sorted, nsorted, sizeof(BatchFile *), compare_outputs);
+    for (uint32_t i = 1; !options->verify && i < nsorted; i++) {
+        for (uint32_t first = i - 1; i < nsorted && strcmp(sorted[first]->output, sorted[i]->output) == 0; i++) {
+            fprintf(stderr, "%s: Same output as %s (%s).\n", sorted[i]->path, sorted[first]->path, sorted[i]->output);
+            sorted[i]->failed = true;
+        }
+    }
+    free(sorted);
+    return true;
+}
+
+// Writes a whole buffer to a new file, which is removed again if it cannot be written in full. Existing
+// files are never overwritten. Holes are recreated by seeking past them, so no disk blocks are allocated
+// for them.
+// Returns whether the file was written
+//
+// path       : the path of the file
+// data       : the bytes to write, which leave out the holes
+// nbytes     : the number of bytes in data
+// holes      : the holes to put between the bytes, or NULL
+// permissions: the permissions to give the file
+static bool write_file(const char *path, uint8_t *data, uint64_t nbytes, Holes *holes, uint16_t permissions) {
+    int outfile = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (outfile < 0) {
+        return false;
+    }
+    uint64_t written = 0, at = 0, count = holes ? holes->count : 0;
+    bool valid = true;
+    for (uint64_t i = 0; valid && i < count; i++) {
+        Hole *h = &holes->holes[i];
+        valid = write_all(outfile, &data[written], h->offset - at) && lseek(outfile, h->size, SEEK_CUR) >= 0;
+        written += h->offset - at;
+        at = h->offset + h->size;
+    }
+    // A hole at the end only extends the file
+    valid = valid && write_all(outfile, &data[written], nbytes - written)
+            && (count == 0 || ftruncate(outfile, nbytes + holes->size) == 0);
+    valid = valid && fchmod(outfile, permissions & 07777) == 0;
+    valid = close(outfile) == 0 && valid;
+    if (!valid) {
+        unlink(path);
+    }
+    return valid;
+}
+
+// Compresses or decompresses one file of a batch, reporting any error on stderr.
+//
+// arg   : the file
+// worker: the index of the worker running the job
+static void run_file(void *arg, uint32_t worker) {
+    BatchFile *f = (BatchFile *) arg;
+    BatchOptions *options = f->batch->options;
+    Buffer *out = &f->batch->outputs[worker];
+    Holes *holes = &f->batch->holes[worker];
+    const char *error = NULL;
+    struct stat sb;
+    uint8_t *map = NULL;
+    int infile = -1;
+    // Outputs are only ever created, never overwritten
+    if (!options->verify && access(f->output, F_OK) == 0) {
+        error = "Output already exists.";
+    } else if ((infile = open(f->path, O_RDONLY)) < 0 || fstat(infile, &sb) != 0) {
+        error = "Unable to open file.";
+    } else if (!S_ISREG(sb.st_mode)) {
+        error = "Not a regular file.";
+    } else if (sb.st_size > 0
+               && (map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, infile, 0)) == MAP_FAILED) {
+        map = NULL;
+        error = "Unable to map file.";
+    }
+    if (!error) {
+        if (options->op == BATCH_COMPRESS) {
+            // Compressed files keep the permissions of the file they came from, and the holes of sparse ones are
+            // skipped and stored as holes
+            error = find_holes(infile, sb.st_size, holes) ? compress_buffer(map, sb.st_size, options->flags, holes, out)
+                                                           : "Unable to allocate hole list.";
+            if (!error) {
+                ((Header *) out->data)->permissions = sb.st_mode;
+            }
+        } else {
+            // Holes are kept out of memory, and recreated as holes
+            error = decompress_buffer(map, sb.st_size, f->batch->cache, UINT64_MAX, out, holes);
+        }
+    }
+    if (!error && !options->verify) {
+        uint16_t permissions = sb.st_mode;
+        if (options->op == BATCH_DECOMPRESS) {
+            permissions = ((Header *) map)->permissions;
+        }
+        Holes *recreated = options->op == BATCH_DECOMPRESS ? holes : NULL;
+        if (!write_file(f->output, out->data, out->size, recreated, permissions)) {
+            error = errno == EEXIST ? "Output already exists." : "Unable to write output.";
+        }
+    }
+    if (map) {
+        munmap(map, sb.st_size);
+    }
+    if (infile >= 0) {
+        close(infile);
+    }
+    f->failed = error != NULL;
+    if (error) {
+        fprintf(stderr, "%s: %s\n", f->path, error);
+    } else {
+        f->in_size = sb.st_size;
+        f->out_size = out->size + (options->op == BATCH_DECOMPRESS ? holes->size : 0);
+    }
+    return;
+}
+
+// Compresses or decompresses many files on a pool of worker threads. Every file is read and coded
+// in memory, the way the daemon does it, and errors only fail the file they happen in.
+// Returns whether every file succeeded
+//
+// paths  : the paths of the files
+// npaths : the number of files
+// threads: the number of worker threads
+// options: what to do to every file
+bool run_batch(char **paths, uint32_t npaths, uint32_t threads, BatchOptions *options) {
+    Batch batch = { options, NULL, NULL, NULL };
+    BatchFile *files = (BatchFile *) calloc(npaths, sizeof(BatchFile));
+    Pool *pool = pool_create(threads);
+    if (pool) {
+        batch.outputs = (Buffer *) calloc(pool_threads(pool), sizeof(Buffer));
+        batch.holes = (Holes *) calloc(pool_threads(pool), sizeof(Holes));
+        // Every worker holds up to two tables: a member's and the one its blocks switched to
+        batch.cache = options->op == BATCH_DECOMPRESS ? cache_create(2 * pool_threads(pool) + 64) : NULL;
+    }
+    if (!files || !pool || !batch.outputs || !batch.holes || (options->op == BATCH_DECOMPRESS && !batch.cache)) {
+        fprintf(stderr, "Unable to start worker threads.\n");
+        pool_delete(&pool);
+        cache_delete(&batch.cache);
+        free(batch.outputs);
+        free(batch.holes);
+        free(files);
+        return false;
+    }
+    uint32_t failed = 0, workers = pool_threads(pool);
+    for (uint32_t i = 0; i < npaths; i++) {
+        files[i] = (BatchFile) { &batch, paths[i], NULL, 0, 0, false };
+    }
+    bool planned = plan_outputs(files, npaths);
+    for (uint32_t i = 0; i < npaths; i++) {
+        if (!planned) {
+            fprintf(stderr, "%s: Unable to allocate output path.\n", paths[i]);
+            files[i].failed = true;
+        } else if (!files[i].failed && !pool_submit(pool, run_file, &files[i])) {
+            fprintf(stderr, "%s: Unable to queue file.\n", paths[i]);
+            files[i].failed = true;
+        }
+    }
+    pool_wait(pool);
+    uint64_t in_size = 0, out_size = 0;
+    for (uint32_t i = 0; i < npaths; i++) {
+        failed += files[i].failed;
+        in_size += files[i].in_size;
+        out_size += files[i].out_size;
+    }
+    if (options->stats) {
+        uint64_t raw = options->op == BATCH_COMPRESS ? in_size : out_size;
+        uint64_t coded = options->op == BATCH_COMPRESS ? out_size : in_size;
+        fprintf(stderr, "Files: %" PRIu32 " (%" PRIu32 " failed) on %" PRIu32 " threads\n", npaths, failed,
+            workers);
+        fprintf(stderr, "Uncompressed size: %" PRIu64 " bytes\n", raw);
+        fprintf(stderr, "Compressed size: %" PRIu64 " bytes\n", coded);
+        fprintf(stderr, "Space saving: %.2lf%%\n", raw ? 100 * (1 - (coded / (raw * 1.0))) : 0);
+    }
+    pool_delete(&pool);
+    cache_delete(&batch.cache);
+    for (uint32_t i = 0; i < workers; i++) {
+        buffer_free(&batch.outputs[i]);
+        holes_free(&batch.holes[i]);
+    }
+    free(batch.outputs);
+    free(batch.holes);
+    for (uint32_t i = 0; i < npaths; i++) {
+        free(files[i].output);
+    }
+    free(files);
+    return failed == 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BATCH_SUFFIX ".huf" // Suffix compressed files are given (and decompressed files lose) by default.
+
+enum BatchOps { BATCH_COMPRESS, BATCH_DECOMPRESS };
+
+// What a batch does to every file, and where the outputs go.
+typedef struct {
+    uint32_t op;
+    uint32_t flags; // The frame flags to compress with.
+    const char *outdir; // The directory to write the outputs to, or NULL for next to every infile.
+    const char *suffix; // Added to compressed files, and removed from decompressed ones.
+    bool verify; // Only check that every file decompresses, without writing any output.
+    bool stats;
+} BatchOptions;
+
+uint32_t batch_threads(const char *threads);
+
+bool run_batch(char **paths, uint32_t npaths, uint32_t threads, BatchOptions *options);
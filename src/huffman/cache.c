@@ -0,0 +1,149 @@
+#include "cache.h"
+#include "huffman.h"
+#include "../utils/crc.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint8_t tree[MAX_TREE_SIZE];
+    uint16_t size;
+    uint32_t hash;
+    Node *root;
+    DecodeTable *table;
+    uint32_t refs;
+    uint64_t used;
+} Slot;
+
+struct TableCache {
+    pthread_mutex_t lock;
+    uint32_t capacity;
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+    Slot *slots;
+};
+
+// Initializes a cache of decode tables keyed by tree dump. The capacity must exceed the number of
+// threads sharing the cache, so that there is always an unreferenced slot to evict.
+//
+// capacity: the number of decode tables to keep
+TableCache *cache_create(uint32_t capacity) {
+    TableCache *c = (TableCache *) calloc(1, sizeof(TableCache));
+    if (c) {
+        c->capacity = capacity;
+        c->slots = (Slot *) calloc(capacity, sizeof(Slot));
+        if (!c->slots) {
+            free(c);
+            return NULL;
+        }
+        pthread_mutex_init(&c->lock, NULL);
+    }
+    return c;
+}
+
+// Frees the cache along with every cached tree and decode table.
+//
+// c: the cache to free
+void cache_delete(TableCache **c) {
+    if (*c) {
+        for (uint32_t i = 0; i < (*c)->capacity; i++) {
+            table_delete(&(*c)->slots[i].table);
+            delete_tree(&(*c)->slots[i].root);
+        }
+        pthread_mutex_destroy(&(*c)->lock);
+        free((*c)->slots);
+        free(*c);
+        *c = NULL;
+    }
+    return;
+}
+
+// Looks up the decode table for a tree dump, building and caching it on a miss.
+// Returns the table, which stays valid until cache_release(), or NULL if the dump is invalid
+//
+// c     : the cache
+// nbytes: the number of bytes in the tree dump
+// tree  : the tree dump
+DecodeTable *cache_acquire(TableCache *c, uint16_t nbytes, uint8_t tree[static nbytes]) {
+    if (nbytes > MAX_TREE_SIZE) {
+        return NULL;
+    }
+    uint32_t hash = crc32c(0, tree, nbytes);
+    pthread_mutex_lock(&c->lock);
+    for (uint32_t i = 0; i < c->capacity; i++) {
+        Slot *s = &c->slots[i];
+        if (s->table && s->hash == hash && s->size == nbytes && !memcmp(s->tree, tree, nbytes)) {
+            s->refs += 1;
+            s->used = ++c->clock;
+            c->hits += 1;
+            pthread_mutex_unlock(&c->lock);
+            return s->table;
+        }
+    }
+    c->misses += 1;
+    pthread_mutex_unlock(&c->lock);
+
+    // Build outside the lock
+    Code codes[ALPHABET] = { 0 };
+    Node *root = rebuild_tree(nbytes, tree);
+    if (!root) {
+        return NULL;
+    }
+    build_codes(root, codes);
+    DecodeTable *table = table_create(root, codes);
+    if (!table) {
+        delete_tree(&root);
+        return NULL;
+    }
+
+    // Evict the least recently used table that no one is decoding with
+    pthread_mutex_lock(&c->lock);
+    Slot *victim = NULL;
+    for (uint32_t i = 0; i < c->capacity; i++) {
+        Slot *s = &c->slots[i];
+        if (s->refs == 0 && (!victim || s->used < victim->used)) {
+            victim = s;
+        }
+    }
+    table_delete(&victim->table);
+    delete_tree(&victim->root);
+    memcpy(victim->tree, tree, nbytes);
+    victim->size = nbytes;
+    victim->hash = hash;
+    victim->root = root;
+    victim->table = table;
+    victim->refs = 1;
+    victim->used = ++c->clock;
+    pthread_mutex_unlock(&c->lock);
+    return table;
+}
+
+// Hands back a decode table returned by cache_acquire().
+//
+// c: the cache
+// t: the decode table
+void cache_release(TableCache *c, DecodeTable *t) {
+    pthread_mutex_lock(&c->lock);
+    for (uint32_t i = 0; i < c->capacity; i++) {
+        if (c->slots[i].table == t) {
+            c->slots[i].refs -= 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    return;
+}
+
+// Reports how many lookups found a cached decode table.
+//
+// c     : the cache
+// hits  : the address to store the number of hits into
+// misses: the address to store the number of misses into
+void cache_stats(TableCache *c, uint64_t *hits, uint64_t *misses) {
+    pthread_mutex_lock(&c->lock);
+    *hits = c->hits;
+    *misses = c->misses;
+    pthread_mutex_unlock(&c->lock);
+    return;
+}
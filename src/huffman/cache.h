@@ -0,0 +1,16 @@
+#pragma once
+
+#include "table.h"
+#include <stdint.h>
+
+typedef struct TableCache TableCache;
+
+TableCache *cache_create(uint32_t capacity);
+
+void cache_delete(TableCache **c);
+
+DecodeTable *cache_acquire(TableCache *c, uint16_t nbytes, uint8_t tree[static nbytes]);
+
+void cache_release(TableCache *c, DecodeTable *t);
+
+void cache_stats(TableCache *c, uint64_t *hits, uint64_t *misses);
@@ -0,0 +1,700 @@
+#include "codec.h"
+#include "frame.h"
+#include "huffman.h"
+#include "../header.h"
+#include "../utils/crc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Grows a buffer to hold at least a given number of bytes.
+// Returns whether the buffer could be grown
+//
+// b       : the buffer to grow
+// capacity: the number of bytes the buffer must hold
+bool buffer_reserve(Buffer *b, uint64_t capacity) {
+    if (capacity <= b->capacity) {
+        return true;
+    }
+    uint64_t grown = b->capacity * 2 > capacity ? b->capacity * 2 : capacity;
+    uint8_t *data = (uint8_t *) realloc(b->data, grown);
+    if (!data) {
+        return false;
+    }
+    b->data = data;
+    b->capacity = grown;
+    return true;
+}
+
+// Frees the memory held by a buffer.
+//
+// b: the buffer to free
+void buffer_free(Buffer *b) {
+    free(b->data);
+    b->data = NULL;
+    b->size = b->capacity = 0;
+    return;
+}
+
+// Adds a hole to the end of a list, joining it to the last one if the two meet.
+// Returns whether the list could be grown
+//
+// h     : the list of holes
+// offset: where the hole starts, after every hole already in the list
+// size  : the number of zero bytes in the hole
+bool holes_add(Holes *h, uint64_t offset, uint64_t size) {
+    if (h->count > 0 && h->holes[h->count - 1].offset + h->holes[h->count - 1].size == offset) {
+        h->holes[h->count - 1].size += size;
+        h->size += size;
+        return true;
+    }
+    if (h->count == h->capacity) {
+        uint64_t grown = h->capacity ? 2 * h->capacity : 16;
+        Hole *holes = (Hole *) realloc(h->holes, grown * sizeof(Hole));
+        if (!holes) {
+            return false;
+        }
+        h->holes = holes;
+        h->capacity = grown;
+    }
+    h->holes[h->count++] = (Hole) { offset, size };
+    h->size += size;
+    return true;
+}
+
+// Frees the memory held by a list of holes.
+//
+// h: the list to free
+void holes_free(Holes *h) {
+    free(h->holes);
+    h->holes = NULL;
+    h->count = h->capacity = h->size = 0;
+    return;
+}
+
+// Appends bytes to a buffer that has already been reserved.
+//
+// b     : the buffer to append to
+// bytes : the bytes to append
+// nbytes: the number of bytes to append
+static void append(Buffer *b, void *bytes, uint64_t nbytes) {
+    memcpy(&b->data[b->size], bytes, nbytes);
+    b->size += nbytes;
+    return;
+}
+
+// Decides whether coding a file with tANS is likely to beat Huffman, counting the normalized counts
+// and the coder byte every block then carries.
+// Returns whether FLAG_TANS is worth setting
+//
+// book  : the Huffman code book of the file
+// hist  : the histogram of the file
+// counts: the normalized tANS counts of the file
+bool tans_smaller(CodeBook *book, uint64_t hist[static ALPHABET], uint16_t counts[static ALPHABET]) {
+    uint64_t symbols = 0, huffman = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        symbols += hist[symbol];
+        huffman += hist[symbol] * book->lengths[symbol];
+    }
+    uint64_t blocks = (symbols + FRAME_BLOCK - 1) / FRAME_BLOCK;
+    uint8_t table[1 + 2 * ALPHABET];
+    return tans_cost(hist, counts) + 8 * (tans_write_counts(counts, table) + blocks) < huffman;
+}
+
+// Codes a block with whichever of Huffman and tANS makes it smaller. Without FLAG_TANS, FLAG_RLE or
+// a filter this is just pack_block(). The block is filtered first, then with FLAG_RLE it starts with
+// the size of its run-length coded form (0 if it is not run-length coded), and with FLAG_TANS, the
+// CODER_ byte of the coder it chose follows. Under FLAG_TABLES the caller writes the table switch that
+// comes before all of this.
+// Returns the number of bytes written to out
+//
+// book    : the Huffman code book
+// tans    : the tANS encoder, or NULL without FLAG_TANS
+// flags   : the frame flags
+// in      : the symbols to code, at most FRAME_BLOCK of them
+// nsymbols: the number of symbols in in
+// out     : the buffer to write into, which must hold block_bound() + 5 bytes
+// scratch : room for 2 * nsymbols bytes, used with FLAG_RLE or a filter
+uint32_t code_block(CodeBook *book, TansEncoder *tans, uint32_t flags, uint8_t *in, uint32_t nsymbols, uint8_t *out,
+    uint8_t *scratch) {
+    uint32_t prefix = 0;
+    uint8_t *runs = &scratch[nsymbols];
+    in = filter_block(flags, in, nsymbols, scratch);
+    if (flags & FLAG_RLE) {
+        uint32_t size = rle_encode(in, nsymbols, runs);
+        memcpy(out, &size, sizeof(size));
+        prefix += sizeof(size);
+        if (size > 0) {
+            in = runs;
+            nsymbols = size;
+        }
+    }
+    if (!(flags & FLAG_TANS)) {
+        return prefix + pack_block(book, in, nsymbols, &out[prefix], flags & FLAG_STREAMS);
+    }
+    out[prefix] = CODER_HUFFMAN;
+    uint32_t size = pack_block(book, in, nsymbols, &out[prefix + 1], flags & FLAG_STREAMS);
+    uint32_t coded = tans_pack(tans, in, nsymbols, tans->coded);
+    if (coded < size) {
+        out[prefix] = CODER_TANS;
+        memcpy(&out[prefix + 1], tans->coded, coded);
+        size = coded;
+    }
+    return prefix + 1 + size;
+}
+
+// Counts the symbols code_block() codes for a block: the filtered block, run-length coded under
+// FLAG_RLE when that makes it smaller.
+//
+// flags   : the frame flags
+// in      : the block, at most FRAME_BLOCK symbols
+// nsymbols: the number of symbols in in
+// hist    : the histogram to add the symbols to
+// scratch : room for 2 * nsymbols bytes, used with FLAG_RLE or a filter
+void count_block(uint32_t flags, uint8_t *in, uint32_t nsymbols, uint64_t hist[static ALPHABET], uint8_t *scratch) {
+    in = filter_block(flags, in, nsymbols, scratch);
+    uint32_t size = flags & FLAG_RLE ? rle_encode(in, nsymbols, &scratch[nsymbols]) : 0;
+    count_symbols(size > 0 ? &scratch[nsymbols] : in, size > 0 ? size : nsymbols, hist);
+    return;
+}
+
+// Reads the table switch a block starts with under FLAG_TABLES: the size of a tree dump and, if that
+// is not 0, the dump of the table this block and the ones after it are coded with.
+// Returns the number of bytes the switch took up, or -1 if it is truncated or the tree dump is invalid
+//
+// cache   : the cache to look the new decode table up in
+// in      : the coded bytes of the block
+// nbytes  : the number of bytes in in
+// acquired: the table acquired by the previous switch, or NULL; released and replaced by a new table
+int32_t switch_table(TableCache *cache, uint8_t *in, uint64_t nbytes, DecodeTable **acquired) {
+    uint16_t tree_size;
+    if (nbytes < sizeof(tree_size)) {
+        return -1;
+    }
+    memcpy(&tree_size, in, sizeof(tree_size));
+    if (tree_size == 0) {
+        return sizeof(tree_size);
+    }
+    if (tree_size > MAX_TREE_SIZE || tree_size > nbytes - sizeof(tree_size)) {
+        return -1;
+    }
+    if (*acquired) {
+        cache_release(cache, *acquired);
+    }
+    *acquired = cache_acquire(cache, tree_size, &in[sizeof(tree_size)]);
+    return *acquired ? (int32_t) (sizeof(tree_size) + tree_size) : -1;
+}
+
+// Decodes the coded symbols of a block, with the coder its CODER_ byte names under FLAG_TANS.
+// Returns whether all the symbols were decoded without leaving the tree or the block
+static bool decode_symbols(DecodeTable *t, TansDecoder *tans, uint32_t flags, uint8_t *in, uint64_t nbytes,
+    uint8_t *out, uint32_t nsymbols) {
+    if (flags & FLAG_TANS) {
+        if (nbytes < 1 || in[0] > CODER_TANS) {
+            return false;
+        }
+        if (in[0] == CODER_TANS) {
+            return tans_unpack(tans, &in[1], nbytes - 1, out, nsymbols);
+        }
+        in += 1;
+        nbytes -= 1;
+    }
+    uint64_t pos = 0;
+    return flags & FLAG_STREAMS ? table_decode_streams(t, in, nbytes, out, nsymbols)
+                                : table_decode(t, in, nbytes, &pos, nbytes * 8, out, nsymbols) == nsymbols;
+}
+
+// Decodes a block coded by code_block().
+// Returns whether all the symbols were decoded without leaving the tree or the block
+//
+// t       : the Huffman decode table
+// tans    : the tANS decoder, or NULL without FLAG_TANS
+// flags   : the frame flags, whose filter must be valid
+// in      : the coded bytes of the block
+// nbytes  : the number of bytes in in
+// out     : the buffer to store the decoded symbols into
+// nsymbols: the number of symbols in the block
+// scratch : room for 2 * nsymbols bytes, used with FLAG_RLE or a filter
+bool decode_block(DecodeTable *t, TansDecoder *tans, uint32_t flags, uint8_t *in, uint64_t nbytes, uint8_t *out,
+    uint32_t nsymbols, uint8_t *scratch) {
+    // Filtered blocks are decoded into the scratch buffer and unfiltered into out at the end
+    uint8_t *filtered = FILTER(flags) != FILTER_NONE ? scratch : out, *runs = &scratch[nsymbols];
+    uint32_t size = 0;
+    if (flags & FLAG_RLE) {
+        if (nbytes < sizeof(size)) {
+            return false;
+        }
+        memcpy(&size, in, sizeof(size));
+        in += sizeof(size);
+        nbytes -= sizeof(size);
+    }
+    bool valid = size == 0 ? decode_symbols(t, tans, flags, in, nbytes, filtered, nsymbols)
+                           : size < nsymbols && decode_symbols(t, tans, flags, in, nbytes, runs, size)
+                                 && rle_decode(runs, size, filtered, nsymbols);
+    if (valid && filtered != out) {
+        unfilter_block(flags, filtered, nsymbols, out);
+    }
+    return valid;
+}
+
+// Adds up the sizes the blocks (and holes) of a framed stream held in memory decode to, for FLAG_SYNC
+// streams whose header does not record it and for sparse streams whose holes are kept out of memory.
+// Returns the number of bytes the blocks decode to, or -1 if a block is too large or the stream ends before its
+// terminating block
+//
+// in    : the blocks of the stream
+// nbytes: the number of bytes in in
+// holes : set to the number of those bytes that are in holes, if not NULL
+int64_t blocks_size(uint8_t *in, uint64_t nbytes, uint64_t *holes) {
+    BlockHeader block;
+    uint64_t offset = 0, symbols = 0;
+    if (holes) {
+        *holes = 0;
+    }
+    while (nbytes - offset >= sizeof(block)) {
+        memcpy(&block, &in[offset], sizeof(block));
+        offset += sizeof(block);
+        if (block.raw_size == 0 && block.coded_size == 0) {
+            return symbols;
+        }
+        uint64_t hole = 0;
+        if (block.raw_size == 0 && block.coded_size == sizeof(hole) && nbytes - offset >= sizeof(hole)) {
+            memcpy(&hole, &in[offset], sizeof(hole));
+            if (hole > INT64_MAX - symbols) {
+                break;
+            }
+            symbols += hole;
+            if (holes) {
+                *holes += hole;
+            }
+        }
+        if (block.raw_size > FRAME_BLOCK || block.coded_size > nbytes - offset) {
+            break;
+        }
+        offset += block.coded_size;
+        symbols += block.raw_size;
+    }
+    return -1;
+}
+
+// Finds the next block of a buffer with holes: up to FRAME_BLOCK bytes, ending before the next hole, or the
+// hole itself if the buffer is at one.
+// Returns the number of bytes in the block, which is 0 at a hole
+//
+// holes : the holes of the buffer, or NULL
+// next  : the index of the next hole, moved past the hole if the buffer is at one
+// at    : where in the buffer the block starts
+// nbytes: the number of bytes in the buffer
+// hole  : set to the size of the hole, 0 if the buffer is not at one
+static uint32_t next_block(Holes *holes, uint64_t *next, uint64_t at, uint64_t nbytes, uint64_t *hole) {
+    *hole = 0;
+    if (holes && *next < holes->count && holes->holes[*next].offset == at) {
+        *hole = holes->holes[(*next)++].size;
+        return 0;
+    }
+    uint64_t end = holes && *next < holes->count ? holes->holes[*next].offset : nbytes;
+    return end - at < FRAME_BLOCK ? end - at : FRAME_BLOCK;
+}
+
+// Compresses a buffer into a framed stream that decode (and decompress_buffer()) can read.
+// Returns NULL on success, or a message describing the failure
+//
+// in    : the bytes to compress
+// nbytes: the number of bytes in in
+// flags : the frame flags (FLAG_CHECKSUM, FLAG_STREAMS, FLAG_TANS, FLAG_RLE, FLAG_COUNTS and a filter) to
+//         compress with; FLAG_TANS is dropped when tANS would not make the stream smaller, and FLAG_RLE is
+//         added when the input is filtered or dominated by one symbol, and its runs code smaller.
+//         FLAG_TABLES, FLAG_WIDE, FLAG_SYNC and FLAG_HOLES, which only encode writes, are ignored.
+// holes : the holes of in, in order and apart, which are stored as holes (FLAG_HOLES) instead of being read,
+//         or NULL
+// out   : the buffer to store the stream into
+const char *compress_buffer(uint8_t *in, uint64_t nbytes, uint32_t flags, Holes *holes, Buffer *out) {
+    uint64_t histogram[ALPHABET] = { 0 }, coded[ALPHABET] = { 0 }, next = 0, hole = 0;
+    uint32_t size = 0;
+    flags &= ~(FLAG_TABLES | FLAG_WIDE | FLAG_SYNC | FLAG_HOLES);
+    flags |= holes && holes->count > 0 ? FLAG_HOLES : 0;
+    if (!filter_valid(flags)) {
+        return "Invalid filter.";
+    }
+    uint8_t *scratch = (uint8_t *) malloc(2 * FRAME_BLOCK);
+    if (!scratch) {
+        return "Unable to allocate block buffer.";
+    }
+    for (uint64_t i = 0; i < nbytes; i += size + hole) {
+        size = next_block(holes, &next, i, nbytes, &hole);
+        count_symbols(filter_block(flags, &in[i], size, scratch), size, histogram);
+    }
+    // Filtered inputs and inputs dominated by one symbol are coded after the run-length pre-pass if that
+    // codes smaller
+    if ((flags & FLAG_RLE) || FILTER(flags) != FILTER_NONE || rle_dominated(histogram)) {
+        next = 0;
+        for (uint64_t i = 0; i < nbytes; i += size + hole) {
+            size = next_block(holes, &next, i, nbytes, &hole);
+            count_runs(filter_block(flags, &in[i], size, scratch), size, coded, &scratch[FRAME_BLOCK]);
+        }
+        if ((flags & FLAG_RLE) || rle_smaller(histogram, coded)) {
+            flags |= FLAG_RLE;
+            memcpy(histogram, coded, sizeof(histogram));
+        }
+    }
+    uint16_t counts[ALPHABET];
+    bool tans = (flags & FLAG_TANS) && tans_normalize(histogram, counts);
+    histogram[0] += 1;
+    histogram[ALPHABET - 1] += 1;
+    Node *root = build_tree(histogram);
+    if (!root) {
+        free(scratch);
+        return "Unable to allocate Huffman tree.";
+    }
+    Code table[ALPHABET] = { 0 };
+    CodeBook book;
+    uint8_t tree[MAX_TREE_SIZE];
+    build_codes(root, table);
+    codebook_init(&book, table);
+    uint16_t tree_size = flatten_tree(root, tree);
+    delete_tree(&root);
+    histogram[0] -= 1;
+    histogram[ALPHABET - 1] -= 1;
+    TansEncoder *encoder = NULL;
+    if (tans && tans_smaller(&book, histogram, counts)) {
+        encoder = (TansEncoder *) malloc(sizeof(TansEncoder));
+        if (!encoder) {
+            free(scratch);
+            return "Unable to allocate tANS encoder.";
+        }
+        tans_encoder_init(encoder, counts);
+    } else {
+        flags &= ~FLAG_TANS;
+    }
+
+    Header header = { MAGIC_FRAMED, S_IFREG | 0644, tree_size, nbytes };
+    FrameHeader frame = { flags, FRAME_BLOCK };
+    out->size = 0;
+    if (!buffer_reserve(out, sizeof(header) + sizeof(frame) + tree_size + 1 + 2 * ALPHABET)) {
+        free(encoder);
+        free(scratch);
+        return "Unable to allocate output buffer.";
+    }
+    append(out, &header, sizeof(header));
+    append(out, &frame, sizeof(frame));
+    append(out, tree, tree_size);
+    if (encoder) {
+        out->size += tans_write_counts(counts, &out->data[out->size]);
+    }
+
+    BlockHeader block = { 0, 0, 0 };
+    uint32_t checksum = 0;
+    next = 0;
+    for (uint64_t i = 0; i < nbytes; i += block.raw_size + hole) {
+        block.raw_size = next_block(holes, &next, i, nbytes, &hole);
+        uint64_t bound = MAX_COUNTS + block_bound(&book, block.raw_size) + 5;
+        if (!buffer_reserve(out, out->size + 2 * sizeof(block) + bound)) {
+            free(encoder);
+            free(scratch);
+            return "Unable to allocate output buffer.";
+        }
+        uint8_t *coded = &out->data[out->size + sizeof(block)];
+        // A hole: an empty block holding the number of zero bytes it stands for, which the file checksum skips
+        if (hole > 0) {
+            block.coded_size = sizeof(hole);
+            memcpy(coded, &hole, sizeof(hole));
+            block.checksum = flags & FLAG_CHECKSUM ? crc32c(0, coded, sizeof(hole)) : 0;
+            append(out, &block, sizeof(block));
+            out->size += block.coded_size;
+            continue;
+        }
+        uint32_t prefix = 0;
+        if (flags & FLAG_COUNTS) {
+            uint64_t hist[ALPHABET] = { 0 };
+            count_symbols(&in[i], block.raw_size, hist);
+            prefix = counts_write(hist, coded);
+        }
+        block.coded_size
+            = prefix + code_block(&book, encoder, flags, &in[i], block.raw_size, &coded[prefix], scratch);
+        if (flags & FLAG_CHECKSUM) {
+            block.checksum = crc32c(0, coded, block.coded_size);
+            checksum = crc32c(checksum, &in[i], block.raw_size);
+        }
+        append(out, &block, sizeof(block));
+        out->size += block.coded_size;
+    }
+    free(encoder);
+    free(scratch);
+    // The terminating block
+    if (!buffer_reserve(out, out->size + sizeof(block))) {
+        return "Unable to allocate output buffer.";
+    }
+    block.raw_size = block.coded_size = 0;
+    block.checksum = checksum;
+    append(out, &block, sizeof(block));
+    return NULL;
+}
+
+// Decodes the blocks of a framed stream held in memory.
+// Returns NULL on success, or a message describing the failure
+//
+// t        : the decode table
+// wide     : the decode table of the 16-bit symbols under FLAG_WIDE, used instead of t
+// cache    : the cache to look up the tables blocks switch to under FLAG_TABLES
+// tans     : the tANS decoder, or NULL without FLAG_TANS
+// frame    : the frame header of the stream
+// in       : the bytes following the tree dump
+// nbytes   : the number of bytes in in
+// out      : the buffer to decode into, which must hold file_size bytes, less any holes kept out of it
+// file_size: the number of bytes the blocks decode to
+// used     : set to the number of bytes of in the blocks took up
+// scratch  : room for two blocks, used with FLAG_RLE or a filter
+// holes    : the list to add holes to instead of zeroing them in out, or NULL
+// base     : where the blocks start in the whole stream, for the offsets of their holes
+static const char *decompress_blocks(DecodeTable *t, WideTable *wide, TableCache *cache, TansDecoder *tans,
+    FrameHeader *frame, uint8_t *in, uint64_t nbytes, uint8_t *out, uint64_t file_size, uint64_t *used,
+    uint8_t *scratch, Holes *holes, uint64_t base) {
+    BlockHeader block;
+    DecodeTable *acquired = NULL;
+    const char *error = NULL;
+    uint64_t offset = 0, symbols = 0, skipped = 0;
+    uint32_t checksum = 0;
+    while (!error) {
+        if (nbytes - offset < sizeof(block)) {
+            error = "Truncated stream.";
+            break;
+        }
+        memcpy(&block, &in[offset], sizeof(block));
+        offset += sizeof(block);
+        // A hole
+        if (block.raw_size == 0 && block.coded_size != 0 && (frame->flags & FLAG_HOLES)) {
+            uint64_t hole = 0;
+            if (block.coded_size != sizeof(hole) || nbytes - offset < sizeof(hole)) {
+                error = "Corrupt or truncated block.";
+                break;
+            }
+            memcpy(&hole, &in[offset], sizeof(hole));
+            if (hole > file_size - symbols) {
+                error = "Corrupt or truncated block.";
+            } else if ((frame->flags & FLAG_CHECKSUM) && crc32c(0, &in[offset], sizeof(hole)) != block.checksum) {
+                error = "Block checksum mismatch.";
+            } else if (holes && !holes_add(holes, base + symbols, hole)) {
+                error = "Unable to allocate hole list.";
+            } else {
+                if (!holes) {
+                    memset(&out[symbols], 0, hole);
+                }
+                offset += sizeof(hole);
+                symbols += hole;
+                skipped += holes ? hole : 0;
+            }
+            continue;
+        }
+        // The terminating block
+        if (block.raw_size == 0) {
+            *used = offset;
+            if ((frame->flags & FLAG_CHECKSUM) && block.checksum != checksum) {
+                error = "File checksum mismatch.";
+            } else if (symbols != file_size) {
+                error = "Stream ended early.";
+            }
+            break;
+        }
+        if (block.raw_size > frame->block_size || block.raw_size > file_size - symbols
+            || block.coded_size > nbytes - offset) {
+            error = "Corrupt or truncated block.";
+            break;
+        }
+        uint8_t *coded = &in[offset];
+        uint32_t size = block.coded_size;
+        if ((frame->flags & FLAG_CHECKSUM) && crc32c(0, coded, size) != block.checksum) {
+            error = "Block checksum mismatch.";
+            break;
+        }
+        // The counts are only metadata
+        int32_t counted = frame->flags & FLAG_COUNTS ? counts_read(coded, size, block.raw_size, NULL) : 0;
+        if (counted < 0) {
+            error = "Invalid block counts.";
+            break;
+        }
+        coded += counted;
+        size -= counted;
+        int32_t switched = frame->flags & FLAG_TABLES ? switch_table(cache, coded, size, &acquired) : 0;
+        if (switched < 0) {
+            error = "Invalid Huffman encoding.";
+            break;
+        }
+        uint8_t *decoded_to = &out[symbols - skipped];
+        bool decoded = wide ? wide_decode(wide, coded, size, decoded_to, block.raw_size)
+                            : decode_block(acquired ? acquired : t, tans, frame->flags, &coded[switched],
+                                size - switched, decoded_to, block.raw_size, scratch);
+        if (!decoded) {
+            error = "Invalid Huffman codes.";
+        } else if (frame->flags & FLAG_CHECKSUM) {
+            checksum = crc32c(checksum, decoded_to, block.raw_size);
+        }
+        offset += block.coded_size;
+        symbols += block.raw_size;
+    }
+    if (acquired) {
+        cache_release(cache, acquired);
+    }
+    return error;
+}
+
+// Decompresses one member of a stream held in memory, appending it to a buffer.
+// Returns NULL on success, or a message describing the failure
+//
+// in    : the member, followed by whatever comes after it
+// nbytes: the number of bytes in in
+// cache : the cache to look decode tables up in
+// limit : the most bytes out may hold once the member is appended
+// out   : the buffer to append the decompressed bytes to
+// holes : the list to add the member's holes to instead of storing them in out, or NULL
+// used  : set to the number of bytes of in the member took up
+static const char *decompress_member(uint8_t *in, uint64_t nbytes, TableCache *cache, uint64_t limit, Buffer *out,
+    Holes *holes, uint64_t *used) {
+    Header header;
+    FrameHeader frame = { 0, 0 };
+    uint64_t offset = sizeof(header);
+    if (nbytes < sizeof(header)) {
+        return "Unable to read header.";
+    }
+    memcpy(&header, in, sizeof(header));
+    if (header.magic != MAGIC && header.magic != MAGIC_FRAMED) {
+        return "Invalid magic number.";
+    }
+    if (header.magic == MAGIC_FRAMED) {
+        if (nbytes - offset < sizeof(frame)) {
+            return "Invalid frame header.";
+        }
+        memcpy(&frame, &in[offset], sizeof(frame));
+        offset += sizeof(frame);
+        if (frame.block_size == 0 || frame.block_size > FRAME_BLOCK || !filter_valid(frame.flags)
+            || !wide_valid(frame.flags)) {
+            return "Invalid frame header.";
+        }
+    }
+    // Every Huffman code takes at least a bit (and codes two bytes under FLAG_WIDE), and every tANS or
+    // run-length coded block at least a block header, which bounds how much a stream can expand to (holes
+    // are not bounded at all, so only the caller's limit bounds them). Streams of 16-bit symbols have a code
+    // length table instead of a tree dump.
+    bool wide = frame.flags & FLAG_WIDE;
+    uint64_t expansion = frame.flags & (FLAG_TANS | FLAG_RLE)
+                             ? (nbytes - offset) / sizeof(BlockHeader) * frame.block_size
+                             : (nbytes - offset) * (wide ? 16 : 8);
+    expansion = frame.flags & FLAG_HOLES ? UINT64_MAX : expansion;
+    if ((header.tree_size == 0) != wide || header.tree_size > nbytes - offset || header.file_size > expansion) {
+        return "Invalid Huffman encoding.";
+    }
+    uint8_t *tree = &in[offset];
+    offset += header.tree_size;
+    WideTable *wide_table = NULL;
+    if (wide) {
+        uint8_t *lengths = (uint8_t *) malloc(WIDE_ALPHABET);
+        int64_t size = lengths ? wide_read_lengths(&in[offset], nbytes - offset, lengths) : -1;
+        wide_table = size < 0 ? NULL : wide_table_create(lengths);
+        free(lengths);
+        if (!wide_table) {
+            return "Invalid code length table.";
+        }
+        offset += size;
+    }
+    uint16_t counts[ALPHABET];
+    TansDecoder *tans = NULL;
+    if (frame.flags & FLAG_TANS) {
+        int32_t size = tans_read_counts(&in[offset], nbytes - offset, counts);
+        if (size < 0) {
+            return "Invalid tANS counts.";
+        }
+        offset += size;
+        tans = (TansDecoder *) malloc(sizeof(TansDecoder));
+        if (!tans) {
+            wide_table_delete(&wide_table);
+            return "Unable to allocate tANS decoder.";
+        }
+        tans_decoder_init(tans, counts);
+    }
+    uint8_t *scratch = frame.flags & (FLAG_RLE | FLAG_FILTER) ? (uint8_t *) malloc(2 * frame.block_size) : NULL;
+    if ((frame.flags & (FLAG_RLE | FLAG_FILTER)) && !scratch) {
+        free(tans);
+        wide_table_delete(&wide_table);
+        return "Unable to allocate block buffer.";
+    }
+
+    // Live streams only record their size in their blocks, and so do the holes of sparse streams, which take no
+    // room in out when the caller collects them
+    bool collect = holes && (frame.flags & FLAG_HOLES);
+    uint64_t skipped = 0, base = holes ? out->size + holes->size : 0;
+    int64_t live = frame.flags & FLAG_SYNC || collect ? blocks_size(&in[offset], nbytes - offset, &skipped) : 0;
+    header.file_size = frame.flags & FLAG_SYNC ? (uint64_t) live : header.file_size;
+    skipped = collect ? skipped : 0;
+    DecodeTable *t = wide ? NULL : cache_acquire(cache, header.tree_size, tree);
+    const char *error = NULL;
+    uint64_t coded = 0;
+    if (!t && !wide) {
+        error = "Invalid Huffman encoding.";
+    } else if (live < 0) {
+        error = "Truncated stream.";
+    } else if (collect && (uint64_t) live != header.file_size) {
+        error = "Stream ended early.";
+    } else if (header.file_size - skipped > limit - out->size) {
+        error = "Decompressed stream too large.";
+    } else if (!buffer_reserve(out, out->size + header.file_size - skipped)) {
+        error = "Unable to allocate output buffer.";
+    } else if (header.magic == MAGIC_FRAMED) {
+        error = decompress_blocks(t, wide_table, cache, tans, &frame, &in[offset], nbytes - offset,
+            &out->data[out->size], header.file_size, &coded, scratch, collect ? holes : NULL, base);
+    } else {
+        uint64_t pos = 0;
+        if (table_decode(t, &in[offset], nbytes - offset, &pos, (nbytes - offset) * 8,
+                &out->data[out->size], header.file_size)
+            != (int64_t) header.file_size) {
+            error = "Corrupt or truncated Huffman stream.";
+        }
+        coded = (pos + 7) / 8;
+    }
+    if (t) {
+        cache_release(cache, t);
+    }
+    wide_table_delete(&wide_table);
+    free(tans);
+    free(scratch);
+    if (!error) {
+        out->size += header.file_size - skipped;
+        *used = offset + coded;
+    }
+    return error;
+}
+
+// Decompresses a stream held in memory, in either the framed or the original format. Concatenated
+// members are decompressed back to back.
+// Returns NULL on success, or a message describing the failure
+//
+// in    : the compressed stream
+// nbytes: the number of bytes in in
+// cache : the cache to look decode tables up in, or NULL to build one for this stream
+// limit : the most bytes the stream may decompress to, not counting holes kept out of out
+// out   : the buffer to store the decompressed bytes into
+// holes : the list to store the holes of sparse members in, which out then leaves out, or NULL to store
+//         them in out as zero bytes
+const char *decompress_buffer(uint8_t *in, uint64_t nbytes, TableCache *cache, uint64_t limit, Buffer *out,
+    Holes *holes) {
+    // Room for the table of the member and the one its blocks last switched to
+    TableCache *local = cache ? NULL : cache_create(2);
+    TableCache *tables = cache ? cache : local;
+    const char *error = tables ? NULL : "Unable to allocate decode table.";
+    uint64_t offset = 0, used = 0;
+    out->size = 0;
+    if (holes) {
+        holes->count = holes->size = 0;
+    }
+    // At least one member, then as many as follow it
+    while (!error && (offset == 0 || offset < nbytes)) {
+        error = decompress_member(&in[offset], nbytes - offset, tables, limit, out, holes, &used);
+        offset += used;
+    }
+    if (error) {
+        out->size = 0;
+        if (holes) {
+            holes->count = holes->size = 0;
+        }
+    }
+    cache_delete(&local);
+    return error;
+}
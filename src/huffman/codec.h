@@ -0,0 +1,59 @@
+#pragma once
+
+#include "cache.h"
+#include "counts.h"
+#include "filter.h"
+#include "frame.h"
+#include "tans.h"
+#include "rle.h"
+#include "wide.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A growable byte buffer, kept between calls so its memory stays warm.
+typedef struct {
+    uint8_t *data;
+    uint64_t size;
+    uint64_t capacity;
+} Buffer;
+
+// A run of zero bytes that is skipped rather than coded or stored.
+typedef struct {
+    uint64_t offset; // Where the run starts, counting every byte of the stream (holes included).
+    uint64_t size;
+} Hole;
+
+// The holes of a sparse stream, in order, kept between calls like a buffer.
+typedef struct {
+    Hole *holes;
+    uint64_t count;
+    uint64_t capacity;
+    uint64_t size; // The number of zero bytes in every hole.
+} Holes;
+
+bool buffer_reserve(Buffer *b, uint64_t capacity);
+
+void buffer_free(Buffer *b);
+
+bool holes_add(Holes *h, uint64_t offset, uint64_t size);
+
+void holes_free(Holes *h);
+
+bool tans_smaller(CodeBook *book, uint64_t hist[static ALPHABET], uint16_t counts[static ALPHABET]);
+
+uint32_t code_block(CodeBook *book, TansEncoder *tans, uint32_t flags, uint8_t *in, uint32_t nsymbols, uint8_t *out,
+    uint8_t *scratch);
+
+void count_block(uint32_t flags, uint8_t *in, uint32_t nsymbols, uint64_t hist[static ALPHABET], uint8_t *scratch);
+
+int32_t switch_table(TableCache *cache, uint8_t *in, uint64_t nbytes, DecodeTable **acquired);
+
+bool decode_block(DecodeTable *t, TansDecoder *tans, uint32_t flags, uint8_t *in, uint64_t nbytes, uint8_t *out,
+    uint32_t nsymbols, uint8_t *scratch);
+
+int64_t blocks_size(uint8_t *in, uint64_t nbytes, uint64_t *holes);
+
+const char *compress_buffer(uint8_t *in, uint64_t nbytes, uint32_t flags, Holes *holes, Buffer *out);
+
+const char *decompress_buffer(uint8_t *in, uint64_t nbytes, TableCache *cache, uint64_t limit, Buffer *out,
+    Holes *holes);
@@ -0,0 +1,55 @@
+#include "counts.h"
+#include <string.h>
+
+// Writes the count of every byte value in a block, as a block starts under FLAG_COUNTS: a bitmap of
+// the values that occur, then the count of each of them minus 1 as a 16-bit integer, in value order.
+// A block holds at most FRAME_BLOCK bytes, so every count fits.
+// Returns the number of bytes written
+//
+// hist: the histogram of the block
+// out : the buffer to write the counts into
+uint32_t counts_write(uint64_t hist[static ALPHABET], uint8_t out[static MAX_COUNTS]) {
+    uint32_t size = COUNTS_BITMAP;
+    memset(out, 0, COUNTS_BITMAP);
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        if (hist[symbol] > 0) {
+            uint16_t count = hist[symbol] - 1;
+            out[symbol / 8] |= 1 << (symbol % 8);
+            memcpy(&out[size], &count, sizeof(count));
+            size += sizeof(count);
+        }
+    }
+    return size;
+}
+
+// Reads the counts a block starts with under FLAG_COUNTS.
+// Returns the number of bytes the counts took up, or -1 if they are truncated or do not add up to the
+// size of the block
+//
+// in      : the coded bytes of the block
+// nbytes  : the number of bytes in in
+// nsymbols: the number of bytes the block decodes to
+// counts  : set to the count of every byte value, or NULL to only skip the counts
+int32_t counts_read(uint8_t *in, uint64_t nbytes, uint32_t nsymbols, uint32_t *counts) {
+    uint32_t size = COUNTS_BITMAP;
+    uint64_t total = 0;
+    if (nbytes < COUNTS_BITMAP) {
+        return -1;
+    }
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        uint16_t count = 0;
+        bool present = (in[symbol / 8] >> (symbol % 8)) & 1;
+        if (present) {
+            if (nbytes - size < sizeof(count)) {
+                return -1;
+            }
+            memcpy(&count, &in[size], sizeof(count));
+            size += sizeof(count);
+            total += count + 1;
+        }
+        if (counts) {
+            counts[symbol] = present ? count + 1 : 0;
+        }
+    }
+    return total == nsymbols ? (int32_t) size : -1;
+}
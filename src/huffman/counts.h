@@ -0,0 +1,12 @@
+#pragma once
+
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define COUNTS_BITMAP (ALPHABET / 8) // Bytes of the bitmap of the byte values a block holds.
+#define MAX_COUNTS    (COUNTS_BITMAP + 2 * ALPHABET) // Most bytes the counts of a block take up.
+
+uint32_t counts_write(uint64_t hist[static ALPHABET], uint8_t out[static MAX_COUNTS]);
+
+int32_t counts_read(uint8_t *in, uint64_t nbytes, uint32_t nsymbols, uint32_t *counts);
@@ -1,31 +1,86 @@
 #include "huffman.h"
+#include "frame.h"
+#include "table.h"
+#include "codec.h"
+#include "batch.h"
+#include "speculate.h"
 #include "../io/io.h"
 #include "../header.h"
+#include "../utils/crc.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvVnt:j:S:b:i:o:"
 #define STATS   true
 
 enum Files { INFILE, OUTFILE };
-enum Paths { LEFT, RIGHT };
+
+static struct option long_options[] = {
+    { "verify", no_argument, NULL, 'V' },
+    { "nocache", no_argument, NULL, 'n' },
+    { "buffer-size", required_argument, NULL, 'b' },
+    { "threads", required_argument, NULL, 't' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "suffix", required_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 },
+};
 
 void help_message(void);
 void close_files(int64_t *files);
+bool decode_member(int64_t *files, Header *header, uint64_t offset, bool verify, Speculator *spec);
+bool decode_blocks(int64_t *files, DecodeTable *table, WideTable *wide, TansDecoder *tans, FrameHeader *frame,
+    uint64_t file_size, uint8_t *map, bool verify);
+bool decode_wide_member(int64_t *files, FrameHeader *frame, uint64_t file_size, uint8_t *map, bool verify);
+bool decode_stream(int64_t *files, DecodeTable *table, uint32_t longest, uint64_t file_size, uint8_t *map,
+    bool verify, Speculator *spec);
 
 int main(int argc, char **argv) {
     int8_t opt = 0;
-    bool stats = false;
+    bool stats = false, verify = false, input = false;
+    uint32_t threads = 1, ranges = 1;
+    char *outname = NULL, *suffix = BATCH_SUFFIX;
     int64_t files[2] = { STDIN_FILENO, STDOUT_FILENO };
     // Checks all flags
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'v': stats = STATS; break;
+        case 'V': verify = true; break;
+        case 'n': io_nocache = true; break;
+        case 'b':
+            if (!set_io_size(optarg)) {
+                fprintf(stderr, "Invalid buffer size.\n");
+                close_files(files);
+                help_message();
+                return 1;
+            }
+            break;
+        case 'j':
+            if (!(threads = batch_threads(optarg))) {
+                fprintf(stderr, "Invalid number of jobs.\n");
+                close_files(files);
+                help_message();
+                return 1;
+            }
+            break;
+        case 't':
+            if (!(ranges = batch_threads(optarg))) {
+                fprintf(stderr, "Invalid number of threads.\n");
+                close_files(files);
+                help_message();
+                return 1;
+            }
+            break;
+        case 'S': suffix = optarg; break;
         case 'i':
+            input = true;
             if (!optarg) {
                 close_files(files);
                 help_message();
@@ -45,13 +100,7 @@ int main(int argc, char **argv) {
                 help_message();
                 return 1;
             }
-            files[OUTFILE] = open(optarg, O_RDWR | O_CREAT | O_TRUNC);
-            if (files[OUTFILE] < 0) {
-                close_files(files);
-                perror("Invalid file");
-                help_message();
-                return 1;
-            }
+            outname = optarg;
             break;
         case 'h':
             close_files(files);
@@ -63,56 +112,66 @@ int main(int argc, char **argv) {
             return 1;
         }
     }
-    Header header;
-    // Ensure the header is valid and the input file is valid
-    if (read_bytes(files[INFILE], (uint8_t *) &header, sizeof(header)) < 2) {
-        fprintf(stderr, "Unable to read header.\n");
-        help_message();
-        return 1;
-    } else if (header.magic != MAGIC) {
-        fprintf(stderr, "Invalid magic number.\n");
-        help_message();
-        return 1;
+    // Files named after the options are decompressed as a batch, with outfile as the output directory
+    if (optind < argc) {
+        if (input || ranges > 1) {
+            fprintf(stderr, "%s takes a single infile.\n", input ? "-i" : "-t");
+            close_files(files);
+            help_message();
+            return 1;
+        }
+        BatchOptions options = { BATCH_DECOMPRESS, 0, outname, suffix, verify, stats };
+        close_files(files);
+        return run_batch(&argv[optind], argc - optind, threads, &options) ? 0 : 1;
     }
-    // Private file 
-    if (files[OUTFILE] != STDOUT_FILENO) {
-        fchmod(files[OUTFILE], header.permissions);
+    if (outname) {
+        files[OUTFILE] = open(outname, O_RDWR | O_CREAT | O_TRUNC);
+        if (files[OUTFILE] < 0) {
+            close_files(files);
+            perror("Invalid file");
+            help_message();
+            return 1;
+        }
     }
-    uint8_t tree[header.tree_size];
-    read_bytes(files[INFILE], tree, header.tree_size);
-
-    Node *root = rebuild_tree(header.tree_size, tree);
-    Node *current = root;
-    if (!root) {
+    // Single bitstreams are decoded in parallel ranges with -t
+    Speculator *spec = NULL;
+    if (ranges > 1 && !(spec = speculator_create(ranges))) {
+        fprintf(stderr, "Unable to start decode threads.\n");
         close_files(files);
-        delete_tree(&root);
-        fprintf(stderr, "Invalid Huffman encoding.\n");
         return 1;
     }
-
-    // Decodes encoded file
-    uint8_t bit, buffer[BLOCK];
-    uint64_t index = 0, symbols = 0;
-    while (read_bit(files[INFILE], &bit) && (symbols < header.file_size)) {
-        if (current) {
-            switch (bit) {
-            case LEFT: current = current->left; break;
-            case RIGHT: current = current->right; break;
-            default: break;
-            }
-            if (current && !current->left && !current->right) {
-                if (index == BLOCK) {
-                    write_bytes(files[OUTFILE], buffer, index);
-                    index = 0;
-                }
-                buffer[index++] = current->symbol;
-                symbols += 1;
-                current = root;
+    advise_input(files[INFILE]);
+    Header header;
+    uint64_t members = 0, offset = 0;
+    bool valid = true;
+    // Decodes every member of the infile back to back
+    while (valid) {
+        int curr_read = read_bytes(files[INFILE], (uint8_t *) &header, sizeof(header));
+        if (curr_read == 0 && members > 0) {
+            break;
+        }
+        // Ensure the header is valid and the input file is valid
+        if (curr_read != sizeof(header)) {
+            fprintf(stderr, "Unable to read header.\n");
+            valid = false;
+        } else if (header.magic != MAGIC && header.magic != MAGIC_FRAMED) {
+            fprintf(stderr, "Invalid magic number.\n");
+            valid = false;
+        }
+        if (!valid) {
+            if (members == 0) {
+                help_message();
             }
+            break;
+        }
+        // Private file, with the permissions of the first member
+        if (members == 0 && files[OUTFILE] != STDOUT_FILENO && !verify) {
+            fchmod(files[OUTFILE], header.permissions);
         }
+        valid = decode_member(files, &header, offset, verify, spec);
+        offset += header.file_size;
+        members += 1;
     }
-
-    write_bytes(files[OUTFILE], buffer, (symbols % BLOCK));
     // Prints stats
     if (stats) {
         fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", bytes_read);
@@ -120,9 +179,316 @@ int main(int argc, char **argv) {
         fprintf(
             stderr, "Space saving: %.2lf%%\n", 100 * (1 - (bytes_read / (bytes_written * 1.0))));
     }
+    speculator_delete(&spec);
     close_files(files);
+    return valid && reads_ok() && writes_ok() ? 0 : 1;
+}
+
+//
+// Decodes one member of the infile, whose header has already been read.
+// Returns whether the member decoded (and verified) cleanly
+//
+// files : an array of file descriptors
+// header: the header of the member
+// offset: the number of bytes the preceding members decoded to
+// verify: whether to only check the member without writing any output
+// spec  : the speculator to decode a single bitstream in parallel ranges with, or NULL
+//
+bool decode_member(int64_t *files, Header *header, uint64_t offset, bool verify, Speculator *spec) {
+    FrameHeader frame = { 0, 0 };
+    if (header->magic == MAGIC_FRAMED
+        && (read_bytes(files[INFILE], (uint8_t *) &frame, sizeof(frame)) != sizeof(frame)
+            || frame.block_size == 0 || frame.block_size > FRAME_BLOCK || !filter_valid(frame.flags)
+            || !wide_valid(frame.flags))) {
+        fprintf(stderr, "Invalid frame header.\n");
+        return false;
+    }
+    // Streams of 16-bit symbols have a code length table instead of a tree dump
+    if (frame.flags & FLAG_WIDE) {
+        if (header->tree_size != 0) {
+            fprintf(stderr, "Invalid Huffman encoding.\n");
+            return false;
+        }
+        uint8_t *map = verify ? NULL : map_output(files[OUTFILE], offset, header->file_size);
+        bool valid = decode_wide_member(files, &frame, header->file_size, map, verify);
+        unmap_output(map, offset, header->file_size);
+        return valid;
+    }
+    uint8_t tree[MAX_TREE_SIZE];
+    if (header->tree_size == 0 || header->tree_size > MAX_TREE_SIZE
+        || read_bytes(files[INFILE], tree, header->tree_size) != header->tree_size) {
+        fprintf(stderr, "Invalid Huffman encoding.\n");
+        return false;
+    }
+    // The tANS counts follow the tree dump: the last symbol with a count, then the counts up to it
+    uint8_t normalized[1 + 2 * ALPHABET];
+    uint16_t counts[ALPHABET];
+    if ((frame.flags & FLAG_TANS)
+        && (read_bytes(files[INFILE], normalized, 1) != 1
+            || read_bytes(files[INFILE], &normalized[1], 2 * (normalized[0] + 1)) != 2 * (normalized[0] + 1)
+            || tans_read_counts(normalized, sizeof(normalized), counts) < 0)) {
+        fprintf(stderr, "Invalid tANS counts.\n");
+        return false;
+    }
+    Node *root = rebuild_tree(header->tree_size, tree);
+    if (!root) {
+        fprintf(stderr, "Invalid Huffman encoding.\n");
+        return false;
+    }
+
+    Code codes[ALPHABET] = { 0 };
+    build_codes(root, codes);
+    DecodeTable *table = table_create(root, codes);
+    TansDecoder *tans = frame.flags & FLAG_TANS ? (TansDecoder *) malloc(sizeof(TansDecoder)) : NULL;
+    if (!table || ((frame.flags & FLAG_TANS) && !tans)) {
+        table_delete(&table);
+        free(tans);
+        delete_tree(&root);
+        fprintf(stderr, "Unable to allocate decode table.\n");
+        return false;
+    }
+    if (tans) {
+        tans_decoder_init(tans, counts);
+    }
+
+    // Regular outfiles are sized up front and decoded into directly. Live streams only record their size in
+    // their blocks, so they are written out a block at a time as the blocks arrive, and so are sparse ones,
+    // whose holes are skipped over rather than allocated.
+    bool live = frame.flags & FLAG_SYNC, sparse = frame.flags & FLAG_HOLES, valid = true;
+    uint8_t *map = verify || live || sparse ? NULL : map_output(files[OUTFILE], offset, header->file_size);
+    if (live) {
+        uint64_t written = bytes_written;
+        valid = decode_blocks(files, table, NULL, tans, &frame, UINT64_MAX, NULL, verify);
+        header->file_size = bytes_written - written;
+    } else if (header->magic == MAGIC_FRAMED) {
+        valid = decode_blocks(files, table, NULL, tans, &frame, header->file_size, map, verify);
+    } else {
+        valid = decode_stream(files, table, max_code_length(codes), header->file_size, map, verify, spec);
+    }
+    unmap_output(map, offset, header->file_size);
+    free(tans);
+    table_delete(&table);
     delete_tree(&root);
-    return 0;
+    return valid;
+}
+
+//
+// Decodes the blocks of a member of 16-bit symbols, after reading its code length table.
+// Returns whether the member decoded (and verified) cleanly
+//
+// files    : an array of file descriptors
+// frame    : the frame header of the member
+// file_size: the number of bytes the blocks decode to
+// map      : the mapped outfile to decode into, or NULL to write the outfile a block at a time
+// verify   : whether to only check the stream without writing any output
+//
+bool decode_wide_member(int64_t *files, FrameHeader *frame, uint64_t file_size, uint8_t *map, bool verify) {
+    uint8_t *table = (uint8_t *) malloc(WIDE_LENGTHS), *lengths = (uint8_t *) malloc(WIDE_ALPHABET);
+    uint32_t symbols = 0;
+    WideTable *wide = NULL;
+    if (table && lengths && read_bytes(files[INFILE], table, sizeof(symbols)) == sizeof(symbols)) {
+        memcpy(&symbols, table, sizeof(symbols));
+        if (symbols <= WIDE_ALPHABET
+            && read_bytes(files[INFILE], &table[sizeof(symbols)], 3 * symbols) == (int) (3 * symbols)
+            && wide_read_lengths(table, WIDE_LENGTHS, lengths) >= 0) {
+            wide = wide_table_create(lengths);
+        }
+    }
+    free(table);
+    free(lengths);
+    if (!wide) {
+        fprintf(stderr, "Invalid code length table.\n");
+        return false;
+    }
+    bool valid = decode_blocks(files, NULL, wide, NULL, frame, file_size, map, verify);
+    wide_table_delete(&wide);
+    return valid;
+}
+
+//
+// Decodes a single, unframed bitstream of codes through a sliding window of the infile.
+// Returns whether all the symbols decoded without leaving the tree or the stream
+//
+// files    : an array of file descriptors
+// table    : the decode table built from the huffman tree
+// longest  : the length of the longest code in bits
+// file_size: the number of symbols to decode
+// map      : the mapped outfile to decode into, or NULL to write the outfile a window at a time
+// verify   : whether to only check the stream without writing any output
+// spec     : the speculator to decode every window in parallel ranges with, or NULL to decode serially
+//
+bool decode_stream(int64_t *files, DecodeTable *table, uint32_t longest, uint64_t file_size, uint8_t *map,
+    bool verify, Speculator *spec) {
+    // Parallel windows span a range per thread, and every coded bit may be a symbol
+    uint64_t window = spec ? speculate_window(spec) : io_size, room = spec ? 8 * window : io_size;
+    uint8_t *in = (uint8_t *) malloc(window), *out = map ? NULL : (uint8_t *) malloc(room);
+    if (!in || (!map && !out)) {
+        fprintf(stderr, "Unable to allocate stream buffers.\n");
+        free(in);
+        free(out);
+        return false;
+    }
+    uint64_t symbols = 0, pos = 0, nbytes = read_bytes(files[INFILE], in, window);
+    bool eof = nbytes < window;
+    while (symbols < file_size) {
+        // Until the end of the infile, only start codes (or table probes of several short codes) that are
+        // certain to be in the window
+        uint64_t reach = longest > TABLE_BITS ? longest : TABLE_BITS;
+        uint64_t limit = eof ? nbytes * 8 : nbytes * 8 - reach + 1;
+        uint64_t wanted = file_size - symbols;
+        if (!map && wanted > room) {
+            wanted = room;
+        }
+        uint8_t *dest = map ? &map[symbols] : out;
+        int64_t decoded = spec ? speculate_decode(spec, table, in, nbytes, &pos, limit, dest, wanted)
+                               : table_decode(table, in, nbytes, &pos, limit, dest, wanted);
+        if (decoded < 0 || (decoded == 0 && eof)) {
+            break;
+        }
+        if (!verify && !map) {
+            write_bytes(files[OUTFILE], out, decoded);
+        }
+        symbols += decoded;
+        // Slide the window past the consumed bytes and refill it
+        if (!eof) {
+            memmove(in, &in[pos / 8], nbytes - pos / 8);
+            nbytes -= pos / 8;
+            pos %= 8;
+            nbytes += read_bytes(files[INFILE], &in[nbytes], window - nbytes);
+            eof = nbytes < window;
+        }
+    }
+    if (symbols < file_size) {
+        fprintf(stderr, "Corrupt or truncated Huffman stream after %" PRIu64 " bytes.\n", symbols);
+    } else {
+        // The member ends at the byte holding its last code; the rest of the window is the next member
+        unread_bytes(files[INFILE], &in[(pos + 7) / 8], nbytes - (pos + 7) / 8);
+    }
+    free(in);
+    free(out);
+    return symbols == file_size;
+}
+
+//
+// Decodes a series of framed blocks, verifying their checksums if they carry any.
+// Returns whether every block (and the whole file) decoded and verified cleanly
+//
+// files    : an array of file descriptors
+// table    : the decode table built from the huffman tree
+// wide     : the decode table of the 16-bit symbols under FLAG_WIDE, used instead of table
+// tans     : the tANS decoder, or NULL without FLAG_TANS
+// frame    : the frame header of the stream
+// file_size: the number of bytes the blocks decode to, or the most they may decode to under FLAG_SYNC
+// map      : the mapped outfile to decode into, or NULL to write the outfile a block at a time
+// verify   : whether to only check the stream without writing any output
+//
+bool decode_blocks(int64_t *files, DecodeTable *table, WideTable *wide, TansDecoder *tans, FrameHeader *frame,
+    uint64_t file_size, uint8_t *map, bool verify) {
+    BlockHeader block;
+    // Blocks that switch tables also carry a tree dump, and counted blocks their counts
+    uint64_t prefixes = (frame->flags & FLAG_TABLES ? sizeof(uint16_t) + MAX_TREE_SIZE : 0)
+                        + (frame->flags & FLAG_COUNTS ? MAX_COUNTS : 0);
+    uint8_t *raw = (uint8_t *) malloc(frame->block_size);
+    uint8_t *coded = (uint8_t *) malloc(
+        (uint64_t) frame->block_size * MAX_CODE_SIZE + STREAMS * sizeof(uint64_t) + prefixes);
+    uint8_t *scratch
+        = frame->flags & (FLAG_RLE | FLAG_FILTER) ? (uint8_t *) malloc(2 * frame->block_size) : NULL;
+    TableCache *cache = frame->flags & FLAG_TABLES ? cache_create(4) : NULL;
+    DecodeTable *acquired = NULL;
+    uint32_t checksum = 0;
+    uint64_t blocks = 0, symbols = 0;
+    bool valid = false, ended = false;
+    if (!raw || !coded || ((frame->flags & (FLAG_RLE | FLAG_FILTER)) && !scratch)
+        || ((frame->flags & FLAG_TABLES) && !cache)) {
+        fprintf(stderr, "Unable to allocate block buffers.\n");
+        free(raw);
+        free(coded);
+        free(scratch);
+        cache_delete(&cache);
+        return false;
+    }
+    while (read_bytes(files[INFILE], (uint8_t *) &block, sizeof(block)) == sizeof(block)) {
+        ended = true;
+        // A hole, recreated by seeking past it in regular outfiles
+        if (block.raw_size == 0 && block.coded_size != 0 && (frame->flags & FLAG_HOLES)) {
+            uint64_t hole = 0;
+            if (block.coded_size != sizeof(hole)
+                || read_bytes(files[INFILE], (uint8_t *) &hole, sizeof(hole)) != sizeof(hole)
+                || hole > file_size - symbols
+                || ((frame->flags & FLAG_CHECKSUM) && crc32c(0, (uint8_t *) &hole, sizeof(hole)) != block.checksum)) {
+                fprintf(stderr, "Corrupt or truncated hole after block %" PRIu64 ".\n", blocks);
+                break;
+            }
+            if (!verify && !write_hole(files[OUTFILE], hole)) {
+                fprintf(stderr, "Unable to write hole after block %" PRIu64 ".\n", blocks);
+                break;
+            }
+            symbols += hole;
+            ended = false;
+            continue;
+        }
+        // The terminating block
+        if (block.raw_size == 0) {
+            valid = !(frame->flags & FLAG_CHECKSUM) || block.checksum == checksum;
+            if (!valid) {
+                fprintf(stderr, "File checksum mismatch.\n");
+            } else if (symbols != file_size && !(frame->flags & FLAG_SYNC)) {
+                fprintf(stderr, "Stream ended after %" PRIu64 " bytes.\n", symbols);
+                valid = false;
+            }
+            break;
+        }
+        if (block.raw_size > frame->block_size || block.raw_size > file_size - symbols
+            || block.coded_size > (uint64_t) block.raw_size * MAX_CODE_SIZE + STREAMS * sizeof(uint64_t) + prefixes
+            || read_bytes(files[INFILE], coded, block.coded_size) != (int) block.coded_size) {
+            fprintf(stderr, "Corrupt or truncated block %" PRIu64 ".\n", blocks);
+            break;
+        }
+        if ((frame->flags & FLAG_CHECKSUM) && crc32c(0, coded, block.coded_size) != block.checksum) {
+            fprintf(stderr, "Checksum mismatch in block %" PRIu64 ".\n", blocks);
+            break;
+        }
+        // The counts are only metadata
+        int32_t counted = frame->flags & FLAG_COUNTS ? counts_read(coded, block.coded_size, block.raw_size, NULL) : 0;
+        if (counted < 0) {
+            fprintf(stderr, "Invalid counts in block %" PRIu64 ".\n", blocks);
+            break;
+        }
+        uint8_t *out = map ? &map[symbols] : raw, *codes = &coded[counted];
+        uint32_t size = block.coded_size - counted;
+        int32_t switched = cache ? switch_table(cache, codes, size, &acquired) : 0;
+        if (switched < 0) {
+            fprintf(stderr, "Invalid Huffman tree in block %" PRIu64 ".\n", blocks);
+            break;
+        }
+        bool decoded = wide ? wide_decode(wide, codes, size, out, block.raw_size)
+                            : decode_block(acquired ? acquired : table, tans, frame->flags, &codes[switched],
+                                size - switched, out, block.raw_size, scratch);
+        if (!decoded) {
+            fprintf(stderr, "Invalid Huffman codes in block %" PRIu64 ".\n", blocks);
+            break;
+        }
+        if (frame->flags & FLAG_CHECKSUM) {
+            checksum = crc32c(checksum, out, block.raw_size);
+        }
+        if (!verify && !map) {
+            write_bytes(files[OUTFILE], raw, block.raw_size);
+        }
+        symbols += block.raw_size;
+        blocks += 1;
+        ended = false;
+    }
+    if (!ended) {
+        fprintf(stderr, "Truncated stream.\n");
+    }
+    if (acquired) {
+        cache_release(cache, acquired);
+    }
+    cache_delete(&cache);
+    free(raw);
+    free(coded);
+    free(scratch);
+    return valid;
 }
 
 //
@@ -148,11 +514,24 @@ void help_message(void) {
            "  A Huffman decoder."
            "  Decompresses a file using the Huffman coding algorithm.\n\n"
            "USAGE\n"
-           "  ./decode [-h] [-i infile] [-o outfile]\n\n"
+           "  ./decode [-hvVn] [-b size] [-t threads] [-i infile] [-o outfile]\n"
+           "  ./decode [-hvV] [-j jobs] [-S suffix] [-o outdir] file...\n\n"
            "OPTIONS\n"
            "  -h             Program usage and help.\n"
            "  -v             Print compression statistics.\n"
+           "  -V, --verify   Check the stream (and its checksums) without writing output.\n"
+           "  -b, --buffer-size size\n"
+           "                 Size of the read/write buffers, e.g. 1M (default: 64K, max: 64M).\n"
+           "  -n, --nocache  Drop infile and outfile pages from the page cache once done with them.\n"
+           "  -t, --threads threads\n"
+           "                 Decode members in the original single-bitstream format on this many threads.\n"
            "  -i infile      Input file to decompress.\n"
-           "  -o outfile     Output of decompressed data.\n");
+           "  -o outfile     Output of decompressed data.\n"
+           "  file...        Decompress every file in one process, to its name without the suffix next\n"
+           "                 to it, or in outdir with -o; a file that fails does not stop the others.\n"
+           "  -j, --jobs jobs\n"
+           "                 Number of files to decompress at once (default: 1).\n"
+           "  -S, --suffix suffix\n"
+           "                 Suffix of the compressed files (default: " BATCH_SUFFIX ").\n");
     return;
 }
@@ -1,129 +1,848 @@
 #include "huffman.h"
+#include "frame.h"
+#include "analyze.h"
+#include "batch.h"
+#include "codec.h"
+#include "split.h"
 #include "../io/io.h"
 #include "../header.h"
+#include "../utils/crc.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvcmtrRkaAdnf:s:w:F:p:j:S:b:i:o:"
 #define STATS   true
+#define SAMPLE_CHUNKS 64 // Chunks a sampled histogram is read in, unless they would be smaller than BLOCK.
 
 enum Files { INFILE, OUTFILE, TEMP };
+enum Runs { RUNS_AUTO, RUNS_ON, RUNS_OFF };
+
+// How a live infile is cut into blocks: every block is written once it holds size bytes, or wait milliseconds
+// after its first byte arrived, whichever comes first.
+typedef struct {
+    uint32_t size;
+    uint32_t wait;
+} Flush;
+
+// How much of the infile a sampled histogram is built from: size bytes, or percent of the infile.
+typedef struct {
+    uint64_t size;
+    uint32_t percent;
+} Sample;
+
+static struct option long_options[] = {
+    { "checksum", no_argument, NULL, 'c' },
+    { "streams", no_argument, NULL, 'm' },
+    { "tans", no_argument, NULL, 't' },
+    { "rle", no_argument, NULL, 'r' },
+    { "no-rle", no_argument, NULL, 'R' },
+    { "counts", no_argument, NULL, 'k' },
+    { "filter", required_argument, NULL, 'f' },
+    { "split", required_argument, NULL, 's' },
+    { "width", required_argument, NULL, 'w' },
+    { "flush", required_argument, NULL, 'F' },
+    { "sample", required_argument, NULL, 'p' },
+    { "append", no_argument, NULL, 'a' },
+    { "analyze", no_argument, NULL, 'A' },
+    { "direct", no_argument, NULL, 'd' },
+    { "nocache", no_argument, NULL, 'n' },
+    { "buffer-size", required_argument, NULL, 'b' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "suffix", required_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 },
+};
 
 void close_files(int64_t *files);
-void encode_file(int64_t *files, uint8_t *buffer, Code *table);
+bool encode_file(int64_t *files, uint8_t *buffer, CodeBook *book, uint64_t *seen);
+bool encode_blocks(int64_t *files, CodeBook *book, TansEncoder *tans, uint32_t flags, uint32_t effort, WideBook *wide,
+    Flush *flush, uint64_t *seen);
+bool encode_wide(int64_t *files, uint64_t *pairs, uint32_t flags, uint64_t total, bool stats);
+bool encode_live(int64_t *files, uint32_t flags, Flush *flush, bool stats);
+bool set_flush(const char *flush, Flush *live);
+int read_live(int infile, uint8_t *buf, uint32_t nbytes, uint32_t wait);
+bool set_sample(const char *sample, Sample *part);
+uint64_t sample_file(int64_t *files, uint64_t sample, uint8_t *buffer, uint64_t *histogram, uint32_t *flags);
+void report_sampling(uint64_t *seen, Code *table, uint64_t sampled, uint64_t file_size);
+uint64_t write_headers(int64_t *files, uint32_t flags, uint16_t tree_size, uint64_t total);
+bool count_file_blocks(int64_t *files, uint32_t flags, uint64_t *plain, uint64_t *runs);
 void help_message(char *, int64_t files[3]);
 bool check_optarg(char *optarg, int64_t files[3]);
 
 
 int main(int argc, char **argv) {
     int8_t opt = 0;
-    bool stats = false;
+    bool stats = false, append = false, analyze = false, direct = false, wide = false;
+    uint32_t flags = 0, runs = RUNS_AUTO, threads = 1, effort = 0;
+    char *inname = NULL, *outname = NULL, *suffix = BATCH_SUFFIX;
+    Flush live = { 0, 0 };
+    Sample part = { 0, 0 };
     int64_t files[3] = { STDIN_FILENO, STDOUT_FILENO, -1 };
     // Checks all flags
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'v': stats = STATS; break;
-        case 'i':
-            if (!check_optarg(optarg, files)) {
+        case 'c': flags |= FLAG_CHECKSUM; break;
+        case 'm': flags |= FLAG_STREAMS; break;
+        case 't': flags |= FLAG_TANS; break;
+        case 'r': runs = RUNS_ON; break;
+        case 'R': runs = RUNS_OFF; break;
+        case 'k': flags |= FLAG_COUNTS; break;
+        case 'f':
+            if (!set_filter(optarg, &flags)) {
+                help_message("Invalid filter.\n", files);
                 return EXIT_FAILURE;
             }
-            files[INFILE] = open(optarg, O_RDONLY);
-            if (files[INFILE] < 0) {
-                help_message("Invalid file.\n", files);
+            break;
+        case 's':
+            if (!(effort = split_effort(optarg))) {
+                help_message("Invalid split effort.\n", files);
                 return EXIT_FAILURE;
             }
             break;
-        case 'o':
+        case 'w':
+            if (strcmp(optarg, "8") != 0 && strcmp(optarg, "16") != 0) {
+                help_message("Invalid symbol width.\n", files);
+                return EXIT_FAILURE;
+            }
+            wide = strcmp(optarg, "16") == 0;
+            break;
+        case 'F':
+            if (!set_flush(optarg, &live)) {
+                help_message("Invalid flush interval.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            if (!set_sample(optarg, &part)) {
+                help_message("Invalid sample size.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'a': append = true; break;
+        case 'A': analyze = true; break;
+        case 'd': direct = true; break;
+        case 'n': io_nocache = true; break;
+        case 'b':
+            if (!set_io_size(optarg)) {
+                help_message("Invalid buffer size.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'j':
+            if (!(threads = batch_threads(optarg))) {
+                help_message("Invalid number of jobs.\n", files);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S': suffix = optarg; break;
+        case 'i':
             if (!check_optarg(optarg, files)) {
                 return EXIT_FAILURE;
             }
-            files[OUTFILE] = open(optarg, O_RDWR | O_CREAT | O_TRUNC);
-            if (files[OUTFILE] < 0) {
-                help_message("Invalid file.\n", files);
+            inname = optarg;
+            break;
+        case 'o':
+            if (!check_optarg(optarg, files)) {
                 return EXIT_FAILURE;
             }
+            outname = optarg;
             break;
         case 'h': help_message("", files); return EXIT_SUCCESS;
         default: help_message("", files); return EXIT_FAILURE;
         }
     }
+    // Files named after the options are compressed as a batch, with outfile as the output directory
+    if (optind < argc) {
+        if (inname || append || analyze || runs == RUNS_OFF || effort || wide || live.size || part.size
+            || part.percent) {
+            help_message("-i, -a, -A, -R, -s, -w 16, -F and -p take a single infile.\n", files);
+            return EXIT_FAILURE;
+        }
+        flags |= runs == RUNS_ON ? FLAG_RLE : 0;
+        BatchOptions options = { BATCH_COMPRESS, flags, outname, suffix, false, stats };
+        return run_batch(&argv[optind], argc - optind, threads, &options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (inname) {
+        files[INFILE] = open_input(inname, direct);
+        if (files[INFILE] < 0) {
+            help_message("Invalid file.\n", files);
+            return EXIT_FAILURE;
+        }
+    }
+    if (analyze && effort) {
+        help_message("-A does not support -s.\n", files);
+        return EXIT_FAILURE;
+    }
+    // Live blocks are coded before the rest of the infile has been seen, so nothing can be planned over it
+    if (live.size && ((flags & FLAG_TANS) || effort || wide || analyze)) {
+        help_message("-F does not support -t, -s, -w 16 and -A.\n", files);
+        return EXIT_FAILURE;
+    }
+    flags |= effort ? FLAG_TABLES : 0;
+    // 16-bit symbols are only coded with Huffman codes, and optionally checksummed and counted
+    if (wide && ((flags & ~(FLAG_CHECKSUM | FLAG_COUNTS)) || runs == RUNS_ON || analyze)) {
+        help_message("-w 16 only supports -c and -k.\n", files);
+        return EXIT_FAILURE;
+    }
+    // A sample is read at offsets spread over a regular infile. Only the flags that code every block with the
+    // one table fit it, and the run-length pre-pass is not tried, since deciding on it takes another pass.
+    struct stat sb;
+    bool sampling = part.size || part.percent;
+    if (sampling && (files[INFILE] == STDIN_FILENO || fstat(files[INFILE], &sb) != 0 || !S_ISREG(sb.st_mode))) {
+        help_message("-p needs a regular infile.\n", files);
+        return EXIT_FAILURE;
+    }
+    if (sampling && ((flags & ~(FLAG_CHECKSUM | FLAG_STREAMS | FLAG_COUNTS)) || runs == RUNS_ON || wide || analyze
+                        || live.size)) {
+        help_message("-p only supports -c, -m, -k and -R.\n", files);
+        return EXIT_FAILURE;
+    }
+    uint64_t sample = !sampling ? 0 : part.percent ? (uint64_t) sb.st_size / 100 * part.percent : part.size;
+    sampling = sampling && sample < (uint64_t) sb.st_size;
+    runs = sampling ? RUNS_OFF : runs;
+    // A dry run only reads the infile
+    if (analyze) {
+        bool valid = analyze_file(files[INFILE], flags | (runs == RUNS_ON ? FLAG_RLE : 0), runs == RUNS_AUTO, stats);
+        if (!valid && reads_ok()) {
+            fprintf(stderr, "Unable to allocate block histograms.\n");
+        }
+        close_files(files);
+        return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    // Appending adds a new member after the ones already in the outfile
+    if (outname) {
+        files[OUTFILE] = open(outname, O_RDWR | O_CREAT | (append ? O_APPEND : O_TRUNC));
+        if (files[OUTFILE] < 0) {
+            help_message("Invalid file.\n", files);
+            return EXIT_FAILURE;
+        }
+    }
+    if (live.size) {
+        bool valid = encode_live(files, flags | (runs == RUNS_ON ? FLAG_RLE : 0), &live, stats) && reads_ok();
+        close_files(files);
+        return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
     if (files[INFILE] == STDIN_FILENO) {
         files[TEMP] = open("/tmp/read", O_RDWR | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG);
     }
 
     uint16_t unique = 2;
-    uint8_t buffer[BLOCK] = { 0 };
-    uint64_t curr_read, histogram[ALPHABET] = { 0 };
+    uint8_t *buffer = io_alloc(io_size);
+    uint64_t curr_read, hole = 0, histogram[ALPHABET] = { 0 }, seen[ALPHABET] = { 0 }, sampled = 0;
+    uint64_t *pairs = wide ? (uint64_t *) calloc(WIDE_ALPHABET, sizeof(uint64_t)) : NULL;
+    if (!buffer || (wide && !pairs)) {
+        free(buffer);
+        help_message("Unable to allocate read buffer.\n", files);
+        return EXIT_FAILURE;
+    }
     histogram[0] += 1;
     histogram[ALPHABET - 1] += 1;
-    // creates the histogram for the Huffman tree
-    while ((curr_read = read_bytes(files[INFILE], buffer, BLOCK)) > 0) {
+    // creates the histogram for the Huffman tree, from a sample with -p. The holes of a sparse infile are skipped
+    // instead of read, and stored as holes (in the framed format), except in streams of 16-bit symbols.
+    bool sparse = files[TEMP] == -1 && !wide;
+    if (sampling) {
+        sampled = sample_file(files, sample, buffer, histogram, &flags);
+    }
+    while (!sampling
+           && ((curr_read = read_extent(files[INFILE], buffer, io_size, sparse ? &hole : NULL)) > 0 || hole > 0)) {
+        flags |= hole > 0 ? FLAG_HOLES : 0;
         if (files[TEMP] != -1) {
             uint32_t temporary = write_bytes(files[TEMP], buffer, curr_read);
             // Needed to remove the bytes written to the temporary file
             bytes_written -= temporary;
         }
-        for (uint64_t i = 0; i < curr_read; i++) {
-            if (histogram[buffer[i]] == 0) {
-                unique += 1;
-            }
-            histogram[buffer[i]] += 1;
+        // io_size is even, so only the last read can split a 16-bit symbol
+        if (pairs) {
+            count_pairs(buffer, curr_read, pairs);
+        } else {
+            count_symbols(buffer, curr_read, histogram);
         }
     }
+    // A failed read would otherwise pass for the end of the infile
+    if (!reads_ok()) {
+        free(pairs);
+        free(buffer);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
+    uint64_t total = bytes_read;
+    if (wide) {
+        bool valid = encode_wide(files, pairs, flags, total, stats) && reads_ok();
+        free(pairs);
+        free(buffer);
+        close_files(files);
+        return valid ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    // Filtered blocks need their own histogram, and filtered inputs or inputs dominated by one symbol are
+    // coded after the run-length pre-pass if that codes smaller. Both take another pass over the infile.
+    bool filtered = FILTER(flags) != FILTER_NONE;
+    bool check_runs = runs == RUNS_ON || (runs == RUNS_AUTO && (filtered || rle_dominated(histogram)));
+    uint64_t coded[ALPHABET] = { 0 };
+    if ((filtered || check_runs)
+        && !count_file_blocks(files, flags, filtered ? histogram : NULL, check_runs ? coded : NULL)) {
+        fprintf(stderr, "Unable to allocate block buffers.\n");
+        free(buffer);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
+    if (runs == RUNS_ON || (check_runs && rle_smaller(histogram, coded))) {
+        flags |= FLAG_RLE;
+        memcpy(histogram, coded, sizeof(histogram));
+    }
+    for (uint16_t symbol = 1; symbol < ALPHABET - 1; symbol++) {
+        unique += histogram[symbol] > 0;
+    }
     Node *root = build_tree(histogram);
-    Code table[ALPHABET];
+    Code table[ALPHABET] = { 0 };
     build_codes(root, table);
-
-    // writes the header
-    struct stat sb;
-    fstat(files[INFILE], &sb);
-    uint64_t file_size = files[TEMP] == -1 ? sb.st_size : bytes_read;
-    uint16_t permissions = sb.st_mode, tree_size = (3 * unique) - 1;
-    Header header = { MAGIC, permissions, tree_size, file_size };
-    if (files[OUTFILE] != STDOUT_FILENO) {
-        fchmod(files[OUTFILE], sb.st_mode);
+    static CodeBook book;
+    codebook_init(&book, table);
+    // tANS is only used when it beats the Huffman codes over the whole file
+    static TansEncoder tans;
+    uint16_t counts[ALPHABET];
+    histogram[0] -= 1;
+    histogram[ALPHABET - 1] -= 1;
+    if ((flags & FLAG_TANS) && tans_normalize(histogram, counts) && tans_smaller(&book, histogram, counts)) {
+        tans_encoder_init(&tans, counts);
+    } else {
+        flags &= ~FLAG_TANS;
     }
-    write_bytes(files[OUTFILE], (uint8_t *) &header, sizeof(header));
 
+    // writes the header
+    uint64_t file_size = write_headers(files, flags, (3 * unique) - 1, total);
     dump_tree(files[OUTFILE], root);
+    if (flags & FLAG_TANS) {
+        uint8_t normalized[1 + 2 * ALPHABET];
+        write_bytes(files[OUTFILE], normalized, tans_write_counts(counts, normalized));
+    }
     // writes codes for every symbol
     lseek(files[TEMP] != -1 ? files[TEMP] : files[INFILE], 0, SEEK_SET);
-    encode_file(files, buffer, table);
-    flush_codes(files[OUTFILE]);
+    uint64_t *counted = sampling ? seen : NULL;
+    if (!(flags ? encode_blocks(files, &book, &tans, flags, effort, NULL, NULL, counted)
+                : encode_file(files, buffer, &book, counted))) {
+        fprintf(stderr, "Unable to allocate code buffers.\n");
+        free(buffer);
+        delete_tree(&root);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
+    if (!reads_ok()) {
+        free(buffer);
+        delete_tree(&root);
+        close_files(files);
+        return EXIT_FAILURE;
+    }
 
     // Stats print
     if (stats) {
-        fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", bytes_read / 2);
+        fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", file_size);
         fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", bytes_written);
-        fprintf(
-            stderr, "Space saving: %.2lf%%\n", 100 * (1 - (bytes_written / (bytes_read / 2.0))));
+        fprintf(stderr, "Space saving: %.2lf%%\n", 100 * (1 - (bytes_written / (file_size * 1.0))));
+        if (sampling) {
+            report_sampling(seen, table, sampled, file_size);
+        }
     }
+    free(buffer);
     delete_tree(&root);
     close_files(files);
     return 0;
 }
 
+//
+// write_headers writes the header of a new member, and the frame header if it is framed.
+//
+// write_headers takes 4 arguments: files, flags, tree_size, and total. Files is an array of file descriptors
+// (infile and outfile), flags holds the frame flags (0 for the original format) and tree_size the size of the
+// tree dump that follows. Total is the number of bytes read from the infile, which is the file size of a pipe.
+// Under FLAG_SYNC the file size is not known yet, and 0 is recorded.
+//
+// write_headers returns the file size recorded in the header.
+//
+uint64_t write_headers(int64_t *files, uint32_t flags, uint16_t tree_size, uint64_t total) {
+    struct stat sb;
+    fstat(files[INFILE], &sb);
+    uint64_t file_size = flags & FLAG_SYNC ? 0 : files[TEMP] == -1 ? (uint64_t) sb.st_size : total;
+    uint16_t permissions = sb.st_mode;
+    Header header = { flags ? MAGIC_FRAMED : MAGIC, permissions, tree_size, file_size };
+    // An outfile that already holds members keeps its permissions
+    struct stat ob;
+    if (files[OUTFILE] != STDOUT_FILENO && fstat(files[OUTFILE], &ob) == 0 && ob.st_size == 0) {
+        fchmod(files[OUTFILE], sb.st_mode);
+    }
+    write_bytes(files[OUTFILE], (uint8_t *) &header, sizeof(header));
+    if (flags) {
+        FrameHeader frame = { flags, FRAME_BLOCK };
+        write_bytes(files[OUTFILE], (uint8_t *) &frame, sizeof(frame));
+    }
+    return file_size;
+}
+
+//
+// encode_wide writes an infile as a member of 16-bit symbols: little-endian byte pairs, coded with canonical
+// codes whose lengths are stored in place of the tree dump.
+//
+// encode_wide takes 5 arguments: files, pairs, flags, total, and stats. Files is an array of file descriptors
+// (infile, outfile and temporary file) and pairs the histogram of the 16-bit symbols of the infile. Flags holds
+// the frame flags besides FLAG_WIDE, total the number of bytes read from the infile, and stats whether to
+// print compression statistics.
+//
+// encode_wide returns whether the code book and the block buffers could be allocated.
+//
+bool encode_wide(int64_t *files, uint64_t *pairs, uint32_t flags, uint64_t total, bool stats) {
+    WideBook *book = wide_book_create(pairs);
+    uint8_t *lengths = (uint8_t *) malloc(WIDE_LENGTHS);
+    if (!book || !lengths) {
+        fprintf(stderr, "Unable to allocate code book.\n");
+        free(book);
+        free(lengths);
+        return false;
+    }
+    flags |= FLAG_WIDE;
+    uint64_t file_size = write_headers(files, flags, 0, total);
+    write_bytes(files[OUTFILE], lengths, wide_write_lengths(book, lengths));
+    free(lengths);
+    lseek(files[TEMP] != -1 ? files[TEMP] : files[INFILE], 0, SEEK_SET);
+    bool valid = encode_blocks(files, NULL, NULL, flags, 0, book, NULL, NULL);
+    free(book);
+    if (!valid) {
+        fprintf(stderr, "Unable to allocate code buffers.\n");
+    } else if (stats) {
+        fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", file_size);
+        fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", bytes_written);
+        fprintf(stderr, "Space saving: %.2lf%%\n", 100 * (1 - (bytes_written / (file_size * 1.0))));
+    }
+    return valid;
+}
+
+//
+// encode_live writes an infile as it arrives, for pipes that are read while they are still being written to.
+// Every block is coded with a table of its own (or the one before it) and written out as soon as it is cut,
+// so each block reaches the outfile within the flush interval of its first byte.
+//
+// encode_live takes 4 arguments: files, flags, flush, and stats. Files is an array of file descriptors (infile
+// and outfile) and flags holds the frame flags, to which FLAG_TABLES and FLAG_SYNC are added. Flush holds when
+// blocks are cut, and stats whether to print compression statistics.
+//
+// encode_live returns whether the block buffers could be allocated.
+//
+bool encode_live(int64_t *files, uint32_t flags, Flush *flush, bool stats) {
+    // The member's table only has the padding symbols, so every block with data in it switches tables
+    uint16_t unique = 2;
+    uint64_t histogram[ALPHABET] = { 0 };
+    histogram[0] += 1;
+    histogram[ALPHABET - 1] += 1;
+    Node *root = build_tree(histogram);
+    if (!root) {
+        fprintf(stderr, "Unable to allocate Huffman tree.\n");
+        return false;
+    }
+    Code table[ALPHABET] = { 0 };
+    build_codes(root, table);
+    static CodeBook book;
+    codebook_init(&book, table);
+    flags |= FLAG_TABLES | FLAG_SYNC;
+    write_headers(files, flags, (3 * unique) - 1, 0);
+    dump_tree(files[OUTFILE], root);
+    delete_tree(&root);
+    bool valid = encode_blocks(files, &book, NULL, flags, 0, NULL, flush, NULL);
+    if (!valid) {
+        fprintf(stderr, "Unable to allocate code buffers.\n");
+    } else if (stats) {
+        fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", bytes_read);
+        fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", bytes_written);
+        fprintf(stderr, "Space saving: %.2lf%%\n", 100 * (1 - (bytes_written / (bytes_read * 1.0))));
+    }
+    return valid;
+}
+
+//
+// read_live reads the next block of a live infile: nbytes bytes, or fewer if wait milliseconds pass after the
+// first byte of the block arrived, or the infile ends, before then.
+//
+// read_live takes 4 arguments: infile, buf, nbytes, and wait. Infile is the file to read from, buf the buffer to
+// store the block into, nbytes the most bytes in a block and wait the flush interval in milliseconds.
+//
+// read_live returns the number of bytes read, which is 0 at the end of the infile.
+//
+int read_live(int infile, uint8_t *buf, uint32_t nbytes, uint32_t wait) {
+    struct timespec first, now;
+    uint32_t filled = 0;
+    int timeout = -1;
+    while (filled < nbytes) {
+        int curr_read = read_ready(infile, &buf[filled], nbytes - filled, timeout);
+        if (curr_read <= 0) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (filled == 0) {
+            first = now;
+        }
+        filled += curr_read;
+        // The time left until the block is due
+        int64_t waited = (now.tv_sec - first.tv_sec) * 1000 + (now.tv_nsec - first.tv_nsec) / 1000000;
+        if (waited >= wait) {
+            break;
+        }
+        timeout = wait - waited;
+    }
+    return filled;
+}
+
+//
+// set_flush parses a flush interval: the most milliseconds a block waits for more bytes after its first, optionally
+// followed by the most bytes in a block, as in 100 or 20:4K (default and at most 64K).
+//
+// set_flush takes 2 arguments: flush and live. Flush is the interval to parse and live is set to it.
+//
+// set_flush returns whether the interval was valid.
+//
+bool set_flush(const char *flush, Flush *live) {
+    char *end;
+    uint64_t wait = strtoull(flush, &end, 10), size = FRAME_BLOCK;
+    if (end == flush || wait > INT32_MAX) {
+        return false;
+    }
+    if (*end == ':') {
+        flush = end + 1;
+        size = strtoull(flush, &end, 10);
+        if (end == flush || size > FRAME_BLOCK) {
+            return false;
+        }
+        if (*end == 'k' || *end == 'K') {
+            size <<= 10;
+            end++;
+        }
+        if (size == 0 || size > FRAME_BLOCK) {
+            return false;
+        }
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    live->wait = wait;
+    live->size = size;
+    return true;
+}
+
+//
+// set_sample parses the size of the sample a histogram is built from: a number of bytes, as in 64M (with a K, M
+// or G suffix), or a percentage of the infile from 1 to 99, as in 5%.
+//
+// set_sample takes 2 arguments: sample and part. Sample is the size to parse and part is set to it.
+//
+// set_sample returns whether the size was valid.
+//
+bool set_sample(const char *sample, Sample *part) {
+    char *end;
+    uint64_t value = strtoull(sample, &end, 10);
+    if (end == sample || value == 0) {
+        return false;
+    }
+    if (*end == '%') {
+        part->percent = value;
+        part->size = 0;
+        return end[1] == '\0' && value < 100;
+    }
+    switch (*end) {
+    case 'k':
+    case 'K': value <<= 10; end++; break;
+    case 'm':
+    case 'M': value <<= 20; end++; break;
+    case 'g':
+    case 'G': value <<= 30; end++; break;
+    default: break;
+    }
+    part->size = value;
+    part->percent = 0;
+    return *end == '\0' && value < ((uint64_t) 1 << 50);
+}
+
+//
+// sample_file builds the histogram of a regular infile from a sample of it instead of the whole file.
+//
+// sample_file takes 5 arguments: files, sample, buffer, histogram, and flags. Files is an array of file descriptors
+// (infile and outfile) and sample the number of bytes to read, in up to SAMPLE_CHUNKS chunks spread evenly over
+// the infile. Buffer holds io_size bytes, histogram gets the counts of the sampled bytes and flags gets FLAG_HOLES
+// if a chunk runs into a hole. Every byte value is then counted once more, as the padding symbols are, so that the
+// ones the sample missed still get a code.
+//
+// sample_file returns the number of bytes sampled.
+//
+uint64_t sample_file(int64_t *files, uint64_t sample, uint8_t *buffer, uint64_t *histogram, uint32_t *flags) {
+    struct stat sb;
+    uint64_t chunk = sample / SAMPLE_CHUNKS / BLOCK * BLOCK, sampled = 0, hole = 0;
+    chunk = chunk < BLOCK ? BLOCK : chunk > io_size ? io_size : chunk;
+    uint64_t chunks = sample > chunk ? (sample + chunk - 1) / chunk : 1;
+    fstat(files[INFILE], &sb);
+    for (uint64_t k = 0; k < chunks; k++) {
+        // Offsets stay aligned for O_DIRECT
+        lseek(files[INFILE], (uint64_t) sb.st_size / chunks * k / IO_ALIGN * IO_ALIGN, SEEK_SET);
+        uint64_t curr_read = read_extent(files[INFILE], buffer, chunk, &hole);
+        *flags |= hole > 0 ? FLAG_HOLES : 0;
+        count_symbols(buffer, curr_read, histogram);
+        sampled += curr_read;
+    }
+    for (uint16_t symbol = 1; symbol < ALPHABET - 1; symbol++) {
+        histogram[symbol] += 1;
+    }
+    return sampled;
+}
+
+//
+// report_sampling prints how much the codes built from a sample cost over the codes a full histogram would give.
+//
+// report_sampling takes 4 arguments: seen, table, sampled, and file_size. Seen is the histogram of every byte
+// coded, table the codes built from the sample, sampled the number of bytes in the sample and file_size the size
+// of the infile. The cost counts the coded bits and the tree dumps, which framing adds the same to either way.
+//
+void report_sampling(uint64_t *seen, Code *table, uint64_t sampled, uint64_t file_size) {
+    uint64_t padded[ALPHABET], sampled_bits = 0, full_bits = 0;
+    uint16_t unique = 2;
+    memcpy(padded, seen, sizeof(padded));
+    padded[0] += 1;
+    padded[ALPHABET - 1] += 1;
+    Node *root = build_tree(padded);
+    Code full[ALPHABET] = { 0 };
+    build_codes(root, full);
+    delete_tree(&root);
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        sampled_bits += seen[symbol] * code_size(&table[symbol]);
+        full_bits += seen[symbol] * code_size(&full[symbol]);
+        unique += symbol > 0 && symbol < ALPHABET - 1 && seen[symbol] > 0;
+    }
+    // The sampled tree has a leaf for every byte value
+    int64_t cost = (int64_t) ((sampled_bits + 7) / 8 + 3 * ALPHABET - 1)
+                   - (int64_t) ((full_bits + 7) / 8 + 3 * unique - 1);
+    fprintf(stderr, "Sampled: %" PRIu64 " of %" PRIu64 " bytes (%.2lf%%)\n", sampled, file_size,
+        file_size ? 100 * (sampled / (file_size * 1.0)) : 0);
+    fprintf(stderr, "Sampling cost: %" PRId64 " bytes (%.2lf%% less space saving)\n", cost,
+        file_size ? 100 * (cost / (file_size * 1.0)) : 0);
+    return;
+}
+
 //
 // encode_file simply writes the codes for every symbol in an infile.
 //
-// encode_file takes 3 arguments: files, buffer, and table. Files is an array of file descriptors (infile and outfile)
-// while buffer is a buffer to hold the read bytes. Additionally, table is an array of Codes for every symbol.
+// encode_file takes 4 arguments: files, buffer, book, and seen. Files is an array of file descriptors (infile and
+// outfile) while buffer is a buffer to hold the read bytes. Additionally, book holds the Codes for every symbol,
+// and seen, if not NULL, gets the histogram of every byte coded.
 //
-// encode_file returns nothing/void.
+// encode_file returns whether the code buffer could be allocated.
 //
-void encode_file(int64_t *files, uint8_t *buffer, Code *table) {
+bool encode_file(int64_t *files, uint8_t *buffer, CodeBook *book, uint64_t *seen) {
     uint64_t curr_read = 0, file = files[INFILE] == STDIN_FILENO ? files[TEMP] : files[INFILE];
-    while ((curr_read = read_bytes(file, buffer, BLOCK)) > 0) {
-        for (uint64_t i = 0; i < curr_read; i++) {
-            write_code(files[OUTFILE], &table[buffer[i]]);
+    uint8_t *coded = (uint8_t *) malloc(block_bound(book, io_size));
+    if (!coded) {
+        return false;
+    }
+    BitWriter w;
+    writer_init(&w, coded);
+    while ((curr_read = read_bytes(file, buffer, io_size)) > 0) {
+        if (seen) {
+            count_symbols(buffer, curr_read, seen);
         }
+        pack_codes(book, &w, buffer, curr_read);
+        // Only whole words have been stored; the rest stays pending in the writer
+        write_bytes(files[OUTFILE], coded, w.out - coded);
+        w.out = coded;
     }
-    return;
+    write_bytes(files[OUTFILE], coded, writer_flush(&w) - coded);
+    free(coded);
+    return true;
+}
+
+//
+// encode_blocks writes the codes for every symbol in an infile as a series of framed blocks.
+//
+// encode_blocks takes 8 arguments: files, book, tans, flags, effort, wide, flush, and seen. Files is an array of
+// file descriptors (infile and outfile), book holds the Codes for every symbol and tans the tANS tables, used with
+// FLAG_TANS. Flags selects the optional parts of each block, such as the CRC32C of its coded bytes. The stream
+// ends with an empty block holding the CRC32C of the whole input. Under FLAG_WIDE, blocks are coded with the
+// codes of the 16-bit symbols in wide instead of book.
+//
+// Under FLAG_TABLES, every block is coded with the table of the block before it (starting with book) or
+// switches to a table of its own, whichever codes it smaller. With an effort, blocks are no longer cut every
+// FRAME_BLOCK bytes: split_chunk() places their boundaries where the statistics of the infile change. With a
+// flush, blocks are cut from a live infile by read_live() and written out one at a time. Under FLAG_COUNTS,
+// every block starts with the count of every byte value in it, ahead of any table switch. Under FLAG_HOLES,
+// the holes of the infile are skipped and written as empty blocks that hold their size. Seen, if not NULL, gets
+// the histogram of every byte coded.
+//
+// encode_blocks returns whether the block buffers could be allocated.
+//
+bool encode_blocks(int64_t *files, CodeBook *book, TansEncoder *tans, uint32_t flags, uint32_t effort, WideBook *wide,
+    Flush *flush, uint64_t *seen) {
+    uint64_t curr_read = 0, file = files[TEMP] != -1 ? files[TEMP] : files[INFILE];
+    // Reads hold whole blocks, and blocks are written out once io_size bytes of them have gathered (or at once,
+    // when flushing). A block that switches tables also holds a tree dump, and can be coded with any table.
+    uint32_t chunk = flush ? flush->size : (io_size + FRAME_BLOCK - 1) / FRAME_BLOCK * FRAME_BLOCK;
+    uint64_t used = 0;
+    uint64_t bound = sizeof(BlockHeader) + (wide ? wide_bound(FRAME_BLOCK) : block_bound(book, FRAME_BLOCK) + 5);
+    if (flags & FLAG_TABLES) {
+        bound = sizeof(BlockHeader) + sizeof(uint16_t) + MAX_TREE_SIZE + (uint64_t) FRAME_BLOCK * MAX_CODE_SIZE
+                + STREAMS * sizeof(uint64_t) + 5;
+    }
+    bound += flags & FLAG_COUNTS ? MAX_COUNTS : 0;
+    uint8_t *raw = io_alloc(chunk);
+    uint8_t *staged = (uint8_t *) malloc(io_size + bound);
+    uint8_t *scratch = (uint8_t *) malloc(2 * FRAME_BLOCK);
+    uint32_t *sizes = effort ? (uint32_t *) malloc(chunk / split_segment(effort) * sizeof(uint32_t)) : NULL;
+    BlockTable *tables = flags & FLAG_TABLES ? (BlockTable *) malloc(2 * sizeof(BlockTable)) : NULL;
+    if (!raw || !staged || !scratch || (effort && !sizes) || ((flags & FLAG_TABLES) && !tables)) {
+        free(raw);
+        free(staged);
+        free(scratch);
+        free(sizes);
+        free(tables);
+        return false;
+    }
+    BlockTable *current = tables, *next = tables ? &tables[1] : NULL;
+    if (current) {
+        current->book = *book;
+    }
+    BlockHeader block = { 0, 0, 0 };
+    uint32_t checksum = 0;
+    uint64_t hole = 0, *holes = flags & FLAG_HOLES ? &hole : NULL;
+    bool valid = true;
+    while (valid
+           && ((curr_read = flush ? read_live(file, raw, chunk, flush->wait) : read_extent(file, raw, chunk, holes)) > 0
+               || hole > 0)) {
+        if (seen) {
+            count_symbols(raw, curr_read, seen);
+        }
+        uint32_t blocks = effort && curr_read ? split_chunk(raw, curr_read, flags, effort, sizes) : 0;
+        valid = !effort || !curr_read || blocks > 0;
+        for (uint64_t i = 0, b = 0; valid && i < curr_read; i += block.raw_size, b++) {
+            uint8_t *coded = &staged[used + sizeof(block)];
+            block.raw_size = effort ? sizes[b] : curr_read - i < FRAME_BLOCK ? curr_read - i : FRAME_BLOCK;
+            CodeBook *codes = book;
+            uint32_t prefix = 0;
+            if (flags & FLAG_COUNTS) {
+                uint64_t counted[ALPHABET] = { 0 };
+                count_symbols(&raw[i], block.raw_size, counted);
+                prefix = counts_write(counted, coded);
+            }
+            if (flags & FLAG_TABLES) {
+                // The table switch: the size of the new tree dump and the dump, or 0 to keep the table
+                uint64_t hist[ALPHABET] = { 0 };
+                bool switched = false;
+                count_block(flags, &raw[i], block.raw_size, hist, scratch);
+                if (!(valid = choose_table(current, hist, next, &switched))) {
+                    break;
+                }
+                if (switched) {
+                    BlockTable *previous = current;
+                    current = next;
+                    next = previous;
+                }
+                uint16_t tree_size = switched ? current->tree_size : 0;
+                memcpy(&coded[prefix], &tree_size, sizeof(tree_size));
+                memcpy(&coded[prefix + sizeof(tree_size)], current->tree, tree_size);
+                prefix += sizeof(tree_size) + tree_size;
+                codes = &current->book;
+            }
+            if (wide) {
+                block.coded_size = prefix + wide_pack(wide, &raw[i], block.raw_size, &coded[prefix]);
+            } else {
+                block.coded_size
+                    = prefix + code_block(codes, tans, flags, &raw[i], block.raw_size, &coded[prefix], scratch);
+            }
+            if (flags & FLAG_CHECKSUM) {
+                block.checksum = crc32c(0, coded, block.coded_size);
+                checksum = crc32c(checksum, &raw[i], block.raw_size);
+            }
+            memcpy(&staged[used], &block, sizeof(block));
+            used += sizeof(block) + block.coded_size;
+            if (used >= io_size || flush) {
+                write_bytes(files[OUTFILE], staged, used);
+                used = 0;
+            }
+        }
+        // A hole: an empty block holding the number of zero bytes it stands for, which the file checksum skips
+        if (hole > 0) {
+            BlockHeader empty = { 0, sizeof(hole), 0 };
+            if (flags & FLAG_CHECKSUM) {
+                empty.checksum = crc32c(0, (uint8_t *) &hole, sizeof(hole));
+            }
+            memcpy(&staged[used], &empty, sizeof(empty));
+            memcpy(&staged[used + sizeof(empty)], &hole, sizeof(hole));
+            used += sizeof(empty) + sizeof(hole);
+            if (used >= io_size) {
+                write_bytes(files[OUTFILE], staged, used);
+                used = 0;
+            }
+        }
+    }
+    // The terminating block
+    if (valid) {
+        block.raw_size = block.coded_size = 0;
+        block.checksum = checksum;
+        memcpy(&staged[used], &block, sizeof(block));
+        write_bytes(files[OUTFILE], staged, used + sizeof(block));
+    }
+    free(raw);
+    free(staged);
+    free(scratch);
+    free(sizes);
+    free(tables);
+    return valid;
+}
+
+//
+// count_file_blocks rebuilds the histograms of an infile from its blocks as encode_blocks codes them.
+//
+// count_file_blocks takes 4 arguments: files, flags, plain, and runs. Files is an array of file descriptors
+// (infile and temporary file) and flags holds the filter every block goes through. Plain is the histogram of
+// the filtered blocks and runs the histogram of the filtered blocks after the run-length pre-pass. Either may
+// be NULL, and both keep the two padding symbols.
+//
+// count_file_blocks returns whether the block buffers could be allocated.
+//
+bool count_file_blocks(int64_t *files, uint32_t flags, uint64_t *plain, uint64_t *runs) {
+    uint64_t curr_read = 0, file = files[INFILE] == STDIN_FILENO ? files[TEMP] : files[INFILE];
+    uint32_t chunk = (io_size + FRAME_BLOCK - 1) / FRAME_BLOCK * FRAME_BLOCK;
+    uint8_t *raw = io_alloc(chunk);
+    uint8_t *scratch = (uint8_t *) malloc(2 * FRAME_BLOCK);
+    if (!raw || !scratch) {
+        free(raw);
+        free(scratch);
+        return false;
+    }
+    uint64_t *hists[2] = { plain, runs };
+    for (uint8_t h = 0; h < 2; h++) {
+        if (hists[h]) {
+            memset(hists[h], 0, ALPHABET * sizeof(uint64_t));
+            hists[h][0] += 1;
+            hists[h][ALPHABET - 1] += 1;
+        }
+    }
+    lseek(file, 0, SEEK_SET);
+    // Holes are skipped as encode_blocks skips them, so that blocks are cut in the same places
+    uint64_t hole = 0;
+    while ((curr_read = read_extent(file, raw, chunk, flags & FLAG_HOLES ? &hole : NULL)) > 0 || hole > 0) {
+        for (uint64_t i = 0; i < curr_read; i += FRAME_BLOCK) {
+            uint32_t size = curr_read - i < FRAME_BLOCK ? curr_read - i : FRAME_BLOCK;
+            uint8_t *block = filter_block(flags, &raw[i], size, scratch);
+            if (plain) {
+                count_symbols(block, size, plain);
+            }
+            if (runs) {
+                count_runs(block, size, runs, &scratch[FRAME_BLOCK]);
+            }
+        }
+    }
+    free(raw);
+    free(scratch);
+    return true;
 }
 
 //
@@ -154,15 +873,60 @@ void help_message(char *error, int64_t files[3]) {
     }
     close_files(files);
     fprintf(stderr, "SYNOPSIS\n"
-                    "  A word filtering program for the GPRSC.\n"
-                    "  Filters out and reports bad words parsed from stdin.\n\n"
+                    "  A Huffman encoder.\n"
+                    "  Compresses a file using the Huffman coding algorithm.\n\n"
                     "USAGE\n"
-                    "  ./banhammer [-hs] [-t size] [-f size]\n\n"
+                    "  ./encode [-hvcmtrRkaAdn] [-f filter] [-s effort] [-w width] [-F flush] [-b size]\n"
+                    "           [-p sample] [-i infile] [-o outfile]\n"
+                    "  ./encode [-hvcmtrk] [-f filter] [-j jobs] [-S suffix] [-o outdir] file...\n\n"
                     "OPTIONS\n"
-                    "  -h           Program usage and help.\n"
-                    "  -s           Print program statistics.\n"
-                    "  -t size      Specify hash table size (default: 2^16).\n"
-                    "  -f size      Specify Bloom filter size (default: 2^20).\n");
+                    "  -h             Program usage and help.\n"
+                    "  -v             Print compression statistics.\n"
+                    "  -c, --checksum Write CRC32C checksums per block and for the whole file.\n"
+                    "  -m, --streams  Split every block into 4 bitstreams for faster decoding.\n"
+                    "  -t, --tans     Code blocks with tANS instead of Huffman wherever that is smaller.\n"
+                    "  -r, --rle      Run-length code blocks before coding them (default: when\n"
+                    "                 the infile is filtered or one symbol makes up 3/4 of it, and its\n"
+                    "                 runs code smaller).\n"
+                    "  -R, --no-rle   Never run-length code blocks.\n"
+                    "  -k, --counts   Store the count of every byte value in every block, so that\n"
+                    "                 inspect can answer counting queries without decoding.\n"
+                    "  -f, --filter filter\n"
+                    "                 Transform blocks before coding them, for fixed-width binary data:\n"
+                    "                 delta[:N] (every byte minus the one N bytes before it, default 1)\n"
+                    "                 or shuffle[:N] (byte planes of N-byte elements, default 4).\n"
+                    "  -s, --split effort\n"
+                    "                 Place block boundaries where the data changes, and give blocks their\n"
+                    "                 own tables where that codes smaller. Effort 1 keeps 64KB blocks, and\n"
+                    "                 every step up to 4 looks 4x closer (and takes about 4x the CPU).\n"
+                    "  -w, --width width\n"
+                    "                 Bits per symbol: 8 (default) or 16, for 16-bit data such as UTF-16\n"
+                    "                 text and audio samples (little-endian byte pairs). Only -c and -k\n"
+                    "                 combine with 16-bit symbols.\n"
+                    "  -F, --flush wait[:size]\n"
+                    "                 Code infile as it arrives, for live pipes: a block is written once\n"
+                    "                 it holds size bytes (default: 64K) or wait milliseconds after its\n"
+                    "                 first byte, with a table of its own. Not with -t, -s, -w 16 or -A.\n"
+                    "  -p, --sample sample\n"
+                    "                 Build the codes from a sample of infile instead of reading it twice:\n"
+                    "                 a size, e.g. 64M, or a percentage, e.g. 5%%, spread over the file.\n"
+                    "                 Every byte value gets a code; -v prints what the sample cost. Needs a\n"
+                    "                 regular infile, and only -c, -m, -k and -R combine with it.\n"
+                    "  -a, --append   Add a new member to the end of outfile instead of replacing it.\n"
+                    "  -A, --analyze  Report the exact compressed size and code statistics without writing\n"
+                    "                 any output (-v adds a line per block).\n"
+                    "  -b, --buffer-size size\n"
+                    "                 Size of the read/write buffers, e.g. 1M (default: 64K, max: 64M).\n"
+                    "  -d, --direct   Read infile with O_DIRECT, bypassing the page cache.\n"
+                    "  -n, --nocache  Drop infile and outfile pages from the page cache once done with them.\n"
+                    "  -i infile      Input file to compress.\n"
+                    "  -o outfile     Output of compressed data.\n"
+                    "  file...        Compress every file in one process, to file" BATCH_SUFFIX " next to it, or in\n"
+                    "                 outdir with -o; a file that fails does not stop the others.\n"
+                    "  -j, --jobs jobs\n"
+                    "                 Number of files to compress at once (default: 1).\n"
+                    "  -S, --suffix suffix\n"
+                    "                 Suffix of the compressed files (default: " BATCH_SUFFIX ").\n");
     return;
 }
 
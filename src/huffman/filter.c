@@ -0,0 +1,161 @@
+#include "filter.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH_BITS 0x8080808080808080ULL // The top bit of every byte of a word.
+
+// Adds two words byte by byte, without carries from one byte into the next.
+//
+// a: the first word
+// b: the second word
+static inline uint64_t add_bytes(uint64_t a, uint64_t b) {
+    return ((a & ~HIGH_BITS) + (b & ~HIGH_BITS)) ^ ((a ^ b) & HIGH_BITS);
+}
+
+// Parses a filter of the form name[:stride] ("delta", "delta:4", "shuffle:8") into the frame flags.
+// The delta filter defaults to a stride of 1 and the shuffle filter to 4.
+// Returns whether the filter was valid
+//
+// filter: the filter to parse
+// flags : the frame flags to set the filter and its stride in
+bool set_filter(const char *filter, uint32_t *flags) {
+    uint32_t type = FILTER_NONE, stride = 1;
+    size_t length = strcspn(filter, ":");
+    if (length == strlen("delta") && strncmp(filter, "delta", length) == 0) {
+        type = FILTER_DELTA;
+    } else if (length == strlen("shuffle") && strncmp(filter, "shuffle", length) == 0) {
+        type = FILTER_SHUFFLE;
+        stride = 4;
+    } else if (length == strlen("none") && strncmp(filter, "none", length) == 0) {
+        *flags &= ~(FLAG_FILTER | FLAG_STRIDE);
+        return filter[length] == '\0';
+    } else {
+        return false;
+    }
+    if (filter[length] == ':') {
+        char *end;
+        stride = strtoul(&filter[length + 1], &end, 10);
+        if (*end != '\0' || end == &filter[length + 1]) {
+            return false;
+        }
+    } else if (filter[length] != '\0') {
+        return false;
+    }
+    if (stride == 0 || stride > 255) {
+        return false;
+    }
+    *flags = (*flags & ~(FLAG_FILTER | FLAG_STRIDE)) | type << 8 | stride << 16;
+    return true;
+}
+
+// Checks the filter of a set of frame flags read from a stream.
+// Returns whether the filter is one unfilter_block() can undo
+//
+// flags: the frame flags
+bool filter_valid(uint32_t flags) {
+    return FILTER(flags) == FILTER_NONE || (FILTER(flags) <= FILTER_SHUFFLE && STRIDE(flags) > 0);
+}
+
+// Delta filter: every byte minus the byte a stride before it. There is no dependency between
+// iterations, so the loop vectorizes as it is.
+static void delta_encode(uint8_t *in, uint32_t nbytes, uint32_t stride, uint8_t *out) {
+    uint32_t first = stride < nbytes ? stride : nbytes;
+    memcpy(out, in, first);
+    for (uint32_t i = first; i < nbytes; i++) {
+        out[i] = in[i] - in[i - stride];
+    }
+    return;
+}
+
+// Undoes delta_encode(), 8 bytes at a time. Strides of 8 or more add whole words of earlier
+// output. Strides of 1, 2 and 4 take the prefix sum within a word in log steps and then add the
+// last element of the previous word to every element.
+static void delta_decode(uint8_t *in, uint32_t nbytes, uint32_t stride, uint8_t *out) {
+    uint32_t i = 0;
+    uint64_t word, prev = 0;
+    if (stride >= sizeof(word)) {
+        i = stride < nbytes ? stride : nbytes;
+        memcpy(out, in, i);
+        for (; i + sizeof(word) <= nbytes; i += sizeof(word)) {
+            memcpy(&word, &in[i], sizeof(word));
+            memcpy(&prev, &out[i - stride], sizeof(prev));
+            word = add_bytes(word, prev);
+            memcpy(&out[i], &word, sizeof(word));
+        }
+    } else if (stride == 1 || stride == 2 || stride == 4) {
+        // The last element of the previous word, repeated across a word
+        uint64_t repeat = stride == 1   ? 0x0101010101010101ULL
+                          : stride == 2 ? 0x0001000100010001ULL
+                                        : 0x0000000100000001ULL;
+        for (; i + sizeof(word) <= nbytes; i += sizeof(word)) {
+            memcpy(&word, &in[i], sizeof(word));
+            for (uint32_t shift = 8 * stride; shift < 64; shift *= 2) {
+                word = add_bytes(word, word << shift);
+            }
+            word = add_bytes(word, (prev >> (64 - 8 * stride)) * repeat);
+            memcpy(&out[i], &word, sizeof(word));
+            prev = word;
+        }
+    }
+    // Odd strides, and the end of the block
+    for (; i < nbytes; i++) {
+        out[i] = i < stride ? in[i] : in[i] + out[i - stride];
+    }
+    return;
+}
+
+// Shuffle filter: splits stride-byte elements into byte planes. Any bytes past the last whole
+// element are left at the end as they are.
+static void shuffle(uint8_t *in, uint32_t nbytes, uint32_t stride, uint8_t *out) {
+    uint32_t elements = nbytes / stride;
+    for (uint32_t b = 0; b < stride; b++) {
+        for (uint32_t e = 0; e < elements; e++) {
+            out[b * elements + e] = in[e * stride + b];
+        }
+    }
+    memcpy(&out[elements * stride], &in[elements * stride], nbytes - elements * stride);
+    return;
+}
+
+// Undoes shuffle().
+static void unshuffle(uint8_t *in, uint32_t nbytes, uint32_t stride, uint8_t *out) {
+    uint32_t elements = nbytes / stride;
+    for (uint32_t e = 0; e < elements; e++) {
+        for (uint32_t b = 0; b < stride; b++) {
+            out[e * stride + b] = in[b * elements + e];
+        }
+    }
+    memcpy(&out[elements * stride], &in[elements * stride], nbytes - elements * stride);
+    return;
+}
+
+// Transforms a block with the filter of the frame flags. Every block is filtered on its own, so
+// blocks still decode independently.
+// Returns the filtered block: out, or in itself without a filter
+//
+// flags : the frame flags
+// in    : the block
+// nbytes: the number of bytes in the block
+// out   : the buffer to filter into, which must hold nbytes bytes
+uint8_t *filter_block(uint32_t flags, uint8_t *in, uint32_t nbytes, uint8_t *out) {
+    switch (FILTER(flags)) {
+    case FILTER_DELTA: delta_encode(in, nbytes, STRIDE(flags), out); return out;
+    case FILTER_SHUFFLE: shuffle(in, nbytes, STRIDE(flags), out); return out;
+    default: return in;
+    }
+}
+
+// Undoes filter_block().
+//
+// flags : the frame flags, whose filter must be valid and not FILTER_NONE
+// in    : the filtered block
+// nbytes: the number of bytes in the block
+// out   : the buffer to store the block into
+void unfilter_block(uint32_t flags, uint8_t *in, uint32_t nbytes, uint8_t *out) {
+    switch (FILTER(flags)) {
+    case FILTER_DELTA: delta_decode(in, nbytes, STRIDE(flags), out); break;
+    case FILTER_SHUFFLE: unshuffle(in, nbytes, STRIDE(flags), out); break;
+    default: memcpy(out, in, nbytes); break;
+    }
+    return;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FILTER(flags) (((flags) & FLAG_FILTER) >> 8) // The FILTER_ in a set of frame flags.
+#define STRIDE(flags) (((flags) & FLAG_STRIDE) >> 16) // The filter stride in a set of frame flags.
+
+bool set_filter(const char *filter, uint32_t *flags);
+
+bool filter_valid(uint32_t flags);
+
+uint8_t *filter_block(uint32_t flags, uint8_t *in, uint32_t nbytes, uint8_t *out);
+
+void unfilter_block(uint32_t flags, uint8_t *in, uint32_t nbytes, uint8_t *out);
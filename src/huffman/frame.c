@@ -0,0 +1,278 @@
+#include "frame.h"
+#include "../utils/cpu.h"
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static void (*histogram_kernel)(uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET]);
+static void (*pack_kernel)(CodeBook *book, BitWriter *w, uint8_t *in, uint32_t nsymbols);
+
+// Finds the longest code in a code table.
+// Returns the length of the longest code in bits
+//
+// table: an array of codes for each possible character
+uint32_t max_code_length(Code table[static ALPHABET]) {
+    uint32_t longest = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        if (code_size(&table[symbol]) > longest) {
+            longest = code_size(&table[symbol]);
+        }
+    }
+    return longest;
+}
+
+// Lays out a code table for the packing kernels.
+//
+// book : the code book to fill
+// table: an array of codes for each possible character
+void codebook_init(CodeBook *book, Code table[static ALPHABET]) {
+    memset(book, 0, sizeof(CodeBook));
+    book->longest = max_code_length(table);
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        Code *c = &table[symbol];
+        book->lengths[symbol] = code_size(c);
+        for (uint32_t bit = 0; bit < code_size(c); bit++) {
+            if (code_get_bit(c, bit)) {
+                book->words[symbol][bit / 64] |= (uint64_t) 1 << (bit % 64);
+            }
+        }
+        if (code_size(c) <= 16) {
+            book->gather[symbol] = (uint32_t) book->words[symbol][0] | code_size(c) << 24;
+        }
+    }
+    return;
+}
+
+// Starts a bit writer at the beginning of a buffer.
+//
+// w  : the bit writer
+// out: the buffer to write into
+void writer_init(BitWriter *w, uint8_t *out) {
+    w->out = out;
+    w->bits = 0;
+    w->count = 0;
+    return;
+}
+
+// Writes out the pending bits, zero padding the final byte.
+// Returns the address just past the last written byte
+//
+// w: the bit writer
+uint8_t *writer_flush(BitWriter *w) {
+    uint32_t nbytes = (w->count + 7) / 8;
+    memcpy(w->out, &w->bits, nbytes);
+    w->out += nbytes;
+    w->bits = 0;
+    w->count = 0;
+    return w->out;
+}
+
+// Reference histogram kernel.
+static void histogram_scalar(uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET]) {
+    for (uint32_t i = 0; i < nbytes; i++) {
+        hist[in[i]] += 1;
+    }
+    return;
+}
+
+// Reference packing kernel: one append per code, or per 64 bits of a long code.
+static void pack_scalar(CodeBook *book, BitWriter *w, uint8_t *in, uint32_t nsymbols) {
+    for (uint32_t i = 0; i < nsymbols; i++) {
+        uint32_t length = book->lengths[in[i]];
+        for (uint32_t word = 0; length > 0; word++) {
+            uint32_t chunk = length < 64 ? length : 64;
+            put_bits(w, book->words[in[i]][word], chunk);
+            length -= chunk;
+        }
+    }
+    return;
+}
+
+#if defined(__x86_64__)
+// Histogram kernel for AVX2: 32-byte loads feeding four interleaved 32-bit sub-histograms, which
+// breaks the store-to-load dependency on runs of the same byte.
+__attribute__((target("avx2"))) static void histogram_avx2(
+    uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET]) {
+    uint32_t counts[4][ALPHABET] = { { 0 } }, i = 0;
+    for (; i + 32 <= nbytes; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) &in[i]);
+        uint64_t lanes[4] = { (uint64_t) _mm256_extract_epi64(bytes, 0),
+            (uint64_t) _mm256_extract_epi64(bytes, 1), (uint64_t) _mm256_extract_epi64(bytes, 2),
+            (uint64_t) _mm256_extract_epi64(bytes, 3) };
+        for (uint8_t shift = 0; shift < 64; shift += 8) {
+            counts[0][(lanes[0] >> shift) & 0xFF] += 1;
+            counts[1][(lanes[1] >> shift) & 0xFF] += 1;
+            counts[2][(lanes[2] >> shift) & 0xFF] += 1;
+            counts[3][(lanes[3] >> shift) & 0xFF] += 1;
+        }
+    }
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        hist[symbol] += (uint64_t) counts[0][symbol] + counts[1][symbol] + counts[2][symbol]
+                        + counts[3][symbol];
+    }
+    histogram_scalar(&in[i], nbytes - i, hist);
+    return;
+}
+
+// Histogram kernel for AVX-512: gathers 16 counters, adds each lane's number of equal lanes via
+// vpconflictd/vpopcntd, and scatters them back. Scatters store in lane order, so the lane holding
+// the total for a repeated byte is the one that lands.
+__attribute__((target("avx512f,avx512cd,avx512vpopcntdq"))) static void histogram_avx512(
+    uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET]) {
+    uint32_t counts[ALPHABET] = { 0 }, i = 0;
+    __m512i one = _mm512_set1_epi32(1);
+    for (; i + 16 <= nbytes; i += 16) {
+        __m512i index = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) &in[i]));
+        __m512i prior = _mm512_popcnt_epi32(_mm512_conflict_epi32(index));
+        __m512i total = _mm512_i32gather_epi32(index, (const void *) counts, 4);
+        total = _mm512_add_epi32(total, _mm512_add_epi32(prior, one));
+        _mm512_i32scatter_epi32((void *) counts, index, total, 4);
+    }
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        hist[symbol] += counts[symbol];
+    }
+    histogram_scalar(&in[i], nbytes - i, hist);
+    return;
+}
+
+// Packing kernel for AVX2: gathers 8 codes of at most 16 bits, joins neighbouring codes with
+// variable shifts, and appends the result as two words of at most 64 bits.
+__attribute__((target("avx2"))) static void pack_avx2(
+    CodeBook *book, BitWriter *w, uint8_t *in, uint32_t nsymbols) {
+    uint32_t i = 0;
+    if (book->longest <= 16) {
+        __m256i low = _mm256_set1_epi64x(0xFFFFFFFF), code_mask = _mm256_set1_epi32(0xFFFF);
+        uint64_t joined[4], lengths[4];
+        for (; i + 8 <= nsymbols; i += 8) {
+            __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &in[i]));
+            __m256i entry = _mm256_i32gather_epi32((const int *) book->gather, index, 4);
+            __m256i codes = _mm256_and_si256(entry, code_mask);
+            __m256i length = _mm256_srli_epi32(entry, 24);
+            // Even code | odd code << even length, in each 64-bit lane
+            __m256i even_length = _mm256_and_si256(length, low);
+            __m256i pair = _mm256_or_si256(_mm256_and_si256(codes, low),
+                _mm256_sllv_epi64(_mm256_srli_epi64(codes, 32), even_length));
+            __m256i pair_length = _mm256_add_epi64(even_length, _mm256_srli_epi64(length, 32));
+            _mm256_storeu_si256((__m256i *) joined, pair);
+            _mm256_storeu_si256((__m256i *) lengths, pair_length);
+            put_bits(w, joined[0] | joined[1] << lengths[0], lengths[0] + lengths[1]);
+            put_bits(w, joined[2] | joined[3] << lengths[2], lengths[2] + lengths[3]);
+        }
+    }
+    pack_scalar(book, w, &in[i], nsymbols - i);
+    return;
+}
+
+// Packing kernel for AVX-512: pack_avx2() over 16 codes at a time.
+__attribute__((target("avx512f"))) static void pack_avx512(
+    CodeBook *book, BitWriter *w, uint8_t *in, uint32_t nsymbols) {
+    uint32_t i = 0;
+    if (book->longest <= 16) {
+        __m512i low = _mm512_set1_epi64(0xFFFFFFFF), code_mask = _mm512_set1_epi32(0xFFFF);
+        uint64_t joined[8], lengths[8];
+        for (; i + 16 <= nsymbols; i += 16) {
+            __m512i index = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) &in[i]));
+            __m512i entry = _mm512_i32gather_epi32(index, (const void *) book->gather, 4);
+            __m512i codes = _mm512_and_si512(entry, code_mask);
+            __m512i length = _mm512_srli_epi32(entry, 24);
+            __m512i even_length = _mm512_and_si512(length, low);
+            __m512i pair = _mm512_or_si512(_mm512_and_si512(codes, low),
+                _mm512_sllv_epi64(_mm512_srli_epi64(codes, 32), even_length));
+            __m512i pair_length = _mm512_add_epi64(even_length, _mm512_srli_epi64(length, 32));
+            _mm512_storeu_si512((void *) joined, pair);
+            _mm512_storeu_si512((void *) lengths, pair_length);
+            for (uint8_t lane = 0; lane < 8; lane += 2) {
+                put_bits(w, joined[lane] | joined[lane + 1] << lengths[lane],
+                    lengths[lane] + lengths[lane + 1]);
+            }
+        }
+    }
+    pack_scalar(book, w, &in[i], nsymbols - i);
+    return;
+}
+#endif
+
+// Picks the histogram and packing kernels for the CPU.
+__attribute__((constructor)) static void frame_init(void) {
+    histogram_kernel = histogram_scalar;
+    pack_kernel = pack_scalar;
+#if defined(__x86_64__)
+    switch (cpu_level()) {
+    case CPU_AVX512:
+        histogram_kernel = histogram_avx512;
+        pack_kernel = pack_avx512;
+        break;
+    case CPU_AVX2:
+        histogram_kernel = histogram_avx2;
+        pack_kernel = pack_avx2;
+        break;
+    default: break;
+    }
+#endif
+    return;
+}
+
+// Adds the number of occurrences of every byte in a buffer to a histogram.
+//
+// in    : the bytes to count
+// nbytes: the number of bytes in in
+// hist  : the histogram to add to
+void count_symbols(uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET]) {
+    histogram_kernel(in, nbytes, hist);
+    return;
+}
+
+// Appends the codes for a run of symbols to a bit writer.
+//
+// book    : the code book
+// w       : the bit writer
+// in      : the symbols to code
+// nsymbols: the number of symbols in in
+void pack_codes(CodeBook *book, BitWriter *w, uint8_t *in, uint32_t nsymbols) {
+    pack_kernel(book, w, in, nsymbols);
+    return;
+}
+
+// Returns the most bytes pack_block() can write for a given number of symbols.
+//
+// book    : the code book
+// nsymbols: the number of symbols in the block
+uint64_t block_bound(CodeBook *book, uint32_t nsymbols) {
+    return ((uint64_t) nsymbols * book->longest + 7) / 8 + STREAMS * sizeof(uint64_t);
+}
+
+// Packs the codes for a block of symbols into a byte-aligned buffer. With streams, the block is
+// split into STREAMS equal runs of symbols (the last may be shorter), each packed into its own
+// byte-aligned bitstream, preceded by the byte sizes of all but the last bitstream.
+// Returns the number of bytes written to out
+//
+// book    : the code book
+// in      : the symbols to code
+// nsymbols: the number of symbols in in
+// out     : the buffer to pack into, which must hold block_bound() bytes
+// streams : whether to split the block into STREAMS bitstreams
+uint32_t pack_block(CodeBook *book, uint8_t *in, uint32_t nsymbols, uint8_t *out, bool streams) {
+    BitWriter w;
+    if (!streams) {
+        writer_init(&w, out);
+        pack_codes(book, &w, in, nsymbols);
+        return writer_flush(&w) - out;
+    }
+    uint32_t sizes[STREAMS - 1], quarter = (nsymbols + STREAMS - 1) / STREAMS;
+    uint8_t *start = out + sizeof(sizes);
+    for (uint8_t stream = 0; stream < STREAMS; stream++) {
+        uint32_t first = stream * quarter < nsymbols ? stream * quarter : nsymbols;
+        uint32_t count = nsymbols - first < quarter ? nsymbols - first : quarter;
+        writer_init(&w, start);
+        pack_codes(book, &w, &in[first], count);
+        if (stream < STREAMS - 1) {
+            sizes[stream] = writer_flush(&w) - start;
+            start += sizes[stream];
+        } else {
+            start = writer_flush(&w);
+        }
+    }
+    memcpy(out, sizes, sizeof(sizes));
+    return start - out;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "../utils/code.h"
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Codes laid out for the packing kernels: whole 64-bit words per code, plus a gatherable
+// (code | length << 24) entry for codes of at most 16 bits.
+typedef struct {
+    uint64_t words[ALPHABET][MAX_CODE_SIZE / 8];
+    uint32_t lengths[ALPHABET];
+    uint32_t gather[ALPHABET];
+    uint32_t longest;
+} CodeBook;
+
+// Accumulates codes 64 bits at a time into a byte buffer.
+typedef struct {
+    uint8_t *out;
+    uint64_t bits;
+    uint32_t count;
+} BitWriter;
+
+uint32_t max_code_length(Code table[static ALPHABET]);
+
+void count_symbols(uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET]);
+
+void codebook_init(CodeBook *book, Code table[static ALPHABET]);
+
+void writer_init(BitWriter *w, uint8_t *out);
+
+// Appends up to 64 bits, storing a whole word whenever one fills up.
+//
+// w     : the bit writer
+// bits  : the bits to append, with nothing set above length
+// length: the number of bits to append
+static inline void put_bits(BitWriter *w, uint64_t bits, uint32_t length) {
+    w->bits |= bits << w->count;
+    if (w->count + length >= 64) {
+        memcpy(w->out, &w->bits, sizeof(w->bits));
+        w->out += sizeof(w->bits);
+        w->bits = w->count ? bits >> (64 - w->count) : 0;
+        w->count = w->count + length - 64;
+    } else {
+        w->count += length;
+    }
+    return;
+}
+
+uint8_t *writer_flush(BitWriter *w);
+
+// Loads the next 64 bits of a buffer starting at a bit position, padding past the end with zeros.
+//
+// in    : the coded bytes
+// nbytes: the number of bytes in in
+// pos   : the bit position to start at
+static inline uint64_t peek_bits(uint8_t *in, uint64_t nbytes, uint64_t pos) {
+    uint64_t word = 0, byte = pos / 8;
+    if (byte + sizeof(word) <= nbytes) {
+        memcpy(&word, &in[byte], sizeof(word));
+    } else {
+        for (uint64_t i = 0; byte + i < nbytes; i++) {
+            word |= (uint64_t) in[byte + i] << (8 * i);
+        }
+    }
+    return word >> (pos % 8);
+}
+
+void pack_codes(CodeBook *book, BitWriter *w, uint8_t *in, uint32_t nsymbols);
+
+uint64_t block_bound(CodeBook *book, uint32_t nsymbols);
+
+uint32_t pack_block(CodeBook *book, uint8_t *in, uint32_t nsymbols, uint8_t *out, bool streams);
@@ -2,25 +2,23 @@
 #include "../utils/stack.h"
 #include "../io/io.h"
 #include "../utils/pq.h"
+#include <stddef.h>
 
-static uint16_t tree_size = 0;
-
-// Builds a Huffman tree based off a given histogram.
+// Builds a Huffman tree over an alphabet of any size.
 // Returns the root of the tree
 //
-// hist: histogram representing the characters in the input data
-Node *build_tree(uint64_t hist[static ALPHABET]) {
-    PriorityQueue *queue = pq_create(ALPHABET);
+// hist   : histogram representing the symbols in the input data
+// symbols: the number of symbols in the alphabet
+static Node *build(uint64_t *hist, uint32_t symbols) {
+    PriorityQueue *queue = pq_create(symbols);
     Node *node, *left, *right, *parent, *root;
     // Create a queue from a histogram
-    for (uint16_t key = 0; key < ALPHABET; key++) {
+    for (uint32_t key = 0; key < symbols; key++) {
         if (hist[key] > 0) {
-            tree_size += 1;
             node = node_create(key, hist[key]);
             enqueue(queue, node);
         }
     }
-    tree_size = (3 * tree_size) - 1;
     // Create Huffman tree
     while (pq_size(queue) > 1) {
         dequeue(queue, &left);
@@ -33,63 +31,129 @@ Node *build_tree(uint64_t hist[static ALPHABET]) {
     return root;
 }
 
-// Builds the codes for each symbol in the file.
+// Builds a Huffman tree based off a given histogram.
+// Returns the root of the tree
 //
+// hist: histogram representing the characters in the input data
+Node *build_tree(uint64_t hist[static ALPHABET]) {
+    return build(hist, ALPHABET);
+}
+
+// Builds a Huffman tree over 16-bit symbols.
+// Returns the root of the tree
+//
+// hist: histogram representing the 16-bit symbols in the input data
+Node *build_wide_tree(uint64_t hist[static WIDE_ALPHABET]) {
+    return build(hist, WIDE_ALPHABET);
+}
+
+// Walks the Huffman tree, recording the path to every leaf as its code.
+//
+// root : the current node of the huffman tree
 // table: an array of codes for each possible character
-// root : root of the huffman tree
-void build_codes(Node *root, Code table[static ALPHABET]) {
-    static Code code;
-    if (code_size(&code) == 0) {
-        code = code_init();
-    }
+// code : the path from the root to the current node
+static void walk_codes(Node *root, Code table[static ALPHABET], Code *code) {
     uint8_t popped;
     if (root) {
         // Leaf node
         if (!root->left && !root->right) {
-            table[root->symbol] = code;
+            table[root->symbol] = *code;
         // Interior node
         } else {
             // Going to the left
-            code_push_bit(&code, 0);
-            build_codes(root->left, table);
-            code_pop_bit(&code, &popped);
+            code_push_bit(code, 0);
+            walk_codes(root->left, table, code);
+            code_pop_bit(code, &popped);
             // Going to the right
-            code_push_bit(&code, 1);
-            build_codes(root->right, table);
-            code_pop_bit(&code, &popped);
+            code_push_bit(code, 1);
+            walk_codes(root->right, table, code);
+            code_pop_bit(code, &popped);
         }
     }
     return;
 }
 
-// Writes out the tree dump of the Huffman tree.
+// Builds the codes for each symbol in the file.
 //
-// outfile: the file to write the tree dump to
-// root   : the root of the huffman tree
-void dump_tree(int outfile, Node *root) {
-    static uint8_t dump[MAX_TREE_SIZE];
-    static uint64_t dump_pointer = 0;
-    uint8_t leaf = 'L', interior = 'I';
+// table: an array of codes for each possible character
+// root : root of the huffman tree
+void build_codes(Node *root, Code table[static ALPHABET]) {
+    Code code = code_init();
+    walk_codes(root, table, &code);
+    return;
+}
+
+// Walks the Huffman tree, recording the depth of every leaf as the length of its code.
+//
+// root   : the current node of the huffman tree
+// depth  : the depth of the current node
+// lengths: the code length of every symbol
+static void walk_lengths(Node *root, uint32_t depth, uint32_t *lengths) {
     if (root) {
-        dump_tree(outfile, root->left);
-        dump_tree(outfile, root->right);
         // Leaf node
         if (!root->left && !root->right) {
-            dump[dump_pointer++] = leaf;
-            dump[dump_pointer++] = root->symbol;
+            lengths[root->symbol] = depth;
         // Interior node
         } else {
-            dump[dump_pointer++] = interior;
+            walk_lengths(root->left, depth + 1, lengths);
+            walk_lengths(root->right, depth + 1, lengths);
         }
     }
-    if (dump_pointer == tree_size) {
-        // Read the entire tree dump
-        write_bytes(outfile, dump, tree_size);
-        tree_size = 0;
+    return;
+}
+
+// Finds the length of the code of every symbol in a tree, for alphabets too large to keep a Code
+// per symbol.
+//
+// root   : root of the huffman tree
+// lengths: the code length of every symbol, which is left as it is for symbols not in the tree
+void build_lengths(Node *root, uint32_t *lengths) {
+    walk_lengths(root, 0, lengths);
+    return;
+}
+
+// Appends the postorder dump of a subtree to a tree dump.
+//
+// root: the root of the subtree
+// dump: the tree dump
+// size: the number of bytes already in the dump
+static void flatten(Node *root, uint8_t *dump, uint16_t *size) {
+    if (root) {
+        flatten(root->left, dump, size);
+        flatten(root->right, dump, size);
+        // Leaf node
+        if (!root->left && !root->right) {
+            dump[(*size)++] = 'L';
+            dump[(*size)++] = root->symbol;
+        // Interior node
+        } else {
+            dump[(*size)++] = 'I';
+        }
     }
     return;
 }
 
+// Flattens the Huffman tree into its tree dump.
+// Returns the number of bytes in the dump
+//
+// root: the root of the huffman tree
+// dump: the array to store the tree dump into
+uint16_t flatten_tree(Node *root, uint8_t dump[static MAX_TREE_SIZE]) {
+    uint16_t size = 0;
+    flatten(root, dump, &size);
+    return size;
+}
+
+// Writes out the tree dump of the Huffman tree.
+//
+// outfile: the file to write the tree dump to
+// root   : the root of the huffman tree
+void dump_tree(int outfile, Node *root) {
+    uint8_t dump[MAX_TREE_SIZE];
+    write_bytes(outfile, dump, flatten_tree(root, dump));
+    return;
+}
+
 // Creates a Huffman tree given a tree dump.
 // Returns the root of the tree
 //
@@ -100,18 +164,30 @@ Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
     Node *node, *right, *left, *parent, *root;
     for (int i = 0; i < nbytes; i++) {
         // Leaf node
-        if (tree[i] == 'L') {
+        if (tree[i] == 'L' && i + 1 < nbytes) {
             node = node_create(tree[++i], 0);
             stack_push(stack, node);
         // Interior node
         } else if (tree[i] == 'I') {
-            stack_pop(stack, &right);
-            stack_pop(stack, &left);
+            if (!stack_pop(stack, &right)) {
+                break;
+            }
+            if (!stack_pop(stack, &left)) {
+                delete_tree(&right);
+                break;
+            }
             parent = node_join(left, right);
             stack_push(stack, parent);
         }
     }
-    stack_pop(stack, &root);
+    // A valid dump leaves exactly one node (the root) on the stack
+    root = NULL;
+    if (stack_size(stack) == 1) {
+        stack_pop(stack, &root);
+    }
+    while (stack_pop(stack, &node)) {
+        delete_tree(&node);
+    }
     stack_delete(&stack);
     return root;
 }
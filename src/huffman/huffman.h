@@ -7,8 +7,14 @@
 
 Node *build_tree(uint64_t hist[static ALPHABET]);
 
+Node *build_wide_tree(uint64_t hist[static WIDE_ALPHABET]);
+
 void build_codes(Node *root, Code table[static ALPHABET]);
 
+void build_lengths(Node *root, uint32_t *lengths);
+
+uint16_t flatten_tree(Node *root, uint8_t dump[static MAX_TREE_SIZE]);
+
 void dump_tree(int outfile, Node *root);
 
 Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]);
@@ -0,0 +1,376 @@
+#include "codec.h"
+#include "tans.h"
+#include "../io/io.h"
+#include "../header.h"
+#include "../defines.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPTIONS "hvlab:r:i:"
+
+static struct option long_options[] = {
+    { "lines", no_argument, NULL, 'l' },
+    { "all", no_argument, NULL, 'a' },
+    { "byte", required_argument, NULL, 'b' },
+    { "range", required_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 },
+};
+
+// The blocks asked about, and what their counts add up to.
+typedef struct {
+    uint64_t from; // Blocks are selected if they overlap the bytes from from up to (not including) to.
+    uint64_t to;
+    bool blocks; // Print a line for every selected block.
+    uint64_t counts[ALPHABET];
+    uint64_t selected;
+    uint64_t holes; // The number of holes selected, which are not counted as blocks.
+    uint64_t total;
+    uint64_t first; // The offset of the first byte of the first selected block.
+    uint64_t last; // The offset just past the last selected block.
+    uint64_t coded; // The compressed size of the selected blocks, block headers included.
+    uint64_t offset; // The offset of the next block in the decompressed stream.
+    uint64_t members;
+} Inspect;
+
+void help_message(void);
+bool parse_byte(const char *byte, uint8_t *value);
+bool parse_range(const char *range, uint64_t *from, uint64_t *to);
+bool inspect_member(Inspect *x, uint8_t *in, uint64_t nbytes, uint64_t *used);
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    bool lines = false, all = false, queried[ALPHABET] = { false };
+    uint32_t queries = 0;
+    int infile = STDIN_FILENO;
+    Inspect x = { 0 };
+    x.to = UINT64_MAX;
+    // Checks all flags
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
+        uint8_t value = 0;
+        switch (opt) {
+        case 'v': x.blocks = true; break;
+        case 'l': lines = true; break;
+        case 'a': all = true; break;
+        case 'b':
+            if (!parse_byte(optarg, &value)) {
+                fprintf(stderr, "Invalid byte value.\n");
+                help_message();
+                return 1;
+            }
+            queries += !queried[value];
+            queried[value] = true;
+            break;
+        case 'r':
+            if (!parse_range(optarg, &x.from, &x.to)) {
+                fprintf(stderr, "Invalid range.\n");
+                help_message();
+                return 1;
+            }
+            break;
+        case 'i':
+            if (infile != STDIN_FILENO) {
+                close(infile);
+            }
+            infile = open(optarg, O_RDONLY);
+            if (infile < 0) {
+                perror("Invalid file");
+                help_message();
+                return 1;
+            }
+            break;
+        default:
+            if (infile != STDIN_FILENO) {
+                close(infile);
+            }
+            help_message();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // Regular files are mapped whole, so only the pages holding block headers and counts are read
+    struct stat sb;
+    Buffer buffer = { NULL, 0, 0 };
+    uint8_t *in = NULL, *map = NULL;
+    uint64_t nbytes = 0;
+    if (fstat(infile, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, infile, 0);
+        map = map == MAP_FAILED ? NULL : map;
+        in = map;
+        nbytes = sb.st_size;
+    } else {
+        int curr_read = 0;
+        while (buffer_reserve(&buffer, buffer.size + io_size)
+               && (curr_read = read_bytes(infile, &buffer.data[buffer.size], io_size)) > 0) {
+            buffer.size += curr_read;
+        }
+        in = buffer.data;
+        nbytes = buffer.size;
+    }
+    bool valid = in != NULL && reads_ok();
+    if (in == NULL) {
+        fprintf(stderr, "Unable to read infile.\n");
+    }
+    // Adds up the counts of every member of the infile
+    uint64_t offset = 0, used = 0;
+    while (valid && (offset == 0 || offset < nbytes)) {
+        valid = inspect_member(&x, &in[offset], nbytes - offset, &used);
+        offset += used;
+    }
+
+    // Answers the queries asked, or sums up the selected blocks
+    if (valid && (queries || lines || all)) {
+        for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+            if (queried[symbol] || (all && x.counts[symbol] > 0)) {
+                printf("0x%02x: %" PRIu64 "\n", symbol, x.counts[symbol]);
+            }
+        }
+        if (lines) {
+            printf("Lines: %" PRIu64 "\n", x.counts['\n']);
+        }
+    } else if (valid) {
+        uint32_t distinct = 0;
+        for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+            distinct += x.counts[symbol] > 0;
+        }
+        printf("Members: %" PRIu64 "\n", x.members);
+        printf("Blocks: %" PRIu64 " of %" PRIu64 "\n", x.selected, x.total);
+        if (x.holes) {
+            printf("Holes: %" PRIu64 "\n", x.holes);
+        }
+        if (x.selected || x.holes) {
+            printf("Bytes: %" PRIu64 "-%" PRIu64 " (%" PRIu64 " bytes)\n", x.first, x.last - 1, x.last - x.first);
+        }
+        printf("Compressed size: %" PRIu64 " bytes\n", x.coded);
+        printf("Distinct byte values: %" PRIu32 "\n", distinct);
+        printf("Lines: %" PRIu64 "\n", x.counts['\n']);
+    }
+    if (map) {
+        munmap(map, nbytes);
+    }
+    buffer_free(&buffer);
+    if (infile != STDIN_FILENO) {
+        close(infile);
+    }
+    return valid ? 0 : 1;
+}
+
+//
+// Parses a byte value: a number (decimal, or hexadecimal after 0x) or a single character.
+// Returns whether the value is valid
+//
+// byte : the byte value to parse
+// value: set to the byte value
+//
+bool parse_byte(const char *byte, uint8_t *value) {
+    char *end;
+    uint64_t number = strtoull(byte, &end, 0);
+    if (*end == '\0' && end != byte && number < ALPHABET) {
+        *value = number;
+        return true;
+    }
+    if (byte[0] != '\0' && byte[1] == '\0') {
+        *value = byte[0];
+        return true;
+    }
+    return false;
+}
+
+//
+// Parses a range of the decompressed stream, given as offset:length.
+// Returns whether the range is valid and not empty
+//
+// range: the range to parse
+// from : set to the first offset in the range
+// to   : set to the offset just past the range
+//
+bool parse_range(const char *range, uint64_t *from, uint64_t *to) {
+    char *end;
+    uint64_t offset = strtoull(range, &end, 10), length;
+    if (end == range || *end != ':') {
+        return false;
+    }
+    range = end + 1;
+    length = strtoull(range, &end, 10);
+    if (end == range || *end != '\0' || length == 0) {
+        return false;
+    }
+    *from = offset;
+    *to = offset + length < offset ? UINT64_MAX : offset + length;
+    return true;
+}
+
+//
+// Adds up the counts of the blocks of one member that overlap the range, without decoding any of
+// them. Only framed members written with FLAG_COUNTS have counts.
+// Returns whether the member is valid and has counts
+//
+// x     : the inspection
+// in    : the member, followed by whatever comes after it
+// nbytes: the number of bytes in in
+// used  : set to the number of bytes of in the member took up
+//
+bool inspect_member(Inspect *x, uint8_t *in, uint64_t nbytes, uint64_t *used) {
+    Header header;
+    FrameHeader frame;
+    uint64_t offset = sizeof(header) + sizeof(frame), symbols = 0;
+    if (nbytes < sizeof(header)) {
+        fprintf(stderr, "Unable to read header.\n");
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (header.magic != MAGIC && header.magic != MAGIC_FRAMED) {
+        fprintf(stderr, "Invalid magic number.\n");
+        return false;
+    }
+    if (header.magic != MAGIC_FRAMED || nbytes < offset) {
+        fprintf(stderr, "Member %" PRIu64 " has no block counts; encode it with -k.\n", x->members);
+        return false;
+    }
+    memcpy(&frame, &in[sizeof(header)], sizeof(frame));
+    if (!(frame.flags & FLAG_COUNTS) || frame.block_size == 0 || frame.block_size > FRAME_BLOCK) {
+        fprintf(stderr, "Member %" PRIu64 " has no block counts; encode it with -k.\n", x->members);
+        return false;
+    }
+    // Skips the tree dump, or the code length table of 16-bit symbols, and the tANS counts
+    uint32_t lengths = 0;
+    uint16_t normalized[ALPHABET];
+    int32_t tans = 0;
+    if (header.tree_size > nbytes - offset) {
+        fprintf(stderr, "Invalid Huffman encoding.\n");
+        return false;
+    }
+    offset += header.tree_size;
+    if (frame.flags & FLAG_WIDE) {
+        if (nbytes - offset < sizeof(lengths)) {
+            fprintf(stderr, "Invalid code length table.\n");
+            return false;
+        }
+        memcpy(&lengths, &in[offset], sizeof(lengths));
+        offset += sizeof(lengths) + 3 * (uint64_t) lengths;
+    }
+    if (offset <= nbytes && (frame.flags & FLAG_TANS)
+        && (tans = tans_read_counts(&in[offset], nbytes - offset, normalized)) < 0) {
+        fprintf(stderr, "Invalid tANS counts.\n");
+        return false;
+    }
+    offset += tans;
+    // Live streams only record their size in their blocks
+    int64_t live = frame.flags & FLAG_SYNC && offset <= nbytes ? blocks_size(&in[offset], nbytes - offset, NULL) : 0;
+    if (live < 0) {
+        fprintf(stderr, "Truncated stream.\n");
+        return false;
+    }
+    header.file_size = frame.flags & FLAG_SYNC ? (uint64_t) live : header.file_size;
+
+    BlockHeader block;
+    uint32_t counts[ALPHABET];
+    while (true) {
+        if (offset > nbytes || nbytes - offset < sizeof(block)) {
+            fprintf(stderr, "Truncated stream.\n");
+            return false;
+        }
+        memcpy(&block, &in[offset], sizeof(block));
+        offset += sizeof(block);
+        // A hole only holds zero bytes, and is selected like a block
+        if (block.raw_size == 0 && block.coded_size != 0 && (frame.flags & FLAG_HOLES)) {
+            uint64_t hole = 0;
+            if (block.coded_size == sizeof(hole) && nbytes - offset >= sizeof(hole)) {
+                memcpy(&hole, &in[offset], sizeof(hole));
+            }
+            if (hole == 0 || hole > header.file_size - symbols) {
+                fprintf(stderr, "Corrupt or truncated hole after block %" PRIu64 ".\n", x->total);
+                return false;
+            }
+            if (x->offset < x->to && x->offset + hole > x->from) {
+                x->counts[0] += hole;
+                x->first = x->selected == 0 && x->holes == 0 ? x->offset : x->first;
+                x->last = x->offset + hole;
+                x->coded += sizeof(block) + sizeof(hole);
+                x->holes += 1;
+                if (x->blocks) {
+                    printf("Hole: bytes %" PRIu64 "-%" PRIu64 "\n", x->offset, x->offset + hole - 1);
+                }
+            }
+            offset += sizeof(hole);
+            symbols += hole;
+            x->offset += hole;
+            continue;
+        }
+        // The terminating block
+        if (block.raw_size == 0) {
+            if (symbols != header.file_size) {
+                fprintf(stderr, "Stream ended after %" PRIu64 " bytes.\n", symbols);
+                return false;
+            }
+            break;
+        }
+        if (block.raw_size > frame.block_size || block.raw_size > header.file_size - symbols
+            || block.coded_size > nbytes - offset) {
+            fprintf(stderr, "Corrupt or truncated block %" PRIu64 ".\n", x->total);
+            return false;
+        }
+        // Only the counts of blocks in the range are read
+        if (x->offset < x->to && x->offset + block.raw_size > x->from) {
+            int32_t size = counts_read(&in[offset], block.coded_size, block.raw_size, counts);
+            if (size < 0) {
+                fprintf(stderr, "Invalid counts in block %" PRIu64 ".\n", x->total);
+                return false;
+            }
+            uint32_t distinct = 0;
+            for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+                x->counts[symbol] += counts[symbol];
+                distinct += counts[symbol] > 0;
+            }
+            x->first = x->selected == 0 && x->holes == 0 ? x->offset : x->first;
+            x->last = x->offset + block.raw_size;
+            x->coded += sizeof(block) + block.coded_size;
+            x->selected += 1;
+            if (x->blocks) {
+                printf("Block %" PRIu64 ": bytes %" PRIu64 "-%" PRIu64 ", %" PRIu32 " -> %" PRIu32
+                       " bytes, %" PRIu32 " distinct values, %" PRIu32 " lines\n",
+                    x->total, x->offset, x->offset + block.raw_size - 1, block.raw_size, block.coded_size, distinct,
+                    counts['\n']);
+            }
+        }
+        offset += block.coded_size;
+        symbols += block.raw_size;
+        x->offset += block.raw_size;
+        x->total += 1;
+    }
+    x->members += 1;
+    *used = offset;
+    return true;
+}
+
+//
+// Prints out the help message that describes how to use the program
+//
+void help_message(void) {
+    printf("SYNOPSIS\n"
+           "  Answers counting queries about a Huffman coded file from the byte counts its blocks\n"
+           "  carry (encode -k), without decoding anything.\n\n"
+           "USAGE\n"
+           "  ./inspect [-hvla] [-b byte]... [-r offset:length] [-i infile]\n\n"
+           "OPTIONS\n"
+           "  -h             Program usage and help.\n"
+           "  -v             Print a line for every block.\n"
+           "  -l, --lines    Print the number of newlines.\n"
+           "  -a, --all      Print the count of every byte value that occurs.\n"
+           "  -b, --byte byte\n"
+           "                 Print the count of a byte value: a number (0x for hexadecimal) or a\n"
+           "                 single character. A count of 0 means the value does not occur.\n"
+           "  -r, --range offset:length\n"
+           "                 Only count the blocks that overlap length bytes from offset of the\n"
+           "                 decompressed file; the bytes they cover are printed without -l, -a or -b.\n"
+           "  -i infile      Input file to inspect.\n"
+           "  Without -l, -a or -b, prints the number of blocks, bytes, distinct byte values and lines.\n");
+    return;
+}
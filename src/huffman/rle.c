@@ -0,0 +1,124 @@
+#include "rle.h"
+#include "frame.h"
+#include "huffman.h"
+#include <string.h>
+
+// Returns the number of bits the Huffman codes of a histogram code it to, with the two padding
+// symbols encode adds, or UINT64_MAX if the tree could not be built
+//
+// hist: the histogram
+static uint64_t coded_bits(uint64_t hist[static ALPHABET]) {
+    uint64_t padded[ALPHABET], bits = 0;
+    memcpy(padded, hist, sizeof(padded));
+    padded[0] += 1;
+    padded[ALPHABET - 1] += 1;
+    Node *root = build_tree(padded);
+    if (!root) {
+        return UINT64_MAX;
+    }
+    Code table[ALPHABET] = { 0 };
+    build_codes(root, table);
+    delete_tree(&root);
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        bits += hist[symbol] * code_size(&table[symbol]);
+    }
+    return bits;
+}
+
+// Checks whether one symbol dominates a histogram enough for runs to be likely.
+// Returns whether the run-length pre-pass should be used
+//
+// hist: the histogram of the input
+bool rle_dominated(uint64_t hist[static ALPHABET]) {
+    uint64_t total = 0, most = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        total += hist[symbol];
+        most = hist[symbol] > most ? hist[symbol] : most;
+    }
+    return total > 0 && most >= total / RLE_DOMINANCE * (RLE_DOMINANCE - 1);
+}
+
+// Checks whether the run-length coded input codes smaller than the input itself. Short runs
+// shrink the input but spread its symbols out, which can cost more bits than the runs save.
+// Returns whether the run-length coded histogram takes fewer bits to code
+//
+// plain: the histogram of the input
+// runs : the histogram of the run-length coded input
+bool rle_smaller(uint64_t plain[static ALPHABET], uint64_t runs[static ALPHABET]) {
+    return coded_bits(runs) < coded_bits(plain);
+}
+
+// Run-length codes a block: after RLE_RUN identical bytes comes a byte holding how many more
+// of them follow (up to 255), so the output is still bytes and any coder can code it.
+// Returns the size of the run-length coded block, or 0 if it would not be at least an eighth
+// smaller than the block, in which case the block is coded as it is
+//
+// in    : the block
+// nbytes: the number of bytes in the block
+// out   : the buffer to write into, which must hold nbytes bytes
+uint32_t rle_encode(uint8_t *in, uint32_t nbytes, uint8_t *out) {
+    uint32_t size = 0, limit = nbytes - nbytes / 8;
+    for (uint32_t i = 0; i < nbytes;) {
+        uint32_t run = 1;
+        while (i + run < nbytes && run < RLE_LONGEST && in[i + run] == in[i]) {
+            run += 1;
+        }
+        uint32_t literal = run < RLE_RUN ? run : RLE_RUN;
+        if (size + literal + (run >= RLE_RUN) >= limit) {
+            return 0;
+        }
+        memset(&out[size], in[i], literal);
+        size += literal;
+        if (run >= RLE_RUN) {
+            out[size++] = run - RLE_RUN;
+        }
+        i += run;
+    }
+    return size;
+}
+
+// Adds a block to a histogram the way code_block() will code it: run-length coded if that makes
+// it smaller, as it is otherwise.
+//
+// in    : the block
+// nbytes: the number of bytes in the block
+// hist  : the histogram to add to
+// runs  : room for nbytes bytes
+void count_runs(uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET], uint8_t *runs) {
+    uint32_t size = rle_encode(in, nbytes, runs);
+    if (size > 0) {
+        count_symbols(runs, size, hist);
+    } else {
+        count_symbols(in, nbytes, hist);
+    }
+    return;
+}
+
+// Undoes rle_encode().
+// Returns whether the block expanded to exactly the expected number of bytes
+//
+// in      : the run-length coded block
+// nbytes  : the number of bytes in in
+// out     : the buffer to store the block into
+// nsymbols: the number of bytes the block expands to
+bool rle_decode(uint8_t *in, uint32_t nbytes, uint8_t *out, uint32_t nsymbols) {
+    uint32_t size = 0, run = 0;
+    for (uint32_t i = 0; i < nbytes; i++) {
+        if (size == nsymbols) {
+            return false;
+        }
+        run = size > 0 && out[size - 1] == in[i] ? run + 1 : 1;
+        out[size++] = in[i];
+        // A run length byte follows every RLE_RUN identical bytes
+        if (run == RLE_RUN) {
+            if (i + 1 == nbytes || in[i + 1] > nsymbols - size) {
+                return false;
+            }
+            memset(&out[size], in[i], in[i + 1]);
+            size += in[i + 1];
+            i += 1;
+            run = 0;
+        }
+    }
+    return size == nsymbols;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RLE_RUN       4 // Identical bytes after which a run length byte follows.
+#define RLE_LONGEST   (RLE_RUN + 255) // Longest run a single run length byte covers.
+#define RLE_DOMINANCE 4 // One symbol making up 3 in RLE_DOMINANCE bytes turns the pre-pass on.
+
+bool rle_dominated(uint64_t hist[static ALPHABET]);
+
+bool rle_smaller(uint64_t plain[static ALPHABET], uint64_t runs[static ALPHABET]);
+
+uint32_t rle_encode(uint8_t *in, uint32_t nbytes, uint8_t *out);
+
+void count_runs(uint8_t *in, uint32_t nbytes, uint64_t hist[static ALPHABET], uint8_t *runs);
+
+bool rle_decode(uint8_t *in, uint32_t nbytes, uint8_t *out, uint32_t nsymbols);
@@ -0,0 +1,814 @@
+#include "huffman.h"
+#include "frame.h"
+#include "table.h"
+#include "codec.h"
+#include "../io/io.h"
+#include "../header.h"
+#include "../utils/crc.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OPTIONS     "hvcC:i:"
+#define STATS       true
+#define MAX_PATTERN 256 // Longest pattern, so that a match spans at most two full blocks.
+#define MAX_CONTEXT 4096 // Most bytes of context printed on either side of a match.
+#define CONTEXT     64 // Bytes of context printed on either side of a match by default.
+
+static struct option long_options[] = {
+    { "count", no_argument, NULL, 'c' },
+    { "context", required_argument, NULL, 'C' },
+    { NULL, 0, NULL, 0 },
+};
+
+// The codes of a table, and the pattern coded with them.
+typedef struct {
+    Node *root; // The tree the table walks for codes longer than a probe.
+    DecodeTable *table;
+    uint8_t *bits; // The codes of the pattern bytes, one after another.
+    uint64_t nbytes; // The number of bytes in bits.
+    uint64_t *prefix; // The number of bits the codes of the first i pattern bytes take up, for i up to length.
+    uint8_t *shifts; // For coded patterns of at least 24 bits: the bits within a byte the pattern could start
+                     // at, indexed by the 16 bits after the byte. NULL for shorter ones.
+    int64_t first_missing; // The first pattern byte without a code, or length if every byte has one.
+    int64_t last_missing; // The last pattern byte without a code, or -1 if every byte has one.
+} Compiled;
+
+// A framed block, as far as the search is concerned.
+typedef struct {
+    uint8_t *coded; // The coded bytes, past the table switch.
+    uint32_t size;
+    uint32_t raw_size; // 0 for no block.
+    uint8_t *bits; // The Huffman codes of the block, or NULL if it is not coded with them alone.
+    uint64_t nbytes;
+    Compiled *codes;
+} Block;
+
+// What is being searched for, and the decoded bytes around the current block.
+typedef struct {
+    uint8_t *pattern;
+    uint32_t length;
+    uint32_t context;
+    bool count;
+    uint64_t matches;
+    uint64_t blocks;
+    uint64_t decoded;
+    uint64_t decoded_bytes;
+    uint64_t unscanned; // Blocks decoded in full, as their codes cannot be scanned for the pattern.
+    uint64_t total_bytes;
+    uint8_t *window; // The decoded bytes before the current block, followed by the block.
+    uint32_t kept; // The number of bytes before the current block in window, 0 if its last block was skipped.
+    uint64_t offset; // The offset of the current block in the decompressed stream.
+} Search;
+
+// The coders of the member being searched.
+typedef struct {
+    FrameHeader *frame;
+    TansDecoder *tans;
+    WideTable *wide;
+    uint8_t *scratch;
+} Member;
+
+void help_message(void);
+Compiled *compile(Search *s, uint16_t tree_size, uint8_t *tree);
+void release(Compiled **c);
+bool bits_equal(uint8_t *in, uint64_t nbytes, uint64_t pos, Compiled *c, uint64_t from, uint64_t count);
+bool scan_codes(Search *s, Block *b);
+bool prefix_at(Search *s, Block *skipped, uint32_t p);
+bool suffix_at(Search *s, Block *b, uint32_t p);
+bool straddles(Search *s, Block *skipped, Block *b);
+bool decode_window(Search *s, Member *m, Block *b);
+void keep_window(Search *s, uint32_t nbytes);
+void find_matches(Search *s, uint32_t nbytes);
+bool search_block(Search *s, Member *m, Block *skipped, Block *b);
+bool search_member(Search *s, uint8_t *in, uint64_t nbytes, uint64_t *used);
+bool search_blocks(Search *s, Member *m, Compiled *codes, uint8_t *in, uint64_t nbytes, uint64_t file_size,
+    uint64_t *used);
+bool search_stream(Search *s, DecodeTable *table, uint8_t *in, uint64_t nbytes, uint64_t file_size, uint64_t *used);
+
+int main(int argc, char **argv) {
+    int8_t opt = 0;
+    bool stats = false;
+    char *end;
+    int infile = STDIN_FILENO;
+    Search s = { 0 };
+    s.context = CONTEXT;
+    // Checks all flags
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'v': stats = STATS; break;
+        case 'c': s.count = true; break;
+        case 'C':
+            s.context = strtoul(optarg, &end, 10);
+            if (*end != '\0' || end == optarg || s.context > MAX_CONTEXT) {
+                fprintf(stderr, "Invalid context size.\n");
+                help_message();
+                return 2;
+            }
+            break;
+        case 'i':
+            if (infile != STDIN_FILENO) {
+                close(infile);
+            }
+            infile = open(optarg, O_RDONLY);
+            if (infile < 0) {
+                perror("Invalid file");
+                help_message();
+                return 2;
+            }
+            break;
+        default:
+            if (infile != STDIN_FILENO) {
+                close(infile);
+            }
+            help_message();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc - 1 || argv[optind][0] == '\0' || strlen(argv[optind]) > MAX_PATTERN) {
+        fprintf(stderr, "Expected one pattern of 1 to %d bytes.\n", MAX_PATTERN);
+        if (infile != STDIN_FILENO) {
+            close(infile);
+        }
+        help_message();
+        return 2;
+    }
+    s.pattern = (uint8_t *) argv[optind];
+    s.length = strlen(argv[optind]);
+
+    // Regular files are mapped whole; anything else is read into memory first
+    struct stat sb;
+    Buffer buffer = { NULL, 0, 0 };
+    uint8_t *in = NULL, *map = NULL;
+    uint64_t nbytes = 0;
+    if (fstat(infile, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, infile, 0);
+        map = map == MAP_FAILED ? NULL : map;
+        in = map;
+        nbytes = sb.st_size;
+    } else {
+        int curr_read = 0;
+        while (buffer_reserve(&buffer, buffer.size + io_size)
+               && (curr_read = read_bytes(infile, &buffer.data[buffer.size], io_size)) > 0) {
+            buffer.size += curr_read;
+        }
+        in = buffer.data;
+        nbytes = buffer.size;
+    }
+    s.window = (uint8_t *) malloc(MAX_PATTERN + MAX_CONTEXT + FRAME_BLOCK);
+    bool valid = in && s.window && reads_ok();
+    if (!in || !s.window) {
+        fprintf(stderr, "Unable to read infile.\n");
+    }
+    // Searches every member of the infile back to back
+    uint64_t offset = 0, used = 0;
+    while (valid && (offset == 0 || offset < nbytes)) {
+        valid = search_member(&s, &in[offset], nbytes - offset, &used);
+        offset += used;
+    }
+    if (valid && s.count) {
+        printf("%" PRIu64 "\n", s.matches);
+    }
+    if (valid && s.unscanned > 0) {
+        fprintf(stderr,
+            "Note: %" PRIu64 " of %" PRIu64 " blocks were decoded in full. Only blocks of plain Huffman codes in "
+            "streams written with 'encode -c' or '-k' can be skipped.\n",
+            s.unscanned, s.blocks);
+    }
+    // Prints stats
+    if (stats) {
+        fprintf(stderr, "Blocks decoded: %" PRIu64 " of %" PRIu64 "\n", s.decoded, s.blocks);
+        fprintf(stderr, "Bytes decoded: %" PRIu64 " of %" PRIu64 "\n", s.decoded_bytes, s.total_bytes);
+        fprintf(stderr, "Matches: %" PRIu64 "\n", s.matches);
+    }
+    if (map) {
+        munmap(map, nbytes);
+    }
+    buffer_free(&buffer);
+    free(s.window);
+    if (infile != STDIN_FILENO) {
+        close(infile);
+    }
+    return !valid ? 2 : s.matches ? 0 : 1;
+}
+
+//
+// Builds the decode table for a tree dump, and codes the pattern with its codes.
+// Returns the compiled codes, or NULL if the tree dump is invalid or they could not be allocated
+//
+// s        : the search
+// tree_size: the number of bytes in the tree dump
+// tree     : the tree dump
+//
+Compiled *compile(Search *s, uint16_t tree_size, uint8_t *tree) {
+    Node *root = rebuild_tree(tree_size, tree);
+    Compiled *c = (Compiled *) calloc(1, sizeof(Compiled));
+    if (!root || !c) {
+        delete_tree(&root);
+        free(c);
+        return NULL;
+    }
+    Code codes[ALPHABET] = { 0 };
+    build_codes(root, codes);
+    c->root = root;
+    c->table = table_create(root, codes);
+    c->nbytes = s->length * MAX_CODE_SIZE + sizeof(uint64_t);
+    c->bits = (uint8_t *) calloc(c->nbytes, 1);
+    c->prefix = (uint64_t *) calloc(s->length + 1, sizeof(uint64_t));
+    if (!c->table || !c->bits || !c->prefix) {
+        release(&c);
+        return NULL;
+    }
+    c->first_missing = s->length;
+    c->last_missing = -1;
+    for (uint32_t i = 0; i < s->length; i++) {
+        Code *code = &codes[s->pattern[i]];
+        uint64_t pos = c->prefix[i];
+        for (uint32_t bit = 0; bit < code_size(code); bit++, pos++) {
+            c->bits[pos / 8] |= code_get_bit(code, bit) << (pos % 8);
+        }
+        c->prefix[i + 1] = pos;
+        if (code_empty(code)) {
+            c->first_missing = i < c->first_missing ? i : c->first_missing;
+            c->last_missing = i;
+        }
+    }
+    // A pattern starting shift bits into a byte fills the next two bytes with its bits from 8 - shift on
+    if (c->prefix[s->length] >= 24) {
+        c->shifts = (uint8_t *) calloc(1 << 16, 1);
+        if (!c->shifts) {
+            release(&c);
+            return NULL;
+        }
+        uint64_t head = peek_bits(c->bits, c->nbytes, 0);
+        for (uint32_t shift = 0; shift < 8; shift++) {
+            c->shifts[(head >> (8 - shift)) & 0xFFFF] |= 1 << shift;
+        }
+    }
+    return c;
+}
+
+//
+// Frees compiled codes.
+//
+// c: the compiled codes to free
+//
+void release(Compiled **c) {
+    if (*c) {
+        table_delete(&(*c)->table);
+        delete_tree(&(*c)->root);
+        free((*c)->bits);
+        free((*c)->prefix);
+        free((*c)->shifts);
+        free(*c);
+        *c = NULL;
+    }
+    return;
+}
+
+//
+// Compares a run of bits of a block with a run of bits of the coded pattern.
+// Returns whether the bits are equal
+//
+// in    : the coded bytes of the block
+// nbytes: the number of bytes in in
+// pos   : the bit position in in to start at
+// c     : the compiled codes
+// from  : the bit position in the coded pattern to start at
+// count : the number of bits to compare
+//
+bool bits_equal(uint8_t *in, uint64_t nbytes, uint64_t pos, Compiled *c, uint64_t from, uint64_t count) {
+    while (count > 0) {
+        uint32_t n = count < 56 ? count : 56;
+        uint64_t mask = ((uint64_t) 1 << n) - 1;
+        if ((peek_bits(in, nbytes, pos) ^ peek_bits(c->bits, c->nbytes, from)) & mask) {
+            return false;
+        }
+        pos += n;
+        from += n;
+        count -= n;
+    }
+    return true;
+}
+
+//
+// Looks for the coded pattern at every bit position of a block. Codes do not resynchronize, so a
+// hit may start in the middle of a code, but every match in the block is a hit.
+// Returns whether the block has a hit
+//
+// s: the search
+// b: the block, whose codes have a code for every pattern byte
+//
+bool scan_codes(Search *s, Block *b) {
+    Compiled *c = b->codes;
+    uint64_t total = c->prefix[s->length], nbits = b->nbytes * 8;
+    if (total > nbits) {
+        return false;
+    }
+    // Long patterns: one probe of the two bytes after every byte names the shifts worth comparing
+    if (c->shifts) {
+        for (uint64_t byte = 0; byte * 8 + total <= nbits; byte++) {
+            uint16_t next;
+            memcpy(&next, &b->bits[byte + 1], sizeof(next));
+            uint8_t shifts = c->shifts[next];
+            for (uint32_t shift = 0; shifts && shift < 8; shift++) {
+                uint64_t pos = byte * 8 + shift;
+                if (((shifts >> shift) & 1) && pos + total <= nbits
+                    && bits_equal(b->bits, b->nbytes, pos, c, 0, total)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    // The first 56 bits of the pattern are compared at the 8 positions of every byte before the rest
+    uint32_t head = total < 56 ? total : 56;
+    uint64_t mask = ((uint64_t) 1 << head) - 1, first = peek_bits(c->bits, c->nbytes, 0) & mask;
+    for (uint64_t byte = 0; byte * 8 + total <= nbits; byte++) {
+        uint64_t word = peek_bits(b->bits, b->nbytes, byte * 8);
+        for (uint32_t shift = 0; shift < 8; shift++) {
+            uint64_t pos = byte * 8 + shift;
+            if (((word >> shift) & mask) == first && pos + total <= nbits
+                && bits_equal(b->bits, b->nbytes, pos + head, c, head, total - head)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//
+// Checks whether the first p pattern bytes could end a block: the kept bytes if the block was
+// decoded, or else the last codes of the skipped block, which end within the final byte.
+// Returns whether they could
+//
+// s      : the search
+// skipped: the skipped block, or NULL if the block before the current one was decoded
+// p      : the number of pattern bytes
+//
+bool prefix_at(Search *s, Block *skipped, uint32_t p) {
+    if (!skipped) {
+        return p <= s->kept && memcmp(&s->window[s->kept - p], s->pattern, p) == 0;
+    }
+    Compiled *c = skipped->codes;
+    if (skipped->raw_size < p) {
+        return true;
+    }
+    if (c->first_missing < p) {
+        return false;
+    }
+    uint64_t nbits = c->prefix[p];
+    for (uint32_t pad = 0; pad < 8 && pad <= skipped->nbytes * 8; pad++) {
+        uint64_t end = skipped->nbytes * 8 - pad;
+        bool zeros = (peek_bits(skipped->bits, skipped->nbytes, end) & ((1 << pad) - 1)) == 0;
+        if (zeros && end >= nbits && bits_equal(skipped->bits, skipped->nbytes, end - nbits, c, 0, nbits)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+// Checks whether the pattern bytes from p on could start a block. A block starts on a code, so a
+// block of Huffman codes could only if it starts with exactly their codes.
+// Returns whether they could
+//
+// s: the search
+// b: the block
+// p: the number of pattern bytes before the ones that start the block
+//
+bool suffix_at(Search *s, Block *b, uint32_t p) {
+    if (!b->bits || b->raw_size < s->length - p) {
+        return true;
+    }
+    Compiled *c = b->codes;
+    return c->last_missing < p
+           && bits_equal(b->bits, b->nbytes, 0, c, c->prefix[p], c->prefix[s->length] - c->prefix[p]);
+}
+
+//
+// Checks whether a match could start before a block and end in it.
+// Returns whether one could
+//
+// s      : the search
+// skipped: the block before b if it was skipped, or NULL if it was decoded
+// b      : the block
+//
+bool straddles(Search *s, Block *skipped, Block *b) {
+    if (!skipped && s->kept == 0) {
+        return false;
+    }
+    for (uint32_t p = 1; p < s->length; p++) {
+        if (prefix_at(s, skipped, p) && suffix_at(s, b, p)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//
+// Decodes a block to the end of the window.
+// Returns whether the block decoded
+//
+// s: the search
+// m: the coders of the member
+// b: the block
+//
+bool decode_window(Search *s, Member *m, Block *b) {
+    uint8_t *out = &s->window[s->kept];
+    bool decoded = m->wide ? wide_decode(m->wide, b->coded, b->size, out, b->raw_size)
+                           : decode_block(b->codes->table, m->tans, m->frame->flags, b->coded, b->size, out,
+                               b->raw_size, m->scratch);
+    if (!decoded) {
+        fprintf(stderr, "Invalid Huffman codes in block %" PRIu64 ".\n", s->blocks);
+    }
+    s->decoded += 1;
+    s->decoded_bytes += b->raw_size;
+    return decoded;
+}
+
+//
+// Drops all but the bytes at the end of the window that a match in the next block could start in,
+// and the context before them.
+//
+// s     : the search
+// nbytes: the number of bytes in the window
+//
+void keep_window(Search *s, uint32_t nbytes) {
+    uint32_t keep = s->length - 1 + s->context, kept = nbytes < keep ? nbytes : keep;
+    memmove(s->window, &s->window[nbytes - kept], kept);
+    s->kept = kept;
+    return;
+}
+
+//
+// Prints the matches that end in the bytes just decoded to the end of the window, then keeps the
+// bytes the next block's matches could start in (and their context).
+//
+// s     : the search
+// nbytes: the number of bytes just decoded
+//
+void find_matches(Search *s, uint32_t nbytes) {
+    uint32_t total = s->kept + nbytes;
+    uint32_t first = s->kept >= s->length ? s->kept - s->length + 1 : 0;
+    for (uint32_t i = first; i + s->length <= total; i++) {
+        uint8_t *found = memchr(&s->window[i], s->pattern[0], total - s->length + 1 - i);
+        if (!found) {
+            break;
+        }
+        i = found - s->window;
+        if (memcmp(found, s->pattern, s->length) != 0) {
+            continue;
+        }
+        s->matches += 1;
+        if (s->count) {
+            continue;
+        }
+        // Context stops at line breaks and at the edges of the window
+        uint32_t start = i, end = i + s->length;
+        while (start > 0 && i - start < s->context && s->window[start - 1] != '\n') {
+            start -= 1;
+        }
+        while (end < total && end - i - s->length < s->context && s->window[end] != '\n') {
+            end += 1;
+        }
+        printf("%" PRIu64 ":", s->offset - s->kept + i);
+        fwrite(&s->window[start], 1, end - start, stdout);
+        putchar('\n');
+    }
+    s->kept = 0;
+    keep_window(s, total);
+    s->offset += nbytes;
+    return;
+}
+
+//
+// Searches a block: it is decoded if its codes have a hit for the pattern, if a match could start
+// before it, or if it is not coded with Huffman codes alone. Otherwise it is skipped, and only
+// decoded later if a match could start in it and end in the next block.
+// Returns whether every block that had to be decoded decoded
+//
+// s      : the search
+// m      : the coders of the member
+// skipped: the block before b if it was skipped, or a block with a raw_size of 0; set to b if b is skipped
+// b      : the block
+//
+bool search_block(Search *s, Member *m, Block *skipped, Block *b) {
+    Compiled *c = b->codes;
+    bool hit = !b->bits || (c->first_missing == s->length && scan_codes(s, b));
+    bool straddle = s->length > 1 && straddles(s, skipped->raw_size ? skipped : NULL, b);
+    s->blocks += 1;
+    s->unscanned += !b->bits;
+    s->total_bytes += b->raw_size;
+    if (straddle && skipped->raw_size) {
+        // The skipped block goes before b in the window, with the offset kept at b
+        s->kept = 0;
+        if (!decode_window(s, m, skipped)) {
+            return false;
+        }
+        keep_window(s, skipped->raw_size);
+    }
+    skipped->raw_size = 0;
+    if (!hit && !straddle) {
+        *skipped = *b;
+        s->kept = 0;
+        s->offset += b->raw_size;
+        return true;
+    }
+    if (!decode_window(s, m, b)) {
+        return false;
+    }
+    find_matches(s, b->raw_size);
+    return true;
+}
+
+//
+// Searches one member of the infile.
+// Returns whether the member is valid
+//
+// s     : the search
+// in    : the member, followed by whatever comes after it
+// nbytes: the number of bytes in in
+// used  : set to the number of bytes of in the member took up
+//
+bool search_member(Search *s, uint8_t *in, uint64_t nbytes, uint64_t *used) {
+    Header header;
+    FrameHeader frame = { 0, 0 };
+    uint64_t offset = sizeof(header);
+    if (nbytes < sizeof(header)) {
+        fprintf(stderr, "Unable to read header.\n");
+        return false;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (header.magic != MAGIC && header.magic != MAGIC_FRAMED) {
+        fprintf(stderr, "Invalid magic number.\n");
+        return false;
+    }
+    if (header.magic == MAGIC_FRAMED) {
+        if (nbytes - offset < sizeof(frame)) {
+            fprintf(stderr, "Invalid frame header.\n");
+            return false;
+        }
+        memcpy(&frame, &in[offset], sizeof(frame));
+        offset += sizeof(frame);
+        if (frame.block_size == 0 || frame.block_size > FRAME_BLOCK || !filter_valid(frame.flags)
+            || !wide_valid(frame.flags)) {
+            fprintf(stderr, "Invalid frame header.\n");
+            return false;
+        }
+    }
+    // Streams of 16-bit symbols have a code length table instead of a tree dump
+    bool wide = frame.flags & FLAG_WIDE;
+    if ((header.tree_size == 0) != wide || header.tree_size > MAX_TREE_SIZE || header.tree_size > nbytes - offset) {
+        fprintf(stderr, "Invalid Huffman encoding.\n");
+        return false;
+    }
+    uint8_t *tree = &in[offset];
+    offset += header.tree_size;
+    Member m = { &frame, NULL, NULL, NULL };
+    if (wide) {
+        uint8_t *lengths = (uint8_t *) malloc(WIDE_ALPHABET);
+        int64_t size = lengths ? wide_read_lengths(&in[offset], nbytes - offset, lengths) : -1;
+        m.wide = size < 0 ? NULL : wide_table_create(lengths);
+        free(lengths);
+        if (!m.wide) {
+            fprintf(stderr, "Invalid code length table.\n");
+            return false;
+        }
+        offset += size;
+    }
+    uint16_t counts[ALPHABET];
+    if (frame.flags & FLAG_TANS) {
+        int32_t size = tans_read_counts(&in[offset], nbytes - offset, counts);
+        m.tans = size < 0 ? NULL : (TansDecoder *) malloc(sizeof(TansDecoder));
+        if (!m.tans) {
+            fprintf(stderr, size < 0 ? "Invalid tANS counts.\n" : "Unable to allocate tANS decoder.\n");
+            wide_table_delete(&m.wide);
+            return false;
+        }
+        tans_decoder_init(m.tans, counts);
+        offset += size;
+    }
+    m.scratch = frame.flags & (FLAG_RLE | FLAG_FILTER) ? (uint8_t *) malloc(2 * frame.block_size) : NULL;
+    // Live streams only record their size in their blocks
+    int64_t live = frame.flags & FLAG_SYNC ? blocks_size(&in[offset], nbytes - offset, NULL) : 0;
+    header.file_size = frame.flags & FLAG_SYNC ? (uint64_t) live : header.file_size;
+    Compiled *codes = wide ? NULL : compile(s, header.tree_size, tree);
+    bool valid = false;
+    uint64_t coded = 0;
+    if (!wide && !codes) {
+        fprintf(stderr, "Invalid Huffman encoding.\n");
+    } else if (live < 0) {
+        fprintf(stderr, "Truncated stream.\n");
+    } else if ((frame.flags & (FLAG_RLE | FLAG_FILTER)) && !m.scratch) {
+        fprintf(stderr, "Unable to allocate block buffer.\n");
+    } else if (header.magic == MAGIC_FRAMED) {
+        valid = search_blocks(s, &m, codes, &in[offset], nbytes - offset, header.file_size, &coded);
+        codes = NULL;
+    } else {
+        valid = search_stream(s, codes->table, &in[offset], nbytes - offset, header.file_size, &coded);
+    }
+    release(&codes);
+    wide_table_delete(&m.wide);
+    free(m.tans);
+    free(m.scratch);
+    *used = offset + coded;
+    return valid;
+}
+
+//
+// Searches the blocks of a framed member, switching codes where blocks do under FLAG_TABLES.
+// Block checksums are checked; the file checksum, which needs every byte decoded, is not.
+// Returns whether the blocks are valid
+//
+// s        : the search
+// m        : the coders of the member
+// codes    : the compiled codes of the member's tree dump, or NULL for 16-bit symbols; freed here
+// in       : the bytes following the tree dump (and tANS counts)
+// nbytes   : the number of bytes in in
+// file_size: the number of bytes the blocks decode to
+// used     : set to the number of bytes of in the blocks took up
+//
+bool search_blocks(Search *s, Member *m, Compiled *codes, uint8_t *in, uint64_t nbytes, uint64_t file_size,
+    uint64_t *used) {
+    BlockHeader header;
+    Block skipped = { 0 };
+    Compiled *current = codes, *previous = NULL;
+    uint64_t offset = 0, symbols = 0;
+    bool valid = true, ended = false;
+    while (valid && !ended) {
+        if (nbytes - offset < sizeof(header)) {
+            fprintf(stderr, "Truncated stream.\n");
+            valid = false;
+            break;
+        }
+        memcpy(&header, &in[offset], sizeof(header));
+        offset += sizeof(header);
+        // A hole only holds zero bytes, which patterns (taken from the command line) cannot contain, so it
+        // only separates the blocks around it
+        if (header.raw_size == 0 && header.coded_size != 0 && (m->frame->flags & FLAG_HOLES)) {
+            uint64_t hole = 0;
+            if (header.coded_size == sizeof(hole) && nbytes - offset >= sizeof(hole)) {
+                memcpy(&hole, &in[offset], sizeof(hole));
+            }
+            if (hole == 0 || hole > file_size - symbols
+                || ((m->frame->flags & FLAG_CHECKSUM) && crc32c(0, &in[offset], sizeof(hole)) != header.checksum)) {
+                fprintf(stderr, "Corrupt or truncated hole after block %" PRIu64 ".\n", s->blocks);
+                valid = false;
+                break;
+            }
+            offset += sizeof(hole);
+            symbols += hole;
+            skipped.raw_size = 0;
+            release(&previous);
+            s->kept = 0;
+            s->offset += hole;
+            s->total_bytes += hole;
+            continue;
+        }
+        if (header.raw_size == 0) {
+            ended = true;
+            valid = symbols == file_size;
+            if (!valid) {
+                fprintf(stderr, "Stream ended early.\n");
+            }
+            break;
+        }
+        uint8_t *coded = &in[offset];
+        if (header.raw_size > m->frame->block_size || header.raw_size > file_size - symbols
+            || header.coded_size > nbytes - offset
+            || ((m->frame->flags & FLAG_CHECKSUM) && crc32c(0, coded, header.coded_size) != header.checksum)) {
+            fprintf(stderr, "Corrupt or truncated block %" PRIu64 ".\n", s->blocks);
+            valid = false;
+            break;
+        }
+        offset += header.coded_size;
+        symbols += header.raw_size;
+        int32_t counted
+            = m->frame->flags & FLAG_COUNTS ? counts_read(coded, header.coded_size, header.raw_size, NULL) : 0;
+        if (counted < 0) {
+            fprintf(stderr, "Invalid counts in block %" PRIu64 ".\n", s->blocks);
+            valid = false;
+            break;
+        }
+        coded += counted;
+        uint32_t size = header.coded_size - counted;
+        // A new table replaces the current one, which the skipped block may still need
+        uint16_t tree_size = 0;
+        uint32_t switched = 0;
+        if (m->frame->flags & FLAG_TABLES) {
+            switched = sizeof(tree_size);
+            if (size >= sizeof(tree_size)) {
+                memcpy(&tree_size, coded, sizeof(tree_size));
+                switched += tree_size;
+            }
+            Compiled *next = tree_size && tree_size <= MAX_TREE_SIZE && switched <= size
+                                 ? compile(s, tree_size, &coded[sizeof(tree_size)])
+                                 : NULL;
+            if (switched > size || (tree_size && !next)) {
+                fprintf(stderr, "Invalid Huffman tree in block %" PRIu64 ".\n", s->blocks);
+                valid = false;
+                break;
+            }
+            if (next) {
+                release(&previous);
+                previous = current;
+                current = next;
+            }
+        }
+        Block b = { &coded[switched], size - switched, header.raw_size, NULL, 0, current };
+        // Only blocks of Huffman codes in a single bitstream of the original bytes can be scanned
+        uint32_t flags = m->frame->flags, prefix = (flags & FLAG_RLE ? sizeof(uint32_t) : 0) + !!(flags & FLAG_TANS);
+        if (!m->wide && !(flags & (FLAG_STREAMS | FLAG_FILTER)) && b.size >= prefix) {
+            uint32_t runs = 0;
+            if (flags & FLAG_RLE) {
+                memcpy(&runs, b.coded, sizeof(runs));
+            }
+            if (runs == 0 && (!(flags & FLAG_TANS) || b.coded[prefix - 1] == CODER_HUFFMAN)) {
+                b.bits = &b.coded[prefix];
+                b.nbytes = b.size - prefix;
+            }
+        }
+        valid = search_block(s, m, &skipped, &b);
+        if (!skipped.raw_size || skipped.codes != previous) {
+            release(&previous);
+        }
+    }
+    // The member's last block is decoded if the pattern could go on in the next member
+    if (valid && skipped.raw_size && s->length > 1) {
+        bool prefix = false;
+        for (uint32_t p = 1; p < s->length && !prefix; p++) {
+            prefix = prefix_at(s, &skipped, p);
+        }
+        if (prefix && (valid = decode_window(s, m, &skipped))) {
+            keep_window(s, skipped.raw_size);
+        }
+    }
+    release(&current);
+    release(&previous);
+    *used = offset;
+    return valid;
+}
+
+//
+// Searches a member in the original format, which has no block boundaries to resynchronize at:
+// the whole stream is decoded, a block's worth at a time.
+// Returns whether the stream is valid
+//
+// s        : the search
+// table    : the decode table of the member
+// in       : the bytes following the tree dump
+// nbytes   : the number of bytes in in
+// file_size: the number of bytes the stream decodes to
+// used     : set to the number of bytes of in the stream took up
+//
+bool search_stream(Search *s, DecodeTable *table, uint8_t *in, uint64_t nbytes, uint64_t file_size, uint64_t *used) {
+    uint64_t pos = 0, symbols = 0;
+    while (symbols < file_size) {
+        uint64_t count = file_size - symbols < FRAME_BLOCK ? file_size - symbols : FRAME_BLOCK;
+        if (table_decode(table, in, nbytes, &pos, nbytes * 8, &s->window[s->kept], count) != (int64_t) count) {
+            fprintf(stderr, "Corrupt or truncated Huffman stream.\n");
+            return false;
+        }
+        s->blocks += 1;
+        s->unscanned += 1;
+        s->decoded += 1;
+        s->decoded_bytes += count;
+        s->total_bytes += count;
+        find_matches(s, count);
+        symbols += count;
+    }
+    *used = (pos + 7) / 8;
+    return true;
+}
+
+//
+// Prints out the help message that describes how to use the program
+//
+void help_message(void) {
+    printf("SYNOPSIS\n"
+           "  Searches a Huffman coded file for a byte string without decompressing all of it.\n"
+           "  Prints the offset of every match in the decompressed file and the bytes around it.\n\n"
+           "USAGE\n"
+           "  ./search [-hvc] [-C bytes] [-i infile] pattern\n\n"
+           "OPTIONS\n"
+           "  -h             Program usage and help.\n"
+           "  -v             Print how many blocks and bytes had to be decoded.\n"
+           "  -c, --count    Only print the number of matches.\n"
+           "  -C, --context bytes\n"
+           "                 Bytes of context on either side of a match, up to a line break\n"
+           "                 (default: 64, max: 4096).\n"
+           "  -i infile      Input file to search.\n"
+           "  pattern        Byte string to search for, up to 256 bytes. Blocks without a match are\n"
+           "                 only skipped in streams written with 'encode -c' or '-k'.\n\n"
+           "EXIT STATUS\n"
+           "  0 if the pattern was found, 1 if it was not, 2 if the infile is invalid.\n");
+    return;
+}
@@ -0,0 +1,273 @@
+#include "speculate.h"
+#include "codec.h"
+#include "../utils/pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SPAN_BYTES    (1 << 18) // Coded bytes a range spans.
+#define MIN_SPAN      (1 << 13) // Fewest coded bytes worth giving a range of their own.
+#define MAX_WINDOW    (1 << 23) // Most coded bytes decoded at once, unless every range is down to MIN_SPAN.
+#define SYNC_SYMBOLS  4096 // Symbols a range decodes one at a time to lock on to the codes.
+#define SLICE_SYMBOLS (1 << 16) // Symbols decoded between two marks once a range has locked on.
+
+// A symbol a range decoded, and the bit its code starts at.
+typedef struct {
+    uint64_t count;
+    uint64_t pos;
+} Mark;
+
+// One range of the window, decoded on a thread of its own. Every range but the first starts at a
+// guessed bit, which may fall in the middle of a code.
+typedef struct {
+    Speculator *s;
+    uint64_t start;
+    uint64_t limit; // No code is started at or after this bit.
+    uint64_t nsymbols; // The most symbols to decode.
+    bool guessed;
+    Buffer out;
+    Mark *marks;
+    uint32_t nmarks;
+    uint32_t capacity;
+    uint32_t locked; // marks[0..locked] mark every symbol decoded one at a time.
+    uint64_t end; // The bit after the last code decoded.
+    bool complete; // Whether decoding reached limit, rather than nsymbols or an invalid code.
+} Range;
+
+struct Speculator {
+    Pool *pool;
+    uint32_t nranges;
+    uint64_t span;
+    Range *ranges;
+    DecodeTable *table;
+    uint8_t *in;
+    uint64_t nbytes;
+};
+
+// Initializes a speculator, which decodes a window of a bitstream as ranges on a pool of threads.
+// Returns the speculator, or NULL if it could not be allocated or its threads started
+//
+// threads: the number of threads, and of ranges per window
+Speculator *speculator_create(uint32_t threads) {
+    Speculator *s = (Speculator *) calloc(1, sizeof(Speculator));
+    if (!s || !(s->pool = pool_create(threads))
+        || !(s->ranges = (Range *) calloc(pool_threads(s->pool), sizeof(Range)))) {
+        speculator_delete(&s);
+        return NULL;
+    }
+    s->nranges = pool_threads(s->pool);
+    s->span = MAX_WINDOW / s->nranges < SPAN_BYTES ? MAX_WINDOW / s->nranges : SPAN_BYTES;
+    s->span = s->span < MIN_SPAN ? MIN_SPAN : s->span;
+    for (uint32_t k = 0; k < s->nranges; k++) {
+        s->ranges[k].s = s;
+    }
+    return s;
+}
+
+// Stops the threads of a speculator and frees it.
+//
+// s: the speculator to free
+void speculator_delete(Speculator **s) {
+    if (*s) {
+        pool_delete(&(*s)->pool);
+        for (uint32_t k = 0; (*s)->ranges && k < (*s)->nranges; k++) {
+            buffer_free(&(*s)->ranges[k].out);
+            free((*s)->ranges[k].marks);
+        }
+        free((*s)->ranges);
+        free(*s);
+        *s = NULL;
+    }
+    return;
+}
+
+// Returns the number of coded bytes worth decoding at once, which keeps every thread busy.
+//
+// s: the speculator
+uint64_t speculate_window(Speculator *s) {
+    return s->nranges * s->span;
+}
+
+// Marks the bit the code of the next symbol of a range starts at.
+// Returns whether the mark could be stored
+//
+// r  : the range
+// pos: the bit the next code starts at
+static bool add_mark(Range *r, uint64_t pos) {
+    if (r->nmarks == r->capacity) {
+        uint32_t grown = r->capacity ? 2 * r->capacity : 2 * SYNC_SYMBOLS;
+        Mark *marks = (Mark *) realloc(r->marks, grown * sizeof(Mark));
+        if (!marks) {
+            return false;
+        }
+        r->marks = marks;
+        r->capacity = grown;
+    }
+    r->marks[r->nmarks++] = (Mark) { r->out.size, pos };
+    return true;
+}
+
+// Decodes a range into its own buffer. From a guessed bit, the first symbols are decoded one at a time
+// so that every code start is marked: a misaligned start soon lands on a code boundary of the real
+// stream (Huffman codes resynchronize), after which it decodes exactly what the real stream does, and
+// decoding on from the end of the range before it meets one of these marks.
+//
+// arg   : the range
+// worker: the index of the worker running the job
+static void decode_range(void *arg, uint32_t worker) {
+    Range *r = (Range *) arg;
+    DecodeTable *t = r->s->table;
+    uint64_t at = r->start;
+    (void) worker;
+    r->out.size = 0;
+    r->nmarks = r->locked = 0;
+    r->end = at;
+    r->complete = false;
+    if (!add_mark(r, at)) {
+        return;
+    }
+    while (r->guessed && r->locked < SYNC_SYMBOLS && r->out.size < r->nsymbols && at < r->limit) {
+        if (!buffer_reserve(&r->out, r->out.size + 1)
+            || table_decode(t, r->s->in, r->s->nbytes, &at, r->limit, &r->out.data[r->out.size], 1) != 1) {
+            return;
+        }
+        r->out.size += 1;
+        if (!add_mark(r, at)) {
+            return;
+        }
+        r->locked += 1;
+    }
+    // Then whole table probes, marking every slice to find the end of any symbol again later
+    while (r->out.size < r->nsymbols && at < r->limit) {
+        uint64_t wanted = r->nsymbols - r->out.size < SLICE_SYMBOLS ? r->nsymbols - r->out.size : SLICE_SYMBOLS;
+        if (!buffer_reserve(&r->out, r->out.size + wanted)) {
+            return;
+        }
+        int64_t decoded = table_decode(t, r->s->in, r->s->nbytes, &at, r->limit, &r->out.data[r->out.size], wanted);
+        if (decoded < 0) {
+            return;
+        }
+        r->out.size += decoded;
+        if (!add_mark(r, at)) {
+            return;
+        }
+    }
+    r->end = at;
+    r->complete = at >= r->limit;
+    return;
+}
+
+// Finds the symbol of a range whose code starts at a given bit, among the symbols it decoded one at a time.
+// Returns whether the range locked on to that bit
+//
+// r     : the range
+// pos   : the bit
+// symbol: set to the index of the symbol
+static bool find_lock(Range *r, uint64_t pos, uint64_t *symbol) {
+    if (r->nmarks == 0) {
+        return false;
+    }
+    uint32_t low = 0, high = r->locked;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (r->marks[middle].pos < pos) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    *symbol = r->marks[low].count;
+    return r->marks[low].pos == pos;
+}
+
+// Finds the bit after the code of a symbol of a range by decoding again from the last mark before it.
+// Returns the bit
+//
+// r     : the range
+// symbol: the number of symbols of the range to end after
+static uint64_t symbol_end(Range *r, uint64_t symbol) {
+    uint32_t low = 0, high = r->nmarks - 1;
+    while (low < high) {
+        uint32_t middle = (low + high + 1) / 2;
+        if (r->marks[middle].count <= symbol) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    Mark *m = &r->marks[low];
+    uint64_t at = m->pos;
+    table_decode(r->s->table, r->s->in, r->s->nbytes, &at, r->limit, &r->out.data[m->count], symbol - m->count);
+    return at;
+}
+
+// Decodes a window of a bitstream like table_decode(), as one range per thread. Every range after the first
+// is only kept from the first of its codes that the real stream also starts a code at, so the output is
+// exactly what a serial decode gives; a range that never locked on is decoded again. Windows too small to
+// split are decoded serially.
+// Returns the number of symbols decoded, or -1 if a code is invalid
+//
+// s       : the speculator
+// t       : the decode table
+// in      : the coded bytes
+// nbytes  : the number of bytes in in
+// pos     : the bit to start decoding at, set to the bit after the last code decoded
+// limit   : the bit no code may start at or after
+// out     : the buffer to store the decoded symbols into
+// nsymbols: the most symbols to decode
+int64_t speculate_decode(Speculator *s, DecodeTable *t, uint8_t *in, uint64_t nbytes, uint64_t *pos, uint64_t limit,
+    uint8_t *out, uint64_t nsymbols) {
+    uint64_t span = limit > *pos ? (limit - *pos) / s->nranges : 0;
+    if (span < 8 * MIN_SPAN) {
+        return table_decode(t, in, nbytes, pos, limit, out, nsymbols);
+    }
+    s->table = t;
+    s->in = in;
+    s->nbytes = nbytes;
+    for (uint32_t k = 0; k < s->nranges; k++) {
+        Range *r = &s->ranges[k];
+        r->start = *pos + k * span;
+        r->limit = k + 1 < s->nranges ? r->start + span : limit;
+        r->nsymbols = nsymbols;
+        r->guessed = k > 0;
+        if (!pool_submit(s->pool, decode_range, r)) {
+            decode_range(r, 0);
+        }
+    }
+    pool_wait(s->pool);
+
+    uint64_t decoded = 0, at = *pos;
+    for (uint32_t k = 0; k < s->nranges && decoded < nsymbols; k++) {
+        Range *r = &s->ranges[k];
+        // The range before ends on a code of the real stream, which this range only reaches once it has locked
+        // on: decode serially from there until the two meet
+        uint64_t first = 0;
+        bool found = find_lock(r, at, &first);
+        while (!found && decoded < nsymbols && r->nmarks > 0 && at < r->marks[r->locked].pos) {
+            if (table_decode(t, in, nbytes, &at, limit, &out[decoded], 1) != 1) {
+                return -1;
+            }
+            decoded += 1;
+            found = find_lock(r, at, &first);
+        }
+        if (decoded == nsymbols) {
+            break;
+        }
+        uint64_t needed = nsymbols - decoded;
+        if (!found || (!r->complete && r->out.size - first < needed)) {
+            r->start = at;
+            r->nsymbols = needed;
+            r->guessed = false;
+            decode_range(r, 0);
+            first = 0;
+            if (!r->complete && r->out.size < needed) {
+                return -1;
+            }
+        }
+        uint64_t kept = r->out.size - first < needed ? r->out.size - first : needed;
+        memcpy(&out[decoded], &r->out.data[first], kept);
+        decoded += kept;
+        at = r->complete && first + kept == r->out.size ? r->end : symbol_end(r, first + kept);
+    }
+    *pos = at;
+    return decoded;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "table.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Speculator Speculator;
+
+Speculator *speculator_create(uint32_t threads);
+
+void speculator_delete(Speculator **s);
+
+uint64_t speculate_window(Speculator *s);
+
+int64_t speculate_decode(Speculator *s, DecodeTable *t, uint8_t *in, uint64_t nbytes, uint64_t *pos, uint64_t limit,
+    uint8_t *out, uint64_t nsymbols);
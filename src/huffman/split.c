@@ -0,0 +1,138 @@
+#include "split.h"
+#include "filter.h"
+#include "huffman.h"
+#include "../header.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double xlogx[FRAME_BLOCK + 1]; // x * log2(x) for every count a block can hold.
+static bool xlogx_ready = false;
+
+// Parses the effort adaptive block splitting spends on an infile.
+// Returns the effort, or 0 if it is not a number from 1 to SPLIT_EFFORT
+//
+// effort: the effort to parse
+uint32_t split_effort(const char *effort) {
+    char *end;
+    uint64_t value = strtoull(effort, &end, 10);
+    return *end == '\0' && end != effort && value > 0 && value <= SPLIT_EFFORT ? value : 0;
+}
+
+// Returns the size of the segments block boundaries are placed between: a whole block at effort 1,
+// down to FRAME_BLOCK / 64 at SPLIT_EFFORT. Every step takes about four times the CPU of the one before.
+//
+// effort: the split effort, from 1 to SPLIT_EFFORT
+uint32_t split_segment(uint32_t effort) {
+    return FRAME_BLOCK >> 2 * (effort - 1);
+}
+
+// Splits a chunk of an infile into blocks of at most FRAME_BLOCK bytes, placing the boundaries where
+// the statistics of the (filtered) bytes change. A block is charged the order-0 entropy of its own
+// histogram plus its block header and a tree dump for its own table, and the split with the smallest
+// total is found over all boundaries on segment edges, looking back at most one block.
+// Returns the number of blocks, or 0 if the segment buffers could not be allocated
+//
+// in    : the chunk
+// nbytes: the number of bytes in the chunk, at least 1
+// flags : the frame flags, whose filter segments are counted through
+// effort: the split effort, from 1 to SPLIT_EFFORT
+// sizes : set to the size of every block, which must hold one size per segment
+uint32_t split_chunk(uint8_t *in, uint32_t nbytes, uint32_t flags, uint32_t effort, uint32_t *sizes) {
+    uint32_t segment = split_segment(effort), longest = FRAME_BLOCK / segment;
+    uint32_t segments = (nbytes + segment - 1) / segment, blocks = 0;
+    double *cost = (double *) malloc((segments + 1) * sizeof(double));
+    uint32_t *start = (uint32_t *) malloc((segments + 1) * sizeof(uint32_t));
+    uint32_t (*window)[ALPHABET] = malloc(longest * sizeof(*window));
+    uint8_t *filtered = (uint8_t *) malloc(segment);
+    if (!cost || !start || !window || !filtered) {
+        free(cost);
+        free(start);
+        free(window);
+        free(filtered);
+        return 0;
+    }
+    if (!xlogx_ready) {
+        for (uint32_t x = 1; x <= FRAME_BLOCK; x++) {
+            xlogx[x] = x * log2(x);
+        }
+        xlogx_ready = true;
+    }
+    cost[0] = 0;
+    for (uint32_t end = 1; end <= segments; end++) {
+        // The histograms of the last longest segments are kept in a ring
+        uint32_t first = (end - 1) * segment, size = nbytes - first < segment ? nbytes - first : segment;
+        uint64_t counted[ALPHABET] = { 0 };
+        count_symbols(filter_block(flags, &in[first], size, filtered), size, counted);
+        for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+            window[(end - 1) % longest][symbol] = counted[symbol];
+        }
+        // Grow the last block back a segment at a time, keeping sum(h log2 h) of its histogram current
+        uint32_t hist[ALPHABET] = { 0 }, symbols = 0, unique = 2;
+        double sum = 0;
+        cost[end] = INFINITY;
+        for (uint32_t begin = end; begin-- > 0 && end - begin <= longest;) {
+            uint32_t *counts = window[begin % longest];
+            for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+                if (counts[symbol] > 0) {
+                    sum += xlogx[hist[symbol] + counts[symbol]] - xlogx[hist[symbol]];
+                    unique += hist[symbol] == 0;
+                    hist[symbol] += counts[symbol];
+                }
+            }
+            symbols += begin == end - 1 ? size : segment;
+            double bits = xlogx[symbols] - sum + 8.0 * (sizeof(BlockHeader) + sizeof(uint16_t) + 3 * unique - 1);
+            if (cost[begin] + bits < cost[end]) {
+                cost[end] = cost[begin] + bits;
+                start[end] = begin;
+            }
+        }
+    }
+    // Walk the best split back from the end of the chunk
+    for (uint32_t end = segments; end > 0; end = start[end]) {
+        blocks += 1;
+    }
+    uint32_t block = blocks;
+    for (uint32_t end = segments; end > 0; end = start[end]) {
+        uint32_t last = end * segment < nbytes ? end * segment : nbytes;
+        sizes[--block] = last - start[end] * segment;
+    }
+    free(cost);
+    free(start);
+    free(window);
+    free(filtered);
+    return blocks;
+}
+
+// Decides whether a block is coded with the current table or with a new table built from its own
+// histogram, which costs the block a tree dump. The current table is only kept if it has a code for
+// every symbol in the block.
+// Returns whether the new table could be built
+//
+// current : the table the previous block was coded with
+// hist    : the histogram of the symbols the block codes
+// next    : set to the new table
+// switched: set to whether the new table codes the block smaller, tree dump included
+bool choose_table(BlockTable *current, uint64_t hist[static ALPHABET], BlockTable *next, bool *switched) {
+    uint64_t padded[ALPHABET], kept = 0, built = 0;
+    bool covered = true;
+    memcpy(padded, hist, sizeof(padded));
+    padded[0] += 1;
+    padded[ALPHABET - 1] += 1;
+    Node *root = build_tree(padded);
+    if (!root) {
+        return false;
+    }
+    Code table[ALPHABET] = { 0 };
+    build_codes(root, table);
+    codebook_init(&next->book, table);
+    next->tree_size = flatten_tree(root, next->tree);
+    delete_tree(&root);
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        covered = covered && (hist[symbol] == 0 || current->book.lengths[symbol] > 0);
+        kept += hist[symbol] * current->book.lengths[symbol];
+        built += hist[symbol] * next->book.lengths[symbol];
+    }
+    *switched = !covered || built + 8 * (uint64_t) next->tree_size < kept;
+    return true;
+}
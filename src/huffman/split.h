@@ -0,0 +1,23 @@
+#pragma once
+
+#include "frame.h"
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPLIT_EFFORT 4 // Highest split effort, which places block boundaries to within 1KB.
+
+// A Huffman table blocks can be coded with under FLAG_TABLES, and the tree dump that describes it.
+typedef struct {
+    CodeBook book;
+    uint8_t tree[MAX_TREE_SIZE];
+    uint16_t tree_size;
+} BlockTable;
+
+uint32_t split_effort(const char *effort);
+
+uint32_t split_segment(uint32_t effort);
+
+uint32_t split_chunk(uint8_t *in, uint32_t nbytes, uint32_t flags, uint32_t effort, uint32_t *sizes);
+
+bool choose_table(BlockTable *current, uint64_t hist[static ALPHABET], BlockTable *next, bool *switched);
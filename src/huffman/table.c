@@ -0,0 +1,274 @@
+#include "table.h"
+#include "frame.h"
+#include "../utils/cpu.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define TABLE_MASK ((1 << TABLE_BITS) - 1)
+
+// A table probe: up to TABLE_SYMBOLS complete symbols packed little-endian into symbols.
+// A count of 0 means the next code is longer than TABLE_BITS and must be walked in the tree.
+// Entries are exactly 8 bytes so the vector kernels can gather them as 64-bit words.
+typedef struct {
+    uint32_t symbols;
+    uint8_t count;
+    uint8_t bits;
+    uint16_t unused;
+} Entry;
+
+// The read position of one of the bitstreams of a block.
+typedef struct {
+    uint64_t start;
+    uint64_t nbytes;
+    uint64_t pos;
+    uint8_t *out;
+    uint64_t left;
+} Stream;
+
+struct DecodeTable {
+    Node *root;
+    uint8_t lengths[1 << TABLE_BITS];
+    Entry entries[1 << TABLE_BITS];
+};
+
+static void (*lockstep_kernel)(DecodeTable *t, uint8_t *in, Stream streams[static STREAMS]);
+
+// Creates a decode table whose entries each decode as many whole codes as fit in TABLE_BITS.
+// Returns the table, which borrows (does not own) the tree
+//
+// root : the root of the huffman tree
+// codes: the codes built from the tree by build_codes()
+DecodeTable *table_create(Node *root, Code codes[static ALPHABET]) {
+    DecodeTable *t = (DecodeTable *) calloc(1, sizeof(DecodeTable));
+    if (!t) {
+        return NULL;
+    }
+    t->root = root;
+    uint8_t symbols[1 << TABLE_BITS];
+    // Single-symbol table: every index whose low bits are a short code maps to its symbol
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        uint32_t length = code_size(&codes[symbol]);
+        if (length == 0 || length > TABLE_BITS) {
+            continue;
+        }
+        uint32_t prefix = 0;
+        for (uint32_t bit = 0; bit < length; bit++) {
+            prefix |= (uint32_t) code_get_bit(&codes[symbol], bit) << bit;
+        }
+        for (uint32_t index = prefix; index < (1 << TABLE_BITS); index += 1 << length) {
+            symbols[index] = symbol;
+            t->lengths[index] = length;
+        }
+    }
+    // Multi-symbol table: chain single lookups while the next code still fits in the index
+    for (uint32_t index = 0; index < (1 << TABLE_BITS); index++) {
+        Entry *e = &t->entries[index];
+        while (e->count < TABLE_SYMBOLS) {
+            uint32_t next = (index >> e->bits) & TABLE_MASK;
+            if (t->lengths[next] == 0 || e->bits + t->lengths[next] > TABLE_BITS) {
+                break;
+            }
+            e->symbols |= (uint32_t) symbols[next] << (8 * e->count);
+            e->bits += t->lengths[next];
+            e->count += 1;
+        }
+    }
+    return t;
+}
+
+// Frees a decode table.
+//
+// t: the table to free
+void table_delete(DecodeTable **t) {
+    if (*t) {
+        free(*t);
+        *t = NULL;
+    }
+    return;
+}
+
+// Decodes symbols from a buffer of codes, several at a time while they fit in a table probe.
+// Returns the number of symbols decoded, or -1 if the codes leave the tree or the buffer
+//
+// t       : the decode table
+// in      : the coded bytes
+// nbytes  : the number of bytes in in
+// pos     : the bit position to start at, advanced past the decoded codes
+// limit   : no code may start at or after this bit position
+// out     : the buffer to store the decoded symbols into
+// nsymbols: the maximum number of symbols to decode
+int64_t table_decode(DecodeTable *t, uint8_t *in, uint64_t nbytes, uint64_t *pos, uint64_t limit,
+    uint8_t *out, uint64_t nsymbols) {
+    uint64_t decoded = 0, nbits = nbytes * 8, at = *pos;
+    while (decoded < nsymbols && at < limit) {
+        uint64_t bits = peek_bits(in, nbytes, at);
+        Entry *e = &t->entries[bits & TABLE_MASK];
+        if (e->count && decoded + TABLE_SYMBOLS <= nsymbols) {
+            // Fast path: emit every symbol in the probe
+            memcpy(&out[decoded], &e->symbols, sizeof(e->symbols));
+            decoded += e->count;
+            at += e->bits;
+        } else if (e->count) {
+            // Near the end: emit a single symbol
+            out[decoded++] = e->symbols & 0xFF;
+            at += t->lengths[bits & TABLE_MASK];
+        } else {
+            // Long code: walk the tree
+            Node *current = t->root;
+            while (current && (current->left || current->right)) {
+                if (at == nbits) {
+                    return -1;
+                }
+                current = (in[at / 8] & (1 << (at % 8))) ? current->right : current->left;
+                at += 1;
+            }
+            if (!current) {
+                return -1;
+            }
+            out[decoded++] = current->symbol;
+        }
+        if (at > nbits) {
+            return -1;
+        }
+    }
+    *pos = at;
+    return decoded;
+}
+
+// Returns how many probes every stream can take without a bounds check: each stream needs 8
+// readable bytes for its probe and room for TABLE_SYMBOLS more symbols.
+//
+// streams: the bitstreams of the block
+static uint64_t safe_probes(Stream streams[static STREAMS]) {
+    uint64_t probes = UINT64_MAX;
+    for (uint8_t k = 0; k < STREAMS; k++) {
+        Stream *s = &streams[k];
+        if (s->pos / 8 + 8 > s->nbytes || s->left < TABLE_SYMBOLS) {
+            return 0;
+        }
+        uint64_t by_bits = ((s->nbytes - 8) * 8 - s->pos) / TABLE_BITS + 1;
+        uint64_t by_room = (s->left - TABLE_SYMBOLS) / TABLE_SYMBOLS + 1;
+        probes = by_bits < probes ? by_bits : probes;
+        probes = by_room < probes ? by_room : probes;
+    }
+    return probes;
+}
+
+// Reference lockstep kernel: one table probe per stream per round so the lookups overlap.
+// Stops at the first code longer than TABLE_BITS or when a stream nears its end.
+static void lockstep_scalar(DecodeTable *t, uint8_t *in, Stream streams[static STREAMS]) {
+    uint64_t probes;
+    while ((probes = safe_probes(streams)) > 0) {
+        for (; probes > 0; probes--) {
+            for (uint8_t k = 0; k < STREAMS; k++) {
+                Stream *s = &streams[k];
+                uint64_t word;
+                memcpy(&word, &in[s->start + s->pos / 8], sizeof(word));
+                Entry *e = &t->entries[(word >> (s->pos % 8)) & TABLE_MASK];
+                if (!e->count) {
+                    return;
+                }
+                memcpy(s->out, &e->symbols, sizeof(e->symbols));
+                s->out += e->count;
+                s->left -= e->count;
+                s->pos += e->bits;
+            }
+        }
+    }
+    return;
+}
+
+#if defined(__x86_64__)
+// Lockstep kernel for AVX2: gathers the next 64 bits of all four streams, shifts them into place,
+// and gathers the four table entries in one instruction each.
+__attribute__((target("avx2"))) static void lockstep_avx2(
+    DecodeTable *t, uint8_t *in, Stream streams[static STREAMS]) {
+    __m256i mask = _mm256_set1_epi64x(TABLE_MASK), seven = _mm256_set1_epi64x(7);
+    __m256i byte_mask = _mm256_set1_epi64x(0xFF);
+    uint64_t probes, symbols[STREAMS], counts[STREAMS];
+    while ((probes = safe_probes(streams)) > 0) {
+        __m256i start = _mm256_set_epi64x(
+            streams[3].start, streams[2].start, streams[1].start, streams[0].start);
+        __m256i pos = _mm256_set_epi64x(streams[3].pos, streams[2].pos, streams[1].pos, streams[0].pos);
+        for (; probes > 0; probes--) {
+            __m256i offset = _mm256_add_epi64(start, _mm256_srli_epi64(pos, 3));
+            __m256i words = _mm256_i64gather_epi64((const long long *) in, offset, 1);
+            __m256i index = _mm256_and_si256(_mm256_srlv_epi64(words, _mm256_and_si256(pos, seven)), mask);
+            __m256i entries = _mm256_i64gather_epi64((const long long *) t->entries, index, 8);
+            __m256i count = _mm256_and_si256(_mm256_srli_epi64(entries, 32), byte_mask);
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(count, _mm256_setzero_si256()))) {
+                break;
+            }
+            pos = _mm256_add_epi64(pos, _mm256_and_si256(_mm256_srli_epi64(entries, 40), byte_mask));
+            _mm256_storeu_si256((__m256i *) symbols, entries);
+            _mm256_storeu_si256((__m256i *) counts, count);
+            for (uint8_t k = 0; k < STREAMS; k++) {
+                memcpy(streams[k].out, &symbols[k], sizeof(uint32_t));
+                streams[k].out += counts[k];
+                streams[k].left -= counts[k];
+            }
+        }
+        uint64_t positions[STREAMS];
+        _mm256_storeu_si256((__m256i *) positions, pos);
+        for (uint8_t k = 0; k < STREAMS; k++) {
+            streams[k].pos = positions[k];
+        }
+        if (probes > 0) {
+            return;
+        }
+    }
+    return;
+}
+#endif
+
+// Picks the lockstep decoding kernel for the CPU.
+__attribute__((constructor)) static void table_init(void) {
+    lockstep_kernel = lockstep_scalar;
+#if defined(__x86_64__)
+    if (cpu_level() >= CPU_AVX2) {
+        lockstep_kernel = lockstep_avx2;
+    }
+#endif
+    return;
+}
+
+// Decodes a block packed by pack_block() into STREAMS bitstreams, advancing them in lockstep
+// while they are far from their ends and finishing each one alone.
+// Returns whether all the symbols were decoded without leaving the tree or a bitstream
+//
+// t       : the decode table
+// in      : the coded bytes of the block
+// nbytes  : the number of bytes in in
+// out     : the buffer to store the decoded symbols into
+// nsymbols: the number of symbols in the block
+bool table_decode_streams(DecodeTable *t, uint8_t *in, uint64_t nbytes, uint8_t *out, uint64_t nsymbols) {
+    uint32_t sizes[STREAMS - 1];
+    uint64_t quarter = (nsymbols + STREAMS - 1) / STREAMS, start = sizeof(sizes);
+    Stream streams[STREAMS];
+    if (nbytes < sizeof(sizes)) {
+        return false;
+    }
+    memcpy(sizes, in, sizeof(sizes));
+    for (uint8_t k = 0; k < STREAMS; k++) {
+        uint64_t first = k * quarter < nsymbols ? k * quarter : nsymbols;
+        uint64_t size = k < STREAMS - 1 ? sizes[k] : nbytes - start;
+        if (start + size > nbytes) {
+            return false;
+        }
+        streams[k] = (Stream) { start, size, 0, &out[first], 0 };
+        streams[k].left = nsymbols - first < quarter ? nsymbols - first : quarter;
+        start += size;
+    }
+    lockstep_kernel(t, in, streams);
+    for (uint8_t k = 0; k < STREAMS; k++) {
+        Stream *s = &streams[k];
+        if (table_decode(t, &in[s->start], s->nbytes, &s->pos, s->nbytes * 8, s->out, s->left)
+            != (int64_t) s->left) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "../utils/node.h"
+#include "../utils/code.h"
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct DecodeTable DecodeTable;
+
+DecodeTable *table_create(Node *root, Code codes[static ALPHABET]);
+
+void table_delete(DecodeTable **t);
+
+int64_t table_decode(DecodeTable *t, uint8_t *in, uint64_t nbytes, uint64_t *pos, uint64_t limit,
+    uint8_t *out, uint64_t nsymbols);
+
+bool table_decode_streams(DecodeTable *t, uint8_t *in, uint64_t nbytes, uint8_t *out, uint64_t nsymbols);
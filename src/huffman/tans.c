@@ -0,0 +1,248 @@
+#include "tans.h"
+#include "frame.h"
+#include <math.h>
+#include <string.h>
+
+#define TANS_MASK (TANS_STATES - 1)
+
+// Returns the index of the highest set bit of a non-zero value.
+static inline uint32_t highest_bit(uint32_t value) {
+    return 31 - __builtin_clz(value);
+}
+
+// Spreads every symbol over the states in proportion to its count, scattering the states of a
+// symbol across the table so neighbouring states code different symbols.
+//
+// counts: the normalized count of every symbol
+// spread: the symbol every state codes
+static void spread_symbols(uint16_t counts[static ALPHABET], uint8_t spread[static TANS_STATES]) {
+    uint32_t step = (TANS_STATES >> 1) + (TANS_STATES >> 3) + 3, position = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        for (uint32_t i = 0; i < counts[symbol]; i++) {
+            spread[position] = symbol;
+            position = (position + step) & TANS_MASK;
+        }
+    }
+    return;
+}
+
+// Scales a histogram to counts that sum to the number of tANS states, keeping every symbol that
+// occurs at a count of at least 1.
+// Returns false if the histogram is empty
+//
+// hist  : the histogram of the data to code
+// counts: the normalized counts
+bool tans_normalize(uint64_t hist[static ALPHABET], uint16_t counts[static ALPHABET]) {
+    uint64_t total = 0;
+    int64_t distributed = 0;
+    uint16_t largest = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        total += hist[symbol];
+        largest = hist[symbol] > hist[largest] ? symbol : largest;
+    }
+    if (total == 0) {
+        return false;
+    }
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        counts[symbol] = 0;
+        if (hist[symbol] > 0) {
+            uint64_t scaled = (uint64_t) ((double) hist[symbol] * TANS_STATES / total + 0.5);
+            counts[symbol] = scaled > 0 ? scaled : 1;
+            distributed += counts[symbol];
+        }
+    }
+    // Rounding leaves the sum a little off; settle the difference on the most frequent symbols
+    if (distributed < TANS_STATES) {
+        counts[largest] += TANS_STATES - distributed;
+    }
+    while (distributed > TANS_STATES) {
+        uint16_t most = 0;
+        for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+            most = counts[symbol] > counts[most] ? symbol : most;
+        }
+        uint16_t excess = distributed - TANS_STATES;
+        uint16_t taken = excess < counts[most] / 4 + 1 ? excess : counts[most] / 4 + 1;
+        counts[most] -= taken;
+        distributed -= taken;
+    }
+    return true;
+}
+
+// Returns the number of bits tANS codes a histogram to with a set of counts, to within a few bits
+// per block
+//
+// hist  : the histogram of the data to code
+// counts: the normalized counts, which must be non-zero for every symbol in hist
+uint64_t tans_cost(uint64_t hist[static ALPHABET], uint16_t counts[static ALPHABET]) {
+    double bits = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        if (hist[symbol] > 0) {
+            bits += hist[symbol] * (TANS_LOG - log2(counts[symbol]));
+        }
+    }
+    return (uint64_t) bits + 1;
+}
+
+// Writes out the normalized counts: the last symbol with a count, then the counts of every
+// symbol up to it.
+// Returns the number of bytes written, at most 1 + 2 * ALPHABET
+//
+// counts: the normalized counts
+// out   : the buffer to write into
+uint16_t tans_write_counts(uint16_t counts[static ALPHABET], uint8_t *out) {
+    uint8_t last = 0;
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        last = counts[symbol] ? symbol : last;
+    }
+    out[0] = last;
+    memcpy(&out[1], counts, (last + 1) * sizeof(uint16_t));
+    return 1 + (last + 1) * sizeof(uint16_t);
+}
+
+// Reads back normalized counts written by tans_write_counts().
+// Returns the number of bytes read, or -1 if the counts are truncated or do not sum to the number
+// of states
+//
+// in    : the buffer to read from
+// nbytes: the number of bytes in in
+// counts: the normalized counts
+int32_t tans_read_counts(uint8_t *in, uint64_t nbytes, uint16_t counts[static ALPHABET]) {
+    if (nbytes < 1 || nbytes < 1 + (in[0] + 1) * sizeof(uint16_t)) {
+        return -1;
+    }
+    uint32_t total = 0, size = 1 + (in[0] + 1) * sizeof(uint16_t);
+    memset(counts, 0, ALPHABET * sizeof(uint16_t));
+    memcpy(counts, &in[1], (in[0] + 1) * sizeof(uint16_t));
+    for (uint16_t symbol = 0; symbol < ALPHABET; symbol++) {
+        total += counts[symbol];
+    }
+    return total == TANS_STATES ? (int32_t) size : -1;
+}
+
+// Builds the encoding tables for a set of normalized counts.
+//
+// e     : the encoder
+// counts: the normalized counts
+void tans_encoder_init(TansEncoder *e, uint16_t counts[static ALPHABET]) {
+    uint8_t spread[TANS_STATES];
+    uint16_t seen[ALPHABET] = { 0 };
+    spread_symbols(counts, spread);
+    for (uint16_t symbol = 0, start = 0; symbol < ALPHABET; symbol++) {
+        e->counts[symbol] = counts[symbol];
+        e->starts[symbol] = start;
+        e->max_bits[symbol] = counts[symbol] ? TANS_LOG - highest_bit(counts[symbol]) : 0;
+        start += counts[symbol];
+    }
+    // The states of a symbol, in table order, are the targets of its sub-states count..2*count-1
+    for (uint32_t i = 0; i < TANS_STATES; i++) {
+        uint8_t symbol = spread[i];
+        e->states[e->starts[symbol] + seen[symbol]++] = TANS_STATES + i;
+    }
+    return;
+}
+
+// Builds the decoding table for a set of normalized counts.
+//
+// d     : the decoder
+// counts: the normalized counts
+void tans_decoder_init(TansDecoder *d, uint16_t counts[static ALPHABET]) {
+    uint8_t spread[TANS_STATES];
+    uint16_t next[ALPHABET];
+    spread_symbols(counts, spread);
+    memcpy(next, counts, sizeof(next));
+    for (uint32_t i = 0; i < TANS_STATES; i++) {
+        uint8_t symbol = spread[i];
+        uint32_t sub = next[symbol]++, bits = TANS_LOG - highest_bit(sub);
+        d->entries[i] = (TansEntry) { (sub << bits) - TANS_STATES, symbol, bits };
+    }
+    return;
+}
+
+// Returns the most bytes tans_pack() can write for a given number of symbols.
+//
+// nsymbols: the number of symbols in the block
+uint64_t tans_bound(uint32_t nsymbols) {
+    return ((uint64_t) nsymbols * TANS_LOG + 2 * TANS_LOG + 7) / 8 + sizeof(uint64_t);
+}
+
+// Codes a block with two interleaved tANS states (even symbols use the first, odd symbols the
+// second). The block is coded backwards, so the bits of every symbol are staged and then written
+// in decoding order, after the two final states.
+// Returns the number of bytes written to out
+//
+// e       : the encoder, which must have a count for every symbol in in
+// in      : the symbols to code, at most FRAME_BLOCK of them
+// nsymbols: the number of symbols in in
+// out     : the buffer to write into, which must hold tans_bound() bytes
+uint32_t tans_pack(TansEncoder *e, uint8_t *in, uint32_t nsymbols, uint8_t *out) {
+    uint32_t state[2] = { TANS_STATES, TANS_STATES };
+    for (uint32_t i = nsymbols; i-- > 0;) {
+        uint8_t symbol = in[i];
+        uint32_t *x = &state[i & 1];
+        uint32_t bits = e->max_bits[symbol] - (*x < ((uint32_t) e->counts[symbol] << e->max_bits[symbol]));
+        e->values[i] = *x & ((1 << bits) - 1);
+        e->lengths[i] = bits;
+        *x = e->states[e->starts[symbol] + (*x >> bits) - e->counts[symbol]];
+    }
+    BitWriter w;
+    writer_init(&w, out);
+    put_bits(&w, state[0] - TANS_STATES, TANS_LOG);
+    put_bits(&w, state[1] - TANS_STATES, TANS_LOG);
+    for (uint32_t i = 0; i < nsymbols; i++) {
+        put_bits(&w, e->values[i], e->lengths[i]);
+    }
+    return writer_flush(&w) - out;
+}
+
+// Reads the next bits of a buffer, padding past the end with zeros.
+//
+// in    : the coded bytes
+// nbytes: the number of bytes in in
+// pos   : the bit position to start at
+// bits  : the number of bits to read, at most 32
+static inline uint32_t read_tail(uint8_t *in, uint64_t nbytes, uint64_t pos, uint32_t bits) {
+    uint64_t word = 0;
+    for (uint64_t i = 0; pos / 8 + i < nbytes && i < sizeof(word); i++) {
+        word |= (uint64_t) in[pos / 8 + i] << (8 * i);
+    }
+    return (word >> (pos % 8)) & ((1 << bits) - 1);
+}
+
+// Decodes a block coded by tans_pack(). Every state of the table is valid, so the loop needs no
+// checks: a 64-bit load covers the bits of four symbols, whose lookups chain without branches.
+// Returns whether the symbols decoded without reading past the end of the block
+//
+// d       : the decoder
+// in      : the coded bytes
+// nbytes  : the number of bytes in in
+// out     : the buffer to store the decoded symbols into
+// nsymbols: the number of symbols in the block
+bool tans_unpack(TansDecoder *d, uint8_t *in, uint64_t nbytes, uint8_t *out, uint32_t nsymbols) {
+    uint64_t pos = 2 * TANS_LOG;
+    uint32_t i = 0, s0 = read_tail(in, nbytes, 0, TANS_LOG), s1 = read_tail(in, nbytes, TANS_LOG, TANS_LOG);
+    while (i + 4 <= nsymbols && pos / 8 + sizeof(uint64_t) <= nbytes) {
+        uint64_t word;
+        memcpy(&word, &in[pos / 8], sizeof(word));
+        word >>= pos % 8;
+        for (uint8_t k = 0; k < 2; k++) {
+            TansEntry e0 = d->entries[s0];
+            out[i++] = e0.symbol;
+            s0 = e0.base + (word & ((1 << e0.bits) - 1));
+            word >>= e0.bits;
+            TansEntry e1 = d->entries[s1];
+            out[i++] = e1.symbol;
+            s1 = e1.base + (word & ((1 << e1.bits) - 1));
+            word >>= e1.bits;
+            pos += e0.bits + e1.bits;
+        }
+    }
+    // Near the end of the block: one symbol at a time
+    for (; i < nsymbols; i++) {
+        uint32_t *s = i & 1 ? &s1 : &s0;
+        TansEntry e = d->entries[*s];
+        out[i] = e.symbol;
+        *s = e.base + read_tail(in, nbytes, pos, e.bits);
+        pos += e.bits;
+    }
+    return pos <= nbytes * 8;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TANS_STATES (1 << TANS_LOG)
+#define TANS_BOUND  ((FRAME_BLOCK * TANS_LOG + 2 * TANS_LOG + 7) / 8 + 8) // tans_bound() of a full block.
+
+// Everything needed to code blocks of up to FRAME_BLOCK symbols with tANS: the state table and
+// per-symbol transforms, plus room to stage the bits of a block while it is coded backwards.
+typedef struct {
+    uint16_t states[TANS_STATES];
+    uint16_t counts[ALPHABET];
+    uint16_t starts[ALPHABET];
+    uint8_t max_bits[ALPHABET];
+    uint16_t values[FRAME_BLOCK];
+    uint8_t lengths[FRAME_BLOCK];
+    uint8_t coded[TANS_BOUND];
+} TansEncoder;
+
+// A decoder state: the symbol it emits and how to form the next state from the bitstream.
+typedef struct {
+    uint16_t base;
+    uint8_t symbol;
+    uint8_t bits;
+} TansEntry;
+
+typedef struct {
+    TansEntry entries[TANS_STATES];
+} TansDecoder;
+
+bool tans_normalize(uint64_t hist[static ALPHABET], uint16_t counts[static ALPHABET]);
+
+uint64_t tans_cost(uint64_t hist[static ALPHABET], uint16_t counts[static ALPHABET]);
+
+uint16_t tans_write_counts(uint16_t counts[static ALPHABET], uint8_t *out);
+
+int32_t tans_read_counts(uint8_t *in, uint64_t nbytes, uint16_t counts[static ALPHABET]);
+
+void tans_encoder_init(TansEncoder *e, uint16_t counts[static ALPHABET]);
+
+void tans_decoder_init(TansDecoder *d, uint16_t counts[static ALPHABET]);
+
+uint64_t tans_bound(uint32_t nsymbols);
+
+uint32_t tans_pack(TansEncoder *e, uint8_t *in, uint32_t nsymbols, uint8_t *out);
+
+bool tans_unpack(TansDecoder *d, uint8_t *in, uint64_t nbytes, uint8_t *out, uint32_t nsymbols);
@@ -0,0 +1,287 @@
+#include "wide.h"
+#include "frame.h"
+#include "huffman.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDE_MASK ((1 << WIDE_TABLE_BITS) - 1)
+
+// Decodes canonical codes: a table probe for every code of at most WIDE_TABLE_BITS bits, and the
+// first code and number of codes of every length for the rest. Keeping no Code or tree node per
+// symbol keeps a table for 65536 symbols at about 200KB.
+struct WideTable {
+    uint32_t entries[1 << WIDE_TABLE_BITS]; // symbol | length << 16, or 0 for a longer code.
+    uint64_t first[WIDE_LONGEST + 1];
+    uint32_t count[WIDE_LONGEST + 1];
+    uint32_t offset[WIDE_LONGEST + 1];
+    uint16_t sorted[WIDE_ALPHABET]; // The symbols ordered by code length, then by symbol.
+};
+
+// Returns a code with the order of its bits reversed
+//
+// code  : the code
+// length: the number of bits in the code
+static uint32_t reverse(uint32_t code, uint32_t length) {
+    uint32_t reversed = 0;
+    for (uint32_t bit = 0; bit < length; bit++) {
+        reversed = reversed << 1 | ((code >> bit) & 1);
+    }
+    return reversed;
+}
+
+// Checks the frame flags of a stream of 16-bit symbols, which are only ever checksummed and counted.
+// Returns whether the flags are valid
+//
+// flags: the frame flags
+bool wide_valid(uint32_t flags) {
+    return !(flags & FLAG_WIDE) || (flags & ~(FLAG_WIDE | FLAG_CHECKSUM | FLAG_COUNTS)) == 0;
+}
+
+// Adds the number of occurrences of every 16-bit little-endian symbol in a buffer to a histogram. An odd
+// byte at the end counts as a symbol whose high byte is 0.
+//
+// in    : the bytes to count
+// nbytes: the number of bytes in in
+// hist  : the histogram to add to
+void count_pairs(uint8_t *in, uint32_t nbytes, uint64_t hist[static WIDE_ALPHABET]) {
+    uint32_t i = 0;
+    for (; i + 1 < nbytes; i += 2) {
+        hist[in[i] | in[i + 1] << 8] += 1;
+    }
+    if (i < nbytes) {
+        hist[in[i]] += 1;
+    }
+    return;
+}
+
+// Builds the canonical codes for a histogram of 16-bit symbols. Like the byte codes, the tree gets
+// the first and last symbols as padding, so that there are always two codes.
+// Returns the code book, or NULL if it could not be allocated
+//
+// hist: the histogram of the symbols
+WideBook *wide_book_create(uint64_t hist[static WIDE_ALPHABET]) {
+    WideBook *book = (WideBook *) calloc(1, sizeof(WideBook));
+    uint64_t *padded = (uint64_t *) malloc(WIDE_ALPHABET * sizeof(uint64_t));
+    uint32_t *lengths = (uint32_t *) calloc(WIDE_ALPHABET, sizeof(uint32_t));
+    uint32_t longest = 0;
+    Node *root = NULL;
+    if (book && padded && lengths) {
+        memcpy(padded, hist, WIDE_ALPHABET * sizeof(uint64_t));
+        padded[0] += 1;
+        padded[WIDE_ALPHABET - 1] += 1;
+        // Flatten the histogram until the longest code fits (never, short of terabytes of skew)
+        while ((root = build_wide_tree(padded))) {
+            build_lengths(root, lengths);
+            delete_tree(&root);
+            longest = 0;
+            for (uint32_t symbol = 0; symbol < WIDE_ALPHABET; symbol++) {
+                longest = lengths[symbol] > longest ? lengths[symbol] : longest;
+            }
+            if (longest <= WIDE_LONGEST) {
+                break;
+            }
+            for (uint32_t symbol = 0; symbol < WIDE_ALPHABET; symbol++) {
+                padded[symbol] = padded[symbol] ? padded[symbol] / 2 + 1 : 0;
+            }
+        }
+    }
+    if (!book || !padded || !lengths || longest == 0 || longest > WIDE_LONGEST) {
+        free(book);
+        free(padded);
+        free(lengths);
+        return NULL;
+    }
+
+    // Canonical codes: consecutive within a length, in symbol order
+    uint32_t count[WIDE_LONGEST + 1] = { 0 }, next[WIDE_LONGEST + 1] = { 0 }, code = 0;
+    for (uint32_t symbol = 0; symbol < WIDE_ALPHABET; symbol++) {
+        count[lengths[symbol]] += lengths[symbol] > 0;
+    }
+    for (uint32_t length = 1; length <= WIDE_LONGEST; length++) {
+        code = (code + count[length - 1]) << 1;
+        next[length] = code;
+    }
+    for (uint32_t symbol = 0; symbol < WIDE_ALPHABET; symbol++) {
+        if (lengths[symbol] > 0) {
+            book->lengths[symbol] = lengths[symbol];
+            book->codes[symbol] = reverse(next[lengths[symbol]]++, lengths[symbol]);
+        }
+    }
+    free(padded);
+    free(lengths);
+    return book;
+}
+
+// Writes the code length table of a code book: the number of symbols with a code, then every such
+// symbol and its code length, in symbol order.
+// Returns the number of bytes written
+//
+// book: the code book
+// out : the buffer to write the table into
+uint32_t wide_write_lengths(WideBook *book, uint8_t out[static WIDE_LENGTHS]) {
+    uint32_t symbols = 0, size = sizeof(symbols);
+    for (uint32_t symbol = 0; symbol < WIDE_ALPHABET; symbol++) {
+        if (book->lengths[symbol] > 0) {
+            uint16_t wide = symbol;
+            memcpy(&out[size], &wide, sizeof(wide));
+            out[size + sizeof(wide)] = book->lengths[symbol];
+            size += sizeof(wide) + 1;
+            symbols += 1;
+        }
+    }
+    memcpy(out, &symbols, sizeof(symbols));
+    return size;
+}
+
+// Reads a code length table written by wide_write_lengths().
+// Returns the number of bytes the table took up, or -1 if it is truncated or invalid
+//
+// in     : the bytes holding the table
+// nbytes : the number of bytes in in
+// lengths: set to the code length of every symbol, 0 for symbols without a code
+int64_t wide_read_lengths(uint8_t *in, uint64_t nbytes, uint8_t lengths[static WIDE_ALPHABET]) {
+    uint32_t symbols;
+    if (nbytes < sizeof(symbols)) {
+        return -1;
+    }
+    memcpy(&symbols, in, sizeof(symbols));
+    if (symbols > WIDE_ALPHABET || nbytes - sizeof(symbols) < 3 * (uint64_t) symbols) {
+        return -1;
+    }
+    memset(lengths, 0, WIDE_ALPHABET);
+    int64_t previous = -1;
+    for (uint32_t i = 0; i < symbols; i++) {
+        uint16_t symbol;
+        uint8_t *entry = &in[sizeof(symbols) + 3 * i];
+        memcpy(&symbol, entry, sizeof(symbol));
+        if (symbol <= previous || entry[2] == 0 || entry[2] > WIDE_LONGEST) {
+            return -1;
+        }
+        lengths[symbol] = entry[2];
+        previous = symbol;
+    }
+    return sizeof(symbols) + 3 * (uint64_t) symbols;
+}
+
+// Returns the most bytes wide_pack() can write for a given number of bytes.
+//
+// nbytes: the number of bytes in the block
+uint64_t wide_bound(uint32_t nbytes) {
+    return ((uint64_t) (nbytes + 1) / 2 * WIDE_LONGEST + 7) / 8 + sizeof(uint64_t);
+}
+
+// Packs the codes for a block of 16-bit symbols into a byte-aligned buffer.
+// Returns the number of bytes written to out
+//
+// book  : the code book
+// in    : the bytes to code, two to a symbol
+// nbytes: the number of bytes in in
+// out   : the buffer to pack into, which must hold wide_bound() bytes
+uint32_t wide_pack(WideBook *book, uint8_t *in, uint32_t nbytes, uint8_t *out) {
+    BitWriter w;
+    uint32_t i = 0;
+    writer_init(&w, out);
+    for (; i + 1 < nbytes; i += 2) {
+        uint16_t symbol = in[i] | in[i + 1] << 8;
+        put_bits(&w, book->codes[symbol], book->lengths[symbol]);
+    }
+    if (i < nbytes) {
+        put_bits(&w, book->codes[in[i]], book->lengths[in[i]]);
+    }
+    return writer_flush(&w) - out;
+}
+
+// Creates the decode table for a code length table.
+// Returns the table, or NULL if the lengths describe more codes than fit or it could not be allocated
+//
+// lengths: the code length of every symbol, 0 for symbols without a code
+WideTable *wide_table_create(uint8_t lengths[static WIDE_ALPHABET]) {
+    WideTable *t = (WideTable *) calloc(1, sizeof(WideTable));
+    if (!t) {
+        return NULL;
+    }
+    // Codes of the same length may not add up to more than the whole code space
+    uint64_t space = 0, code = 0;
+    for (uint32_t symbol = 0; symbol < WIDE_ALPHABET; symbol++) {
+        t->count[lengths[symbol]] += lengths[symbol] > 0;
+        space += lengths[symbol] > 0 ? (uint64_t) 1 << (WIDE_LONGEST - lengths[symbol]) : 0;
+    }
+    if (space > (uint64_t) 1 << WIDE_LONGEST) {
+        free(t);
+        return NULL;
+    }
+    uint32_t placed[WIDE_LONGEST + 1] = { 0 };
+    for (uint32_t length = 1, offset = 0; length <= WIDE_LONGEST; length++) {
+        code = (code + t->count[length - 1]) << 1;
+        t->first[length] = code;
+        t->offset[length] = offset;
+        offset += t->count[length];
+    }
+    for (uint32_t symbol = 0; symbol < WIDE_ALPHABET; symbol++) {
+        uint32_t length = lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+        uint32_t rank = placed[length]++;
+        t->sorted[t->offset[length] + rank] = symbol;
+        if (length <= WIDE_TABLE_BITS) {
+            uint32_t prefix = reverse(t->first[length] + rank, length);
+            for (uint32_t index = prefix; index < (1 << WIDE_TABLE_BITS); index += 1 << length) {
+                t->entries[index] = symbol | length << 16;
+            }
+        }
+    }
+    return t;
+}
+
+// Frees a decode table.
+//
+// t: the table to free
+void wide_table_delete(WideTable **t) {
+    if (*t) {
+        free(*t);
+        *t = NULL;
+    }
+    return;
+}
+
+// Decodes a block of 16-bit symbols coded by wide_pack(), two bytes per table probe.
+// Returns whether every symbol was decoded without leaving the codes or the block
+//
+// t     : the decode table
+// in    : the coded bytes
+// nbytes: the number of bytes in in
+// out   : the buffer to store the decoded bytes into
+// nout  : the number of bytes the block decodes to
+bool wide_decode(WideTable *t, uint8_t *in, uint64_t nbytes, uint8_t *out, uint32_t nout) {
+    uint64_t pos = 0, nbits = nbytes * 8;
+    for (uint32_t i = 0; i < nout; i += 2) {
+        uint64_t bits = peek_bits(in, nbytes, pos);
+        uint32_t entry = t->entries[bits & WIDE_MASK], symbol, length = entry >> 16;
+        if (entry) {
+            symbol = entry & 0xFFFF;
+        } else {
+            // Long code: the codes of every length are consecutive, starting at first
+            uint64_t code = 0;
+            for (length = 1; length <= WIDE_LONGEST; length++) {
+                code = code << 1 | ((bits >> (length - 1)) & 1);
+                if (code - t->first[length] < t->count[length]) {
+                    break;
+                }
+            }
+            if (length > WIDE_LONGEST) {
+                return false;
+            }
+            symbol = t->sorted[t->offset[length] + code - t->first[length]];
+        }
+        pos += length;
+        if (pos > nbits) {
+            return false;
+        }
+        out[i] = symbol;
+        if (i + 1 < nout) {
+            out[i + 1] = symbol >> 8;
+        }
+    }
+    return true;
+}
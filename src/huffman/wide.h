@@ -0,0 +1,37 @@
+#pragma once
+
+#include "../defines.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WIDE_LONGEST    32 // Longest code of a 16-bit symbol; longer codes are flattened out of the histogram.
+#define WIDE_TABLE_BITS 14 // Bits of lookahead per 16-bit decode table probe.
+#define WIDE_LENGTHS    (sizeof(uint32_t) + 3 * WIDE_ALPHABET) // Largest code length table.
+
+// Canonical codes for 16-bit symbols, bit-reversed for the LSB-first bitstream.
+typedef struct {
+    uint32_t codes[WIDE_ALPHABET];
+    uint8_t lengths[WIDE_ALPHABET];
+} WideBook;
+
+typedef struct WideTable WideTable;
+
+bool wide_valid(uint32_t flags);
+
+void count_pairs(uint8_t *in, uint32_t nbytes, uint64_t hist[static WIDE_ALPHABET]);
+
+WideBook *wide_book_create(uint64_t hist[static WIDE_ALPHABET]);
+
+uint32_t wide_write_lengths(WideBook *book, uint8_t out[static WIDE_LENGTHS]);
+
+int64_t wide_read_lengths(uint8_t *in, uint64_t nbytes, uint8_t lengths[static WIDE_ALPHABET]);
+
+uint64_t wide_bound(uint32_t nbytes);
+
+uint32_t wide_pack(WideBook *book, uint8_t *in, uint32_t nbytes, uint8_t *out);
+
+WideTable *wide_table_create(uint8_t lengths[static WIDE_ALPHABET]);
+
+void wide_table_delete(WideTable **t);
+
+bool wide_decode(WideTable *t, uint8_t *in, uint64_t nbytes, uint8_t *out, uint32_t nout);
@@ -1,14 +1,123 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "io.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 uint64_t bytes_read = 0;
 uint64_t bytes_written = 0;
+int io_error = 0;
+int io_write_error = 0;
+uint32_t io_size = FRAME_BLOCK;
+bool io_nocache = false;
 static uint8_t code_buffer[BLOCK] = { 0 };
 static int32_t code_index = 0;
+static uint8_t *pushed = NULL;
+static int32_t pushed_size = 0, pushed_index = 0, pushed_file = -1;
 
-// Reads a certain number of bytes from a given file / file descriptor.
+// Parses a buffer size such as 4096, 256K or 8M and makes it the size of every read and write buffer.
+// Sizes are rounded up to a multiple of IO_ALIGN.
+// Returns whether the size was valid (between BLOCK and MAX_IO_SIZE)
+//
+// size: the size to parse
+bool set_io_size(const char *size) {
+    char *end;
+    uint64_t value = strtoull(size, &end, 10);
+    switch (*end) {
+    case 'k':
+    case 'K': value <<= 10; end++; break;
+    case 'm':
+    case 'M': value <<= 20; end++; break;
+    default: break;
+    }
+    if (*end != '\0' || value < BLOCK || value > MAX_IO_SIZE) {
+        return false;
+    }
+    io_size = (value + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN;
+    return true;
+}
+
+// Allocates a buffer aligned for direct I/O, rounded up to a whole number of IO_ALIGN blocks.
+// Returns the buffer (freed with free()), or NULL if it could not be allocated
+//
+// nbytes: the number of bytes needed
+uint8_t *io_alloc(uint64_t nbytes) {
+    void *buf = NULL;
+    if (posix_memalign(&buf, IO_ALIGN, (nbytes + IO_ALIGN - 1) / IO_ALIGN * IO_ALIGN) != 0) {
+        return NULL;
+    }
+    return (uint8_t *) buf;
+}
+
+// Opens a file to read, optionally bypassing the page cache, and advises the kernel of the access pattern.
+// Filesystems that do not support O_DIRECT fall back to buffered reads.
+// Returns the file descriptor, or -1 if the file could not be opened
+//
+// path  : the file to open
+// direct: whether to read the file with O_DIRECT, which needs io_alloc() buffers of io_size bytes
+int open_input(const char *path, bool direct) {
+    int infile = -1;
+#ifdef O_DIRECT
+    if (direct) {
+        infile = open(path, O_RDONLY | O_DIRECT);
+    }
+#else
+    (void) direct;
+#endif
+    // Filesystems such as tmpfs refuse O_DIRECT
+    if (infile < 0) {
+        infile = open(path, O_RDONLY);
+    }
+    if (infile >= 0) {
+        advise_input(infile);
+    }
+    return infile;
+}
+
+// Tells the kernel a file is read once from start to end, so it reads ahead aggressively and, with
+// io_nocache, does not keep the pages around.
+//
+// infile: the file to advise on
+void advise_input(int infile) {
+    posix_fadvise(infile, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (io_nocache) {
+        posix_fadvise(infile, 0, 0, POSIX_FADV_NOREUSE);
+    }
+    return;
+}
+
+// Drops the pages of a file before its current position from the page cache. Written pages are first
+// sent to disk, since dirty pages cannot be dropped; they are dropped on a later call once written.
+//
+// fd     : the file to drop pages of
+// written: whether the pages were written rather than read
+static void drop_behind(int fd, bool written) {
+    off_t at = lseek(fd, 0, SEEK_CUR);
+    if (at <= 0) {
+        return;
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (written) {
+        sync_file_range(fd, 0, at, SYNC_FILE_RANGE_WRITE);
+    }
+#else
+    (void) written;
+#endif
+    posix_fadvise(fd, 0, at, POSIX_FADV_DONTNEED);
+    return;
+}
+
+// Reads a certain number of bytes from a given file / file descriptor. A read that fails (rather than
+// reaching the end of the file) stops it early like the end of the file does, and sets io_error to its errno
+// for the program to report.
 // Returns the number of bytes read
 //
 // infile: the file to read the bytes from
@@ -16,18 +125,148 @@ static int32_t code_index = 0;
 // nbytes: the number of bytes to attempt to read 
 int read_bytes(int infile, uint8_t *buf, int nbytes) {
     int32_t curr_read = 0;
+    // Hand back unread bytes first
+    if (infile == pushed_file && pushed_index < pushed_size) {
+        curr_read = pushed_size - pushed_index < nbytes ? pushed_size - pushed_index : nbytes;
+        memcpy(buf, &pushed[pushed_index], curr_read);
+        pushed_index += curr_read;
+    }
     // Read nbytes bytes
     while (curr_read < nbytes) {
         int value = read(infile, &buf[curr_read], nbytes - curr_read);
+        if (value < 0 && errno == EINTR) {
+            continue;
+        }
         if (value <= 0) {
+            io_error = value < 0 ? errno : io_error;
             break;
         }
         curr_read += value;
     }
+    if (io_nocache && curr_read > 0) {
+        drop_behind(infile, false);
+    }
     bytes_read += curr_read;
     return curr_read;
 }
 
+// Reports a read that failed since the program started, which read_bytes() hands back like the end of the
+// file, on stderr.
+// Returns whether every read succeeded
+bool reads_ok(void) {
+    if (io_error) {
+        fprintf(stderr, "Unable to read infile: %s.\n", strerror(io_error));
+    }
+    return io_error == 0;
+}
+
+// Reports a write that failed since the program started, such as one into a full filesystem, on stderr.
+// Returns whether every write succeeded
+bool writes_ok(void) {
+    if (io_write_error) {
+        fprintf(stderr, "Unable to write outfile: %s.\n", strerror(io_write_error));
+    }
+    return io_write_error == 0;
+}
+
+// Reads whatever bytes of a given file / file descriptor are available, waiting for the first of them
+// to arrive for up to timeout milliseconds (-1 to wait for as long as it takes). Unlike read_bytes(), it
+// does not wait for nbytes bytes, so pipes can be consumed as they are written to.
+// Returns the number of bytes read, 0 at the end of the file, or -1 if nothing arrived in time
+//
+// infile : the file to read the bytes from
+// buf    : an array to store the read bytes into
+// nbytes : the most bytes to read
+// timeout: the number of milliseconds to wait for
+int read_ready(int infile, uint8_t *buf, int nbytes, int timeout) {
+    if (infile == pushed_file && pushed_index < pushed_size) {
+        return read_bytes(infile, buf, pushed_size - pushed_index < nbytes ? pushed_size - pushed_index : nbytes);
+    }
+    struct pollfd ready = { infile, POLLIN, 0 };
+    if (poll(&ready, 1, timeout) == 0) {
+        return -1;
+    }
+    ssize_t value = read(infile, buf, nbytes);
+    if (value <= 0) {
+        return 0;
+    }
+    bytes_read += value;
+    return value;
+}
+
+// Reads a certain number of bytes from a given file / file descriptor, but stops at the start of a hole
+// (a range of a sparse file that no disk blocks are allocated for), and skips the hole instead of reading
+// it if the file is at one. Files without holes, or on filesystems that do not report them, are read as
+// they are by read_bytes(). O_DIRECT reads stay whole IO_ALIGN blocks: they run up to the first block
+// boundary past the hole, and only whole blocks of a hole are skipped.
+// Returns the number of bytes read, which is 0 when a hole was skipped or at the end of the file
+//
+// infile: the file to read the bytes from
+// buf   : an array to store the read bytes into
+// nbytes: the number of bytes to attempt to read
+// hole  : set to the size of the hole skipped, 0 if none was; holes are not looked for if NULL
+int read_extent(int infile, uint8_t *buf, int nbytes, uint64_t *hole) {
+    if (hole) {
+        *hole = 0;
+    }
+#ifdef SEEK_HOLE
+    off_t at = hole && !(infile == pushed_file && pushed_index < pushed_size) ? lseek(infile, 0, SEEK_CUR) : -1;
+    off_t next = at < 0 ? -1 : lseek(infile, at, SEEK_HOLE);
+    off_t align = 1;
+#ifdef O_DIRECT
+    int status = at < 0 ? -1 : fcntl(infile, F_GETFL);
+    align = status >= 0 && (status & O_DIRECT) ? IO_ALIGN : 1;
+#endif
+    if (next >= 0 && next == at) {
+        // A hole runs up to the next data, or to the end of the file if there is none
+        struct stat sb;
+        off_t data = lseek(infile, at, SEEK_DATA);
+        if (data < 0 && fstat(infile, &sb) == 0) {
+            data = sb.st_size;
+        }
+        data = data / align * align;
+        if (data > at) {
+            lseek(infile, data, SEEK_SET);
+            *hole = data - at;
+            return 0;
+        }
+    }
+    if (at >= 0) {
+        lseek(infile, at, SEEK_SET);
+    }
+    next = (next + align - 1) / align * align;
+    if (next > at && next - at < nbytes) {
+        nbytes = next - at;
+    }
+#endif
+    return read_bytes(infile, buf, nbytes);
+}
+
+// Pushes bytes back onto a given file / file descriptor, ahead of any bytes already pushed back,
+// so that the next calls to read_bytes() return them.
+//
+// infile: the file the bytes were read from
+// buf   : the bytes to push back
+// nbytes: the number of bytes to push back
+void unread_bytes(int infile, uint8_t *buf, int nbytes) {
+    int32_t left = infile == pushed_file ? pushed_size - pushed_index : 0;
+    uint8_t *joined = (uint8_t *) malloc(nbytes + left + 1);
+    if (!joined) {
+        return;
+    }
+    memcpy(joined, buf, nbytes);
+    if (left > 0) {
+        memcpy(&joined[nbytes], &pushed[pushed_index], left);
+    }
+    free(pushed);
+    pushed = joined;
+    pushed_size = nbytes + left;
+    pushed_index = 0;
+    pushed_file = infile;
+    bytes_read -= nbytes;
+    return;
+}
+
 // Writes a certain number of bytes in to a given file / file descriptor.
 // Returns the number of bytes written
 //
@@ -39,15 +278,49 @@ int write_bytes(int outfile, uint8_t *buf, int nbytes) {
     // Write nbytes bytes
     while (curr_written < nbytes) {
         ssize_t value = write(outfile, &buf[curr_written], nbytes - curr_written);
+        if (value < 0 && errno == EINTR) {
+            continue;
+        }
         if (value <= 0) {
+            io_write_error = value < 0 ? errno : EIO;
             break;
         }
         curr_written += value;
     }
+    if (io_nocache && curr_written > 0) {
+        drop_behind(outfile, true);
+    }
     bytes_written += curr_written;
     return curr_written;
 }
 
+// Writes a certain number of zero bytes in to a given file / file descriptor. Regular files get a hole
+// instead: the file offset skips ahead, and the file is only extended, so no disk blocks are allocated.
+// Returns whether all the bytes were written or skipped
+//
+// outfile: the file to write the zero bytes in to
+// nbytes : the number of zero bytes
+bool write_hole(int outfile, uint64_t nbytes) {
+    struct stat sb;
+    off_t at = lseek(outfile, 0, SEEK_CUR);
+    if (at >= 0 && fstat(outfile, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        if ((uint64_t) sb.st_size < at + nbytes && ftruncate(outfile, at + nbytes) < 0) {
+            return false;
+        }
+        bytes_written += nbytes;
+        return lseek(outfile, at + nbytes, SEEK_SET) >= 0;
+    }
+    static uint8_t zeros[BLOCK];
+    while (nbytes > 0) {
+        int size = nbytes < BLOCK ? nbytes : BLOCK;
+        if (write_bytes(outfile, zeros, size) != size) {
+            return false;
+        }
+        nbytes -= size;
+    }
+    return true;
+}
+
 // Reads a bit from a given file / file descriptor.
 // Returns whether a bit was able to be read
 //
@@ -107,3 +380,53 @@ void flush_codes(int outfile) {
     code_index = 0;
     return;
 }
+
+// Grows a regular outfile by the size of the next member and maps that region so it can be decoded
+// into directly. The outfile must end exactly at offset, so nothing already in it is overwritten.
+// Returns the mapping, or NULL if the outfile is not a regular file, could not be mapped or has no room for
+// the region, in which case it is left as it was and the region has to be written out instead
+//
+// outfile: the file to map
+// offset : the position in the outfile the region starts at
+// nbytes : the size of the region
+uint8_t *map_output(int outfile, uint64_t offset, uint64_t nbytes) {
+    struct stat sb;
+    if (nbytes == 0 || fstat(outfile, &sb) < 0 || !S_ISREG(sb.st_mode) || (uint64_t) sb.st_size != offset) {
+        return NULL;
+    }
+    // Reserve the blocks in one go so the file is not fragmented, where the filesystem supports it. A store
+    // into a page the filesystem has no room for raises SIGBUS, so a full filesystem must be found here.
+    if (ftruncate(outfile, offset + nbytes) < 0) {
+        return NULL;
+    }
+    int reserved = posix_fallocate(outfile, offset, nbytes);
+    if (reserved != 0 && reserved != EOPNOTSUPP && reserved != EINVAL) {
+        // Give back the length taken above, so that the region is written out from where the file ends
+        if (ftruncate(outfile, offset) < 0) {
+            io_write_error = errno;
+        }
+        return NULL;
+    }
+    uint64_t skew = offset % sysconf(_SC_PAGESIZE);
+    void *map = mmap(NULL, nbytes + skew, PROT_READ | PROT_WRITE, MAP_SHARED, outfile, offset - skew);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(map, nbytes + skew, MADV_SEQUENTIAL);
+    lseek(outfile, offset + nbytes, SEEK_SET);
+    return (uint8_t *) map + skew;
+}
+
+// Unmaps a region mapped by map_output(), counting its bytes as written.
+//
+// map   : the mapping, or NULL if the region was not mapped
+// offset: the position in the outfile the region starts at
+// nbytes: the size of the region
+void unmap_output(uint8_t *map, uint64_t offset, uint64_t nbytes) {
+    if (map) {
+        uint64_t skew = offset % sysconf(_SC_PAGESIZE);
+        munmap(map - skew, nbytes + skew);
+        bytes_written += nbytes;
+    }
+    return;
+}
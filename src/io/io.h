@@ -6,13 +6,41 @@
 
 extern uint64_t bytes_read;
 extern uint64_t bytes_written;
+extern int io_error;
+extern int io_write_error;
+extern uint32_t io_size;
+extern bool io_nocache;
+
+bool set_io_size(const char *size);
+
+uint8_t *io_alloc(uint64_t nbytes);
+
+int open_input(const char *path, bool direct);
+
+void advise_input(int infile);
 
 int read_bytes(int infile, uint8_t *buf, int nbytes);
 
+bool reads_ok(void);
+
+int read_ready(int infile, uint8_t *buf, int nbytes, int timeout);
+
+int read_extent(int infile, uint8_t *buf, int nbytes, uint64_t *hole);
+
+void unread_bytes(int infile, uint8_t *buf, int nbytes);
+
 int write_bytes(int outfile, uint8_t *buf, int nbytes);
 
+bool writes_ok(void);
+
+bool write_hole(int outfile, uint64_t nbytes);
+
 bool read_bit(int infile, uint8_t *bit);
 
 void write_code(int outfile, Code *c);
 
 void flush_codes(int outfile);
+
+uint8_t *map_output(int outfile, uint64_t offset, uint64_t nbytes);
+
+void unmap_output(uint8_t *map, uint64_t offset, uint64_t nbytes);
@@ -0,0 +1,28 @@
+#include "cpu.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Detects the widest vector kernels the CPU supports via cpuid. The HUFF_SIMD environment variable
+// (scalar, avx2 or avx512) caps the level so the vector kernels can be cross-checked against the
+// scalar ones.
+// Returns the vector level to dispatch kernels for
+CpuLevel cpu_level(void) {
+    CpuLevel level = CPU_SCALAR;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        level = CPU_AVX2;
+    }
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")
+        && __builtin_cpu_supports("avx512vpopcntdq")) {
+        level = CPU_AVX512;
+    }
+#endif
+    char *cap = getenv("HUFF_SIMD");
+    if (cap && strcmp(cap, "scalar") == 0) {
+        level = CPU_SCALAR;
+    } else if (cap && strcmp(cap, "avx2") == 0 && level > CPU_AVX2) {
+        level = CPU_AVX2;
+    }
+    return level;
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+typedef enum { CPU_SCALAR, CPU_AVX2, CPU_AVX512 } CpuLevel;
+
+CpuLevel cpu_level(void);
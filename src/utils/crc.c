@@ -0,0 +1,92 @@
+#include "crc.h"
+#include <string.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define POLYNOMIAL 0x82F63B78 // Reflected Castagnoli polynomial.
+
+static uint32_t table[8][256];
+static uint32_t (*crc_kernel)(uint32_t crc, const uint8_t *buf, uint64_t nbytes);
+
+// Updates a CRC32C using eight table lookups per 8 bytes (slice-by-8).
+// Returns the updated (non-inverted) crc
+//
+// crc   : the running crc
+// buf   : the bytes to checksum
+// nbytes: the number of bytes in buf
+static uint32_t crc32c_soft(uint32_t crc, const uint8_t *buf, uint64_t nbytes) {
+    uint64_t word;
+    while (nbytes >= 8) {
+        memcpy(&word, buf, sizeof(word));
+        word ^= crc;
+        crc = table[7][word & 0xFF] ^ table[6][(word >> 8) & 0xFF] ^ table[5][(word >> 16) & 0xFF]
+              ^ table[4][(word >> 24) & 0xFF] ^ table[3][(word >> 32) & 0xFF]
+              ^ table[2][(word >> 40) & 0xFF] ^ table[1][(word >> 48) & 0xFF]
+              ^ table[0][word >> 56];
+        buf += 8;
+        nbytes -= 8;
+    }
+    while (nbytes--) {
+        crc = table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+// Updates a CRC32C using the SSE4.2 crc32 instruction.
+// Returns the updated (non-inverted) crc
+//
+// crc   : the running crc
+// buf   : the bytes to checksum
+// nbytes: the number of bytes in buf
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hard(
+    uint32_t crc, const uint8_t *buf, uint64_t nbytes) {
+    uint64_t word, wide = crc;
+    while (nbytes >= 8) {
+        memcpy(&word, buf, sizeof(word));
+        wide = _mm_crc32_u64(wide, word);
+        buf += 8;
+        nbytes -= 8;
+    }
+    crc = (uint32_t) wide;
+    while (nbytes--) {
+        crc = _mm_crc32_u8(crc, *buf++);
+    }
+    return crc;
+}
+#endif
+
+// Builds the slice-by-8 tables and picks the fastest kernel the CPU supports.
+__attribute__((constructor)) static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+        }
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (uint8_t slice = 1; slice < 8; slice++) {
+            table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+        }
+    }
+    crc_kernel = crc32c_soft;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_kernel = crc32c_hard;
+    }
+#endif
+    return;
+}
+
+// Continues a CRC32C (Castagnoli) checksum over a buffer.
+// Returns the updated checksum; pass 0 to start a new one
+//
+// crc   : the checksum of the preceding bytes
+// buf   : the bytes to checksum
+// nbytes: the number of bytes in buf
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, uint64_t nbytes) {
+    return ~crc_kernel(~crc, buf, nbytes);
+}
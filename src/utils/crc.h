@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdint.h>
+
+uint32_t crc32c(uint32_t crc, const uint8_t *buf, uint64_t nbytes);
@@ -1,4 +1,5 @@
 #include "node.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -6,7 +7,7 @@
 //
 // frequency: the frequency (number of occurences) of the symbol
 // symbol   : the symbol of the node
-Node *node_create(uint8_t symbol, uint64_t frequency) {
+Node *node_create(uint16_t symbol, uint64_t frequency) {
     Node *node = (Node *) calloc(1, sizeof(Node));
     if (node) {
         node->symbol = symbol;
@@ -42,7 +43,7 @@ Node *node_join(Node *left, Node *right) {
 // n: the node to start the print from
 void node_print(Node *n) {
     if (n) {
-        printf("Symbol: %" PRIu8 ", frequency: %" PRIu64 "\n", n->symbol, n->frequency);
+        printf("Symbol: %" PRIu16 ", frequency: %" PRIu64 "\n", n->symbol, n->frequency);
         node_print(n->left);
         node_print(n->right);
     }
@@ -7,11 +7,11 @@ typedef struct Node Node;
 struct Node {
     Node *left;
     Node *right;
-    uint8_t symbol;
+    uint16_t symbol;
     uint64_t frequency;
 };
 
-Node *node_create(uint8_t symbol, uint64_t frequency);
+Node *node_create(uint16_t symbol, uint64_t frequency);
 
 void node_delete(Node **n);
 
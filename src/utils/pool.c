@@ -0,0 +1,165 @@
+#include "pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+typedef struct {
+    Job job;
+    void *arg;
+} Task;
+
+typedef struct {
+    Pool *pool;
+    uint32_t index;
+} Worker;
+
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t idle;
+    uint32_t threads;
+    uint32_t running;
+    bool stopping;
+    uint32_t head;
+    uint32_t size;
+    uint32_t capacity;
+    Task *tasks;
+    Worker *workers;
+    pthread_t *ids;
+};
+
+// Runs queued jobs until the pool is stopped and its queue drained.
+//
+// arg: the worker running the loop
+static void *work(void *arg) {
+    Worker *w = (Worker *) arg;
+    Pool *p = w->pool;
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (p->size == 0 && !p->stopping) {
+            pthread_cond_wait(&p->ready, &p->lock);
+        }
+        if (p->size == 0) {
+            break;
+        }
+        Task task = p->tasks[p->head];
+        p->head = (p->head + 1) % p->capacity;
+        p->size -= 1;
+        p->running += 1;
+        pthread_mutex_unlock(&p->lock);
+        task.job(task.arg, w->index);
+        pthread_mutex_lock(&p->lock);
+        p->running -= 1;
+        if (p->size == 0 && p->running == 0) {
+            pthread_cond_broadcast(&p->idle);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Initializes a pool of worker threads.
+//
+// threads: the number of worker threads
+Pool *pool_create(uint32_t threads) {
+    Pool *p = threads ? (Pool *) calloc(1, sizeof(Pool)) : NULL;
+    if (!p) {
+        return NULL;
+    }
+    p->capacity = 2 * threads;
+    p->tasks = (Task *) calloc(p->capacity, sizeof(Task));
+    p->workers = (Worker *) calloc(threads, sizeof(Worker));
+    p->ids = (pthread_t *) calloc(threads, sizeof(pthread_t));
+    if (!p->tasks || !p->workers || !p->ids) {
+        free(p->tasks);
+        free(p->workers);
+        free(p->ids);
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->ready, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    for (uint32_t i = 0; i < threads; i++) {
+        p->workers[i] = (Worker) { p, i };
+        if (pthread_create(&p->ids[i], NULL, work, &p->workers[i]) != 0) {
+            break;
+        }
+        p->threads += 1;
+    }
+    if (p->threads == 0) {
+        pool_delete(&p);
+    }
+    return p;
+}
+
+// Waits for every queued job to finish, then stops and frees the pool.
+//
+// p: the pool to free
+void pool_delete(Pool **p) {
+    if (*p) {
+        pthread_mutex_lock(&(*p)->lock);
+        (*p)->stopping = true;
+        pthread_cond_broadcast(&(*p)->ready);
+        pthread_mutex_unlock(&(*p)->lock);
+        for (uint32_t i = 0; i < (*p)->threads; i++) {
+            pthread_join((*p)->ids[i], NULL);
+        }
+        pthread_mutex_destroy(&(*p)->lock);
+        pthread_cond_destroy(&(*p)->ready);
+        pthread_cond_destroy(&(*p)->idle);
+        free((*p)->tasks);
+        free((*p)->workers);
+        free((*p)->ids);
+        free(*p);
+        *p = NULL;
+    }
+    return;
+}
+
+// Returns the number of worker threads in the pool.
+//
+// p: the pool to check
+uint32_t pool_threads(Pool *p) {
+    return p->threads;
+}
+
+// Queues a job for the next free worker, growing the queue if it is full.
+// Returns whether the job could be queued
+//
+// p  : the pool to run the job on
+// job: the function to run, which is passed arg and the index of the worker running it
+// arg: the argument to pass to job
+bool pool_submit(Pool *p, Job job, void *arg) {
+    pthread_mutex_lock(&p->lock);
+    if (p->size == p->capacity) {
+        Task *tasks = (Task *) malloc(2 * p->capacity * sizeof(Task));
+        if (!tasks) {
+            pthread_mutex_unlock(&p->lock);
+            return false;
+        }
+        for (uint32_t i = 0; i < p->size; i++) {
+            tasks[i] = p->tasks[(p->head + i) % p->capacity];
+        }
+        free(p->tasks);
+        p->tasks = tasks;
+        p->head = 0;
+        p->capacity *= 2;
+    }
+    p->tasks[(p->head + p->size) % p->capacity] = (Task) { job, arg };
+    p->size += 1;
+    pthread_cond_signal(&p->ready);
+    pthread_mutex_unlock(&p->lock);
+    return true;
+}
+
+// Waits until the queue is empty and no job is running.
+//
+// p: the pool to wait on
+void pool_wait(Pool *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->size > 0 || p->running > 0) {
+        pthread_cond_wait(&p->idle, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return;
+}
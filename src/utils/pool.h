@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Pool Pool;
+
+typedef void (*Job)(void *arg, uint32_t worker);
+
+Pool *pool_create(uint32_t threads);
+
+void pool_delete(Pool **p);
+
+uint32_t pool_threads(Pool *p);
+
+bool pool_submit(Pool *p, Job job, void *arg);
+
+void pool_wait(Pool *p);
@@ -1,4 +1,5 @@
 #include "pq.h"
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -106,7 +107,7 @@ bool dequeue(PriorityQueue *q, Node **n) {
 // q: the priority queue to print
 void pq_print(PriorityQueue *q) {
     for (uint32_t father = 0; father < q->head; father++) {
-        printf("node: %" PRIu8 ", freq%" PRIu64 "\n", q->nodes[father]->symbol, q->nodes[father]->frequency);
+        printf("node: %" PRIu16 ", freq%" PRIu64 "\n", q->nodes[father]->symbol, q->nodes[father]->frequency);
     }
     printf("-----------\n");
     return;